@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_renderer.h"
+#include "escape_time.h"
+#include "scenes.h"
+#include "tile_scheduler.h"
+
+// Benchmarks the CPU escape-time kernels and the full frame pipeline on a
+// fixed set of views, so performance changes can be measured and compared
+// against stored baselines.
+//
+// Two modes are timed for every view and SIMD level:
+//   kernel  iteration counts only, one thread, row by row
+//   frame   renderFrame() with tiles, stealing and shading, per thread count
+
+struct BenchView {
+    const char* name;
+    const char* description;
+    SceneKind scene;
+    float time;                  // iTime the scene is evaluated at
+    bool fixedView = false;      // Use centerX/centerY/zoom below instead of the animation
+    float centerX = 0.0f;
+    float centerY = 0.0f;
+    double zoom = 0.0;
+    const char* deepRe = nullptr;   // Perturbation deep zoom around this centre
+    const char* deepIm = nullptr;
+    int maxIter = 0;             // 0 = the scene's MAX_ITER
+    Formula formula = Formula::Quadratic;
+};
+
+std::vector<BenchView> benchViews() {
+    std::vector<BenchView> views(7);
+    views[0] = {"fractal", "fractal.cpp blend at iCenter (0.15, 0)", SceneKind::Fractal, 20.0f};
+    views[1] = {"seahorse", "mandelbrot.cpp seahorse valley zoom", SceneKind::Mandelbrot, 30.0f};
+    views[2] = {"julia", "julia.cpp with the animated constant around (-0.8, 0.156)", SceneKind::Julia, 20.0f};
+    views[3] = {"interior", "main cardioid only", SceneKind::Mandelbrot, 0.0f, true, -0.15f, 0.0f, 20.0};
+    views[4] = {"deep", "perturbation zoom to 1e30 at the Misiurewicz point (0, 1)", SceneKind::Mandelbrot, 0.0f,
+                true, 0.0f, 1.0f, 1e30, "0", "1", 2000};
+    views[5] = {"burning-ship", "the burning ship formula around the ship at (-1.755, -0.03)", SceneKind::Mandelbrot,
+                0.0f, true, -1.755f, -0.03f, 50.0, nullptr, nullptr, 0, Formula::BurningShip};
+    views[6] = {"multibrot3", "the whole z^3 + c set, without cardioid/bulb rejection", SceneKind::Mandelbrot, 0.0f,
+                true, 0.0f, 0.0f, 1.5, nullptr, nullptr, 0, Formula::Multibrot3};
+    return views;
+}
+
+struct BenchOptions {
+    int width = 1280;
+    int height = 720;
+    int frames = 10;             // Timed frames per configuration, after one warm-up frame
+    int tileSize = 64;
+    std::vector<std::string> views;     // Empty = all
+    std::vector<SimdLevel> kernels;     // Empty = every level the CPU supports
+    std::vector<int> threads;           // Empty = 1 and one per hardware thread
+    std::string json;            // Write results here
+    std::string baseline;        // Compare against these results
+    double tolerance = 0.10;     // Allowed pixels/s drop before a result counts as a regression
+};
+
+struct BenchResult {
+    std::string view;
+    std::string mode;
+    std::string kernel;
+    int threads = 1;
+    double pixelsPerSecond = 0.0;
+    double iterationsPerSecond = 0.0;
+    double latencyMs[5] = {};    // min, p50, p90, p99, max
+};
+
+const char* const kLatencyNames[5] = {"min", "p50", "p90", "p99", "max"};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --size WxH           Frame size (default 1280x720)\n"
+              << "  --frames N           Timed frames per configuration (default 10)\n"
+              << "  --views LIST         Comma separated subset of fractal,seahorse,julia,interior,deep,\n"
+              << "                       burning-ship,multibrot3\n"
+              << "  --simd LIST          Comma separated kernels (default: all supported)\n"
+              << "  --threads LIST       Comma separated thread counts for frame mode\n"
+              << "                       (default: 1 and one per hardware thread)\n"
+              << "  --tile N             Tile edge length in pixels (default 64)\n"
+              << "  --json PATH          Write the results as JSON\n"
+              << "  --baseline PATH      Compare pixels/s against a stored --json file\n"
+              << "  --tolerance F        Slowdown counted as a regression (default 0.10)" << std::endl;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                std::cerr << "Invalid --size, expected WxH" << std::endl;
+                return false;
+            }
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::atoi(argv[++i]);
+        } else if (arg == "--views" && hasValue) {
+            options.views = splitList(argv[++i]);
+        } else if (arg == "--simd" && hasValue) {
+            for (const std::string& name : splitList(argv[++i])) {
+                SimdLevel level;
+                if (!parseSimdLevel(name.c_str(), level)) {
+                    std::cerr << "Unknown SIMD level " << name << std::endl;
+                    return false;
+                }
+                if (level > detectSimdLevel()) {
+                    std::cerr << name << " is not supported on this CPU" << std::endl;
+                    return false;
+                }
+                options.kernels.push_back(level);
+            }
+        } else if (arg == "--threads" && hasValue) {
+            for (const std::string& count : splitList(argv[++i]))
+                options.threads.push_back(std::atoi(count.c_str()));
+        } else if (arg == "--tile" && hasValue) {
+            options.tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--json" && hasValue) {
+            options.json = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            options.baseline = argv[++i];
+        } else if (arg == "--tolerance" && hasValue) {
+            options.tolerance = std::atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.frames < 1 || options.tileSize < 1) {
+        std::cerr << "--frames and --tile must be positive" << std::endl;
+        return false;
+    }
+    for (int threads : options.threads) {
+        if (threads < 1) {
+            std::cerr << "--threads counts must be positive" << std::endl;
+            return false;
+        }
+    }
+
+    if (options.kernels.empty()) {
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Avx512})
+            if (level <= detectSimdLevel()) options.kernels.push_back(level);
+    }
+    if (options.threads.empty()) {
+        options.threads.push_back(1);
+        int hardware = (int)std::max(1u, std::thread::hardware_concurrency());
+        if (hardware > 1) options.threads.push_back(hardware);
+    }
+    return true;
+}
+
+// Scene, render modes and reference orbit of one view at the benchmark size.
+struct PreparedView {
+    Scene scene;
+    DeepFrame deep;
+    bool isDeep = false;
+};
+
+bool prepareView(const BenchView& view, const BenchOptions& options, PreparedView& prepared) {
+    Scene& scene = prepared.scene;
+    scene = makeScene(view.scene, view.time, options.width, options.height);
+    if (view.maxIter > 0) scene.primary.maxIter = scene.secondary.maxIter = view.maxIter;
+    scene.primary.formula = scene.secondary.formula = view.formula;
+    if (view.fixedView) {
+        scene.viewport.centerX = view.centerX;
+        scene.viewport.centerY = view.centerY;
+        scene.viewport.zoom = (float)view.zoom;
+    }
+    prepared.isDeep = view.deepRe != nullptr;
+    if (!prepared.isDeep) return true;
+    return setupDeepFrame(scene, view.zoom, view.deepRe, view.deepIm, prepared.deep);
+}
+
+// Nearest-rank percentiles of the frame times.
+void latencyPercentiles(std::vector<double> ms, double out[5]) {
+    std::sort(ms.begin(), ms.end());
+    const double ranks[5] = {0.0, 0.5, 0.9, 0.99, 1.0};
+    for (int i = 0; i < 5; i++) {
+        size_t index = (size_t)std::ceil(ranks[i] * ms.size());
+        out[i] = ms[std::min(ms.size() - 1, index > 0 ? index - 1 : 0)];
+    }
+}
+
+// Sum of a field's iteration counts. Pixels resolved by an interior
+// shortcut count iterations that never ran; callers subtract those.
+uint64_t fieldIterations(const std::vector<uint32_t>& iters) {
+    uint64_t total = 0;
+    for (uint32_t count : iters) total += count;
+    return total;
+}
+
+template <typename Fn>
+BenchResult timeFrames(const BenchOptions& options, uint64_t iterationsPerFrame, Fn renderOnce) {
+    renderOnce();   // Warm-up: page faults, reference orbit caches, worker start-up
+    std::vector<double> ms;
+    double total = 0.0;
+    for (int frame = 0; frame < options.frames; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        renderOnce();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ms.push_back(seconds * 1e3);
+        total += seconds;
+    }
+    BenchResult result;
+    double pixels = (double)options.width * options.height * options.frames;
+    result.pixelsPerSecond = pixels / total;
+    result.iterationsPerSecond = (double)iterationsPerFrame * options.frames / total;
+    latencyPercentiles(ms, result.latencyMs);
+    return result;
+}
+
+// Iteration counts of every pixel on one thread, without tiles or shading.
+BenchResult benchKernel(PreparedView& prepared, SimdLevel simd, const BenchOptions& options) {
+    const Scene& scene = prepared.scene;
+    int width = options.width, height = options.height;
+    std::vector<uint32_t> primary((size_t)width * height), secondary;
+    if (scene.kind == SceneKind::Fractal) secondary.resize(primary.size());
+
+    // Only the first frame counts its shortcuts, for the iterations per frame
+    EscapeStats escape;
+    EscapeStats* counting = &escape;
+    auto renderOnce = [&] {
+        for (int row = 0; row < height; row++) {
+            uint32_t* out = &primary[(size_t)row * width];
+            if (prepared.isDeep) {
+                perturbRow(prepared.deep.orbit, prepared.deep.view, row, 0, width, scene.primary.maxIter, out, simd,
+                           prepared.deep.stats);
+            } else {
+                escapeRow(scene.primary, scene.viewport, row, 0, width, out, simd, counting);
+            }
+            if (!secondary.empty())
+                escapeRow(scene.secondary, scene.viewport, row, 0, width, &secondary[(size_t)row * width], simd,
+                          counting);
+        }
+    };
+    renderOnce();
+    counting = nullptr;
+    // Iterations the kernels ran: less what the interior shortcuts credited
+    // without running (escape.skipped), so shortcuts show up as fewer
+    // iterations rather than as a faster loop
+    uint64_t iterations = fieldIterations(primary) + fieldIterations(secondary) - escape.skipped;
+    return timeFrames(options, iterations, renderOnce);
+}
+
+// The complete cpurender pipeline: tiles on the scheduler, shading included.
+BenchResult benchFrame(PreparedView& prepared, SimdLevel simd, int threads, const BenchOptions& options) {
+    TileScheduler scheduler(threads);
+    FrameBuffers frame;
+    frame.resize(options.width, options.height, options.tileSize);
+    RenderModes modes;
+    if (prepared.isDeep) modes.deep = &prepared.deep;
+
+    auto renderOnce = [&] { renderFrame(prepared.scene, simd, scheduler, frame, modes); };
+    WorkerStats stats = renderFrame(prepared.scene, simd, scheduler, frame, modes);
+    std::vector<uint32_t> field;
+    frame.primary.copyTo(field);
+    uint64_t iterations = fieldIterations(field);
+    if (prepared.scene.kind == SceneKind::Fractal) {
+        frame.secondary.copyTo(field);
+        iterations += fieldIterations(field);
+    }
+    iterations -= stats.escape.skipped;   // Only the iterations the kernels ran, as in benchKernel
+    return timeFrames(options, iterations, renderOnce);
+}
+
+void printResult(const BenchResult& result) {
+    std::printf("  %-6s %-7s %3d thread(s): %8.2f Mpixel/s %9.1f Miter/s   ms min %.2f p50 %.2f p90 %.2f p99 %.2f "
+                "max %.2f\n",
+                result.mode.c_str(), result.kernel.c_str(), result.threads, result.pixelsPerSecond / 1e6,
+                result.iterationsPerSecond / 1e6, result.latencyMs[0], result.latencyMs[1], result.latencyMs[2],
+                result.latencyMs[3], result.latencyMs[4]);
+}
+
+// One result object per line, so baselines can be read back line by line.
+bool writeJson(const std::string& path, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+    std::fprintf(file, "{\n  \"width\": %d, \"height\": %d, \"frames\": %d, \"tile\": %d,\n", options.width,
+                 options.height, options.frames, options.tileSize);
+    std::fprintf(file, "  \"cpu_simd\": \"%s\", \"hardware_threads\": %u,\n", simdLevelName(detectSimdLevel()),
+                 std::thread::hardware_concurrency());
+    std::fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        std::fprintf(file,
+                     "    {\"view\": \"%s\", \"mode\": \"%s\", \"kernel\": \"%s\", \"threads\": %d, "
+                     "\"pixels_per_s\": %.6g, \"iterations_per_s\": %.6g, \"latency_ms\": {",
+                     r.view.c_str(), r.mode.c_str(), r.kernel.c_str(), r.threads, r.pixelsPerSecond,
+                     r.iterationsPerSecond);
+        for (int p = 0; p < 5; p++)
+            std::fprintf(file, "%s\"%s\": %.4f", p ? ", " : "", kLatencyNames[p], r.latencyMs[p]);
+        std::fprintf(file, "}}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    return std::fclose(file) == 0;
+}
+
+// Reads a string or number field from one result line of writeJson().
+bool jsonField(const std::string& line, const std::string& key, std::string& value) {
+    std::string pattern = "\"" + key + "\": ";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos) return false;
+    pos += pattern.size();
+    if (line[pos] == '"') {
+        size_t end = line.find('"', pos + 1);
+        if (end == std::string::npos) return false;
+        value = line.substr(pos + 1, end - pos - 1);
+    } else {
+        size_t end = line.find_first_of(",}", pos);
+        value = line.substr(pos, end - pos);
+    }
+    return true;
+}
+
+bool readBaseline(const std::string& path, std::vector<BenchResult>& baseline) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        BenchResult result;
+        std::string threads, pixels;
+        if (!jsonField(line, "view", result.view) || !jsonField(line, "mode", result.mode) ||
+            !jsonField(line, "kernel", result.kernel) || !jsonField(line, "threads", threads) ||
+            !jsonField(line, "pixels_per_s", pixels))
+            continue;
+        result.threads = std::atoi(threads.c_str());
+        result.pixelsPerSecond = std::atof(pixels.c_str());
+        baseline.push_back(result);
+    }
+    return true;
+}
+
+// Prints the change against the baseline for every configuration both
+// runs have and returns how many got slower than the tolerance allows.
+int compareBaseline(const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline,
+                    double tolerance) {
+    int regressions = 0;
+    std::printf("\nAgainst baseline (tolerance %.0f%%):\n", tolerance * 100.0);
+    for (const BenchResult& r : results) {
+        auto match = std::find_if(baseline.begin(), baseline.end(), [&](const BenchResult& b) {
+            return b.view == r.view && b.mode == r.mode && b.kernel == r.kernel && b.threads == r.threads;
+        });
+        if (match == baseline.end() || match->pixelsPerSecond <= 0.0) continue;
+        double change = r.pixelsPerSecond / match->pixelsPerSecond - 1.0;
+        bool regressed = change < -tolerance;
+        regressions += regressed;
+        std::printf("  %-8s %-6s %-7s %3d thread(s): %+6.1f%%%s\n", r.view.c_str(), r.mode.c_str(),
+                    r.kernel.c_str(), r.threads, change * 100.0, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) return -1;
+
+    std::vector<BenchView> views;
+    for (const BenchView& view : benchViews()) {
+        if (options.views.empty() || std::find(options.views.begin(), options.views.end(), view.name) !=
+                                         options.views.end())
+            views.push_back(view);
+    }
+    if (views.empty()) {
+        std::cerr << "No known view selected" << std::endl;
+        return -1;
+    }
+
+    std::printf("Benchmarking at %dx%d, %d frame(s) per configuration\n", options.width, options.height,
+                options.frames);
+    std::vector<BenchResult> results;
+    for (const BenchView& view : views) {
+        PreparedView prepared;
+        if (!prepareView(view, options, prepared)) return -1;
+        std::printf("%s: %s\n", view.name, view.description);
+        for (SimdLevel simd : options.kernels) {
+            BenchResult kernel = benchKernel(prepared, simd, options);
+            kernel.view = view.name;
+            kernel.mode = "kernel";
+            kernel.kernel = simdLevelName(simd);
+            printResult(kernel);
+            results.push_back(kernel);
+
+            for (int threads : options.threads) {
+                BenchResult frame = benchFrame(prepared, simd, threads, options);
+                frame.view = view.name;
+                frame.mode = "frame";
+                frame.kernel = simdLevelName(simd);
+                frame.threads = threads;
+                printResult(frame);
+                results.push_back(frame);
+            }
+        }
+    }
+
+    if (!options.json.empty() && !writeJson(options.json, options, results)) return -1;
+    if (!options.baseline.empty()) {
+        std::vector<BenchResult> baseline;
+        if (!readBaseline(options.baseline, baseline)) return -1;
+        if (compareBaseline(results, baseline, options.tolerance) > 0) return 1;
+    }
+    return 0;
+}
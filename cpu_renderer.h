@@ -0,0 +1,240 @@
+#pragma once
+
+// Frame pipeline of the CPU renderer, shared by cpurender and bench: tiles
+// are dealt to the scheduler's workers, each of which produces a tile's
+// iteration counts (directly, by perturbation, by subdivision or from the
+// temporal cache) and colours it like the shaders do.
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "deep_zoom.h"
+#include "escape_time.h"
+#include "image.h"
+#include "mariani_silver.h"
+#include "scenes.h"
+#include "temporal_cache.h"
+#include "tile_scheduler.h"
+
+// Scratch lists of the pixels in a row that the temporal cache could not
+// supply, one per worker. Each row clears and refills them, so they sit on
+// cache lines of their own.
+struct alignas(kCacheLine) RecomputeList {
+    std::vector<int> slots;
+    std::vector<int> interiorSlots;
+    std::vector<float> xs, ys;
+    std::vector<uint32_t> iters;
+};
+
+// Per-frame buffers, reused across frames so rendering does not allocate.
+struct FrameBuffers {
+    std::vector<Tile> tiles;
+    TiledBuffer<uint32_t> primary;
+    TiledBuffer<uint32_t> secondary;
+    Image image;
+    std::vector<RecomputeList> recompute; // One per worker, sized by renderFrame()
+    std::vector<MarianiSilver> subdivision; // One per worker, sized by renderFrame()
+
+    void resize(int width, int height, int tileSize) {
+        if (primary.width == width && primary.height == height && primary.tileSize == tileSize) return;
+        tiles = makeTiles(width, height, tileSize);
+        primary.resize(width, height, tileSize);
+        secondary.resize(width, height, tileSize);
+        image.resize(width, height);
+    }
+};
+
+// Reference orbit and high precision view of one deep zoom frame.
+struct DeepFrame {
+    DeepViewport view;
+    ReferenceOrbit orbit;
+    PerturbationStats stats;
+};
+
+// Sets up a deep zoom of scene's view at zoom around centerRe/centerIm
+// (decimal strings), or around the animated centre of mandelbrot.cpp when
+// they are empty, and computes the reference orbit there.
+inline bool setupDeepFrame(const Scene& scene, double zoom, const std::string& centerRe,
+                           const std::string& centerIm, DeepFrame& deep) {
+    deep.view.width = scene.viewport.width;
+    deep.view.height = scene.viewport.height;
+    deep.view.pixelSize = 1.0 / (scene.viewport.height * (double)scene.viewport.heightScale * zoom);
+    int limbs = BigFixed::limbsForPixelSize(deep.view.pixelSize);
+    if (!centerRe.empty()) {
+        if (!BigFixed::parse(centerRe, limbs, deep.view.centerX) ||
+            !BigFixed::parse(centerIm, limbs, deep.view.centerY)) {
+            std::cerr << "Invalid --center value" << std::endl;
+            return false;
+        }
+    } else {
+        // The animated centre of mandelbrot.cpp, evaluated in double
+        double t = scene.time;
+        deep.view.centerX = BigFixed::fromDouble(-0.745428 + 0.01 * std::sin(t * 0.15), limbs);
+        deep.view.centerY = BigFixed::fromDouble(0.131825 + 0.01 * std::cos(t * 0.1), limbs);
+    }
+    deep.orbit = computeReferenceOrbit(deep.view.centerX, deep.view.centerY, scene.primary.maxIter);
+    deep.stats.rebases = 0;
+    deep.stats.glitches = 0;
+    return true;
+}
+
+// How the iteration counts of a frame are produced; at most one mode is set.
+struct RenderModes {
+    DeepFrame* deep = nullptr;
+    const SubdivisionOptions* subdivision = nullptr;
+    TemporalCache* cache = nullptr;
+};
+
+// Interior shortcut, subdivision and reuse counters of one worker, on its own cache line.
+struct alignas(kCacheLine) WorkerStats {
+    EscapeStats escape;
+    SubdivisionStats subdivision;
+    ReuseStats reuse;
+};
+
+// Takes what it can of one row from the temporal cache and iterates the rest
+// as one batch of points. The leftovers are scattered across the row, so
+// pixels that were interior last frame are batched after the others; one
+// MAX_ITER lane would otherwise hold up a whole SIMD group of short orbits.
+inline void reuseRow(const Scene& scene, SimdLevel simd, TemporalCache& cache, int row, int x0, int count,
+                     uint32_t* primary, uint32_t* secondary, RecomputeList& list, WorkerStats& stats) {
+    list.slots.clear();
+    list.interiorSlots.clear();
+    for (int i = 0; i < count; i++) {
+        uint32_t dwellHint;
+        if (cache.reuse(x0 + i, row, primary[i], secondary[i], dwellHint, stats.reuse)) continue;
+        (dwellHint >= (uint32_t)scene.primary.maxIter ? list.interiorSlots : list.slots).push_back(i);
+    }
+    list.slots.insert(list.slots.end(), list.interiorSlots.begin(), list.interiorSlots.end());
+    int missing = (int)list.slots.size();
+    if (missing == 0) return;
+
+    list.xs.resize(missing);
+    list.ys.assign(missing, scene.viewport.pixelY((float)row));
+    list.iters.resize(missing);
+    for (int k = 0; k < missing; k++) list.xs[k] = scene.viewport.pixelX((float)(x0 + list.slots[k]));
+
+    escapePoints(scene.primary, list.xs.data(), list.ys.data(), missing, list.iters.data(), simd, &stats.escape);
+    for (int k = 0; k < missing; k++) primary[list.slots[k]] = list.iters[k];
+    if (scene.kind == SceneKind::Fractal) {
+        escapePoints(scene.secondary, list.xs.data(), list.ys.data(), missing, list.iters.data(), simd,
+                     &stats.escape);
+        for (int k = 0; k < missing; k++) secondary[list.slots[k]] = list.iters[k];
+    }
+    // Only fractal writes the secondary layer; elsewhere it is uninitialized
+    bool layered = scene.kind == SceneKind::Fractal;
+    for (int k = 0; k < missing; k++) {
+        int slot = list.slots[k];
+        cache.store(x0 + slot, row, list.xs[k], list.ys[k], primary[slot], layered ? secondary[slot] : 0);
+    }
+}
+
+// Iterates and colours one tile; iteration counts stay in the tile's own block.
+// With subdivision the tile is the top-level rectangle of each layer.
+inline void renderTile(const Scene& scene, SimdLevel simd, const Tile& tile, FrameBuffers& frame,
+                       const RenderModes& modes, RecomputeList& recompute, MarianiSilver& subdivision,
+                       WorkerStats& stats) {
+    if (modes.subdivision) {
+        subdivision.run(scene.primary, scene.viewport, simd, *modes.subdivision, &stats.escape, tile,
+                        frame.primary.tileRow(tile, 0), frame.primary.rowStride(), stats.subdivision);
+        if (scene.kind == SceneKind::Fractal) {
+            subdivision.run(scene.secondary, scene.viewport, simd, *modes.subdivision, &stats.escape, tile,
+                            frame.secondary.tileRow(tile, 0), frame.secondary.rowStride(), stats.subdivision);
+        }
+    }
+
+    for (int y = 0; y < tile.height; y++) {
+        int row = tile.y0 + y;
+        uint32_t* primary = frame.primary.tileRow(tile, y);
+        uint32_t* secondary = frame.secondary.tileRow(tile, y);
+        if (modes.deep) {
+            perturbRow(modes.deep->orbit, modes.deep->view, row, tile.x0, tile.width, scene.primary.maxIter,
+                       primary, simd, modes.deep->stats);
+        } else if (modes.cache) {
+            reuseRow(scene, simd, *modes.cache, row, tile.x0, tile.width, primary, secondary, recompute, stats);
+        } else if (!modes.subdivision) {
+            escapeRow(scene.primary, scene.viewport, row, tile.x0, tile.width, primary, simd, &stats.escape);
+            if (scene.kind == SceneKind::Fractal)
+                escapeRow(scene.secondary, scene.viewport, row, tile.x0, tile.width, secondary, simd,
+                          &stats.escape);
+        }
+
+        for (int x = 0; x < tile.width; x++) {
+            Rgb color = shadePixel(scene, tile.x0 + x, row, primary[x], secondary[x]);
+            storeRgb(color, frame.image.pixel(tile.x0 + x, row));
+        }
+    }
+}
+
+// Scratch counts and subdivision lists of one tile for renderTileRgb, one per worker.
+struct TileScratch {
+    std::vector<uint32_t> primary;
+    std::vector<uint32_t> secondary;
+    MarianiSilver subdivision;
+};
+
+// Iterates and colours one tile straight into rgb, whose rows are rgbStride
+// pixels apart, for images too large for FrameBuffers (posters, the tiles
+// of a render farm). The temporal cache is not used.
+inline void renderTileRgb(const Scene& scene, SimdLevel simd, const RenderModes& modes, const Tile& tile,
+                          uint8_t* rgb, size_t rgbStride, TileScratch& scratch, WorkerStats& stats) {
+    size_t stride = tile.width;
+    size_t pixels = (size_t)tile.width * tile.height;
+    if (scratch.primary.size() < pixels) {
+        scratch.primary.resize(pixels);
+        scratch.secondary.resize(pixels);
+    }
+    uint32_t* primary = scratch.primary.data();
+    uint32_t* secondary = scratch.secondary.data();
+    if (modes.subdivision) {
+        scratch.subdivision.run(scene.primary, scene.viewport, simd, *modes.subdivision, &stats.escape, tile,
+                                primary, stride, stats.subdivision);
+        if (scene.kind == SceneKind::Fractal) {
+            scratch.subdivision.run(scene.secondary, scene.viewport, simd, *modes.subdivision, &stats.escape,
+                                    tile, secondary, stride, stats.subdivision);
+        }
+    }
+
+    for (int y = 0; y < tile.height; y++) {
+        int row = tile.y0 + y;
+        uint32_t* primaryRow = primary + y * stride;
+        uint32_t* secondaryRow = secondary + y * stride;
+        if (modes.deep) {
+            perturbRow(modes.deep->orbit, modes.deep->view, row, tile.x0, tile.width, scene.primary.maxIter,
+                       primaryRow, simd, modes.deep->stats);
+        } else if (!modes.subdivision) {
+            escapeRow(scene.primary, scene.viewport, row, tile.x0, tile.width, primaryRow, simd, &stats.escape);
+            if (scene.kind == SceneKind::Fractal)
+                escapeRow(scene.secondary, scene.viewport, row, tile.x0, tile.width, secondaryRow, simd,
+                          &stats.escape);
+        }
+
+        uint8_t* out = rgb + y * rgbStride * 3;
+        for (int x = 0; x < tile.width; x++)
+            storeRgb(shadePixel(scene, tile.x0 + x, row, primaryRow[x], secondaryRow[x]), out + x * 3);
+    }
+}
+
+inline WorkerStats renderFrame(const Scene& scene, SimdLevel simd, TileScheduler& scheduler,
+                               FrameBuffers& frame, const RenderModes& modes) {
+    if (modes.cache) modes.cache->begin(scene);
+    std::vector<WorkerStats> workerStats(scheduler.threadCount());
+    if (frame.recompute.size() < workerStats.size()) frame.recompute.resize(workerStats.size());
+    if (frame.subdivision.size() < workerStats.size()) frame.subdivision.resize(workerStats.size());
+    scheduler.run(frame.tiles, [&](const Tile& tile, int worker) {
+        renderTile(scene, simd, tile, frame, modes, frame.recompute[worker], frame.subdivision[worker],
+                   workerStats[worker]);
+    });
+    if (modes.cache) modes.cache->end();
+
+    WorkerStats stats;
+    for (const WorkerStats& worker : workerStats) {
+        stats.escape += worker.escape;
+        stats.subdivision += worker.subdivision;
+        stats.reuse += worker.reuse;
+    }
+    return stats;
+}
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cpu_renderer.h"
+#include "escape_time.h"
+#include "image.h"
+#include "scenes.h"
+
+// CPU renderer for the three shader scenes, for machines without a GPU and
+// for cross-checking GPU frames against the native escape-time engine.
+
+struct CpuRenderOptions {
+    SceneKind scene = SceneKind::Mandelbrot;
+    Formula formula = Formula::Quadratic;
+    int width = 1920;
+    int height = 1080;
+    double fps = 60.0;
+    double startTime = 0.0;
+    long frames = 1;
+    SimdLevel simd = detectSimdLevel();
+    int threads = 0;          // 0 = one per hardware thread
+    int tileSize = 64;
+    bool pinThreads = false;
+    int maxIter = 0;          // 0 = the scene's MAX_ITER
+    bool interiorChecks = true;
+    bool deep = false;        // Perturbation deep zoom (mandelbrot scene only)
+    bool subdivide = false;   // Mariani-Silver subdivision instead of evaluating every pixel
+    SubdivisionOptions subdivision;
+    double reuseBudget = 0.0; // Temporal reuse error budget in pixels, 0 = recompute every pixel
+    std::string centerRe;     // Fixed view centre as decimal strings, empty = animated
+    std::string centerIm;
+    double zoom = 0.0;        // Fixed zoom, 0 = animated
+    std::string output;       // printf pattern for PPM frames
+    std::string itersOutput;  // printf pattern for raw uint32 iteration fields
+    std::string compare;      // printf pattern of GPU frames to compare against
+};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --scene NAME         mandelbrot, julia or fractal (default mandelbrot)\n"
+              << "  --formula NAME       quadratic, multibrot3, multibrot4, multibrot5, burning-ship or\n"
+              << "                       tricorn (default quadratic)\n"
+              << "  --size WxH           Frame size (default 1920x1080)\n"
+              << "  --fps N              Frame clock rate for iTime (default 60)\n"
+              << "  --start T            iTime of the first frame (default 0)\n"
+              << "  --frames N           Number of frames (default 1)\n"
+              << "  --simd LEVEL         scalar, sse2, avx2 or avx512 (default: widest supported)\n"
+              << "  --threads N          Worker threads (default: one per hardware thread)\n"
+              << "  --tile N             Tile edge length in pixels (default 64)\n"
+              << "  --pin                Pin worker threads to CPUs\n"
+              << "  --max-iter N         Override MAX_ITER\n"
+              << "  --no-interior-checks Disable cardioid/bulb and periodicity shortcuts\n"
+              << "  --subdivide          Fill rectangles with a uniform border instead of iterating them\n"
+              << "  --min-rect N         Smallest rectangle side --subdivide still splits (default 6)\n"
+              << "  --filament-dwell N   Never fill uniform exterior borders at or above this dwell\n"
+              << "  --reuse-budget P     Reuse previous-frame counts sampled within P pixels (e.g. 0.5)\n"
+              << "  --deep               Perturbation deep zoom with a high precision reference orbit\n"
+              << "  --center RE,IM       Fixed view centre, any number of decimal digits\n"
+              << "  --zoom Z             Fixed zoom factor instead of the animated one (e.g. 1e100)\n"
+              << "  --out PATTERN        Write PPM frames, e.g. out/cpu_%05d.ppm\n"
+              << "  --iters PATTERN      Write raw uint32 iteration counts of the primary layer\n"
+              << "  --compare PATTERN    Compare against PPM frames from --headless GPU renders" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, CpuRenderOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--scene" && hasValue) {
+            if (!parseSceneKind(argv[++i], options.scene)) {
+                std::cerr << "Unknown scene " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--formula" && hasValue) {
+            if (!parseFormula(argv[++i], options.formula)) {
+                std::cerr << "Unknown formula " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                std::cerr << "Invalid --size, expected WxH" << std::endl;
+                return false;
+            }
+        } else if (arg == "--fps" && hasValue) {
+            options.fps = std::atof(argv[++i]);
+        } else if (arg == "--start" && hasValue) {
+            options.startTime = std::atof(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::atol(argv[++i]);
+        } else if (arg == "--simd" && hasValue) {
+            if (!parseSimdLevel(argv[++i], options.simd)) {
+                std::cerr << "Unknown SIMD level " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::atoi(argv[++i]);
+        } else if (arg == "--tile" && hasValue) {
+            options.tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--pin") {
+            options.pinThreads = true;
+        } else if (arg == "--max-iter" && hasValue) {
+            options.maxIter = std::atoi(argv[++i]);
+        } else if (arg == "--no-interior-checks") {
+            options.interiorChecks = false;
+        } else if (arg == "--subdivide") {
+            options.subdivide = true;
+        } else if (arg == "--min-rect" && hasValue) {
+            options.subdivision.minSize = std::max(2, std::atoi(argv[++i]));
+        } else if (arg == "--filament-dwell" && hasValue) {
+            options.subdivision.filamentDwell = std::atoi(argv[++i]);
+        } else if (arg == "--reuse-budget" && hasValue) {
+            options.reuseBudget = std::atof(argv[++i]);
+        } else if (arg == "--deep") {
+            options.deep = true;
+        } else if (arg == "--center" && hasValue) {
+            std::string center = argv[++i];
+            size_t comma = center.find(',');
+            if (comma == std::string::npos) {
+                std::cerr << "Invalid --center, expected RE,IM" << std::endl;
+                return false;
+            }
+            options.centerRe = center.substr(0, comma);
+            options.centerIm = center.substr(comma + 1);
+        } else if (arg == "--zoom" && hasValue) {
+            options.zoom = std::atof(argv[++i]);
+        } else if (arg == "--out" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--iters" && hasValue) {
+            options.itersOutput = argv[++i];
+        } else if (arg == "--compare" && hasValue) {
+            options.compare = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.fps <= 0.0 || options.frames < 1 || options.tileSize < 1) {
+        std::cerr << "--fps, --frames and --tile must be positive" << std::endl;
+        return false;
+    }
+    if (options.deep && options.scene != SceneKind::Mandelbrot) {
+        std::cerr << "--deep is only available for the mandelbrot scene" << std::endl;
+        return false;
+    }
+    if (options.deep && options.formula != Formula::Quadratic) {
+        std::cerr << "--deep is only available for the quadratic formula" << std::endl;
+        return false;
+    }
+    if ((options.deep || options.reuseBudget > 0.0) && options.subdivide) {
+        std::cerr << "--subdivide cannot be combined with --deep or --reuse-budget" << std::endl;
+        return false;
+    }
+    if (options.deep && options.reuseBudget > 0.0) {
+        std::cerr << "--reuse-budget cannot be combined with --deep" << std::endl;
+        return false;
+    }
+    if (options.simd > detectSimdLevel()) {
+        std::cerr << simdLevelName(options.simd) << " is not supported on this CPU" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Applies --formula/--center/--zoom/--max-iter to the float scene, and for --deep sets
+// up the same view in high precision around the reference point.
+bool setupView(const CpuRenderOptions& options, Scene& scene, DeepFrame* deep) {
+    if (options.maxIter > 0) scene.primary.maxIter = scene.secondary.maxIter = options.maxIter;
+    scene.primary.interiorChecks = scene.secondary.interiorChecks = options.interiorChecks;
+    scene.primary.formula = scene.secondary.formula = options.formula;
+
+    double zoom = options.zoom > 0.0 ? options.zoom : std::exp((double)scene.time * 0.13);
+    if (options.zoom > 0.0) scene.viewport.zoom = (float)std::min(options.zoom, 1e30);
+    if (!options.centerRe.empty()) {
+        scene.viewport.centerX = (float)std::atof(options.centerRe.c_str());
+        scene.viewport.centerY = (float)std::atof(options.centerIm.c_str());
+    }
+    if (!deep) return true;
+    return setupDeepFrame(scene, zoom, options.centerRe, options.centerIm, *deep);
+}
+
+bool writeIterations(const std::string& path, const std::vector<uint32_t>& iters) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+    bool ok = std::fwrite(iters.data(), sizeof(uint32_t), iters.size(), file) == iters.size();
+    std::fclose(file);
+    return ok;
+}
+
+// Reports how many pixels differ from a GPU frame. Float rounding differs
+// slightly between drivers, so near-boundary pixels may disagree by an iteration.
+bool compareFrame(const std::string& path, const Image& image) {
+    Image reference;
+    if (!readPpm(path, reference)) return false;
+    if (reference.width != image.width || reference.height != image.height) {
+        std::cerr << path << " is " << reference.width << "x" << reference.height
+                  << ", expected " << image.width << "x" << image.height << std::endl;
+        return false;
+    }
+
+    size_t pixels = (size_t)image.width * image.height;
+    size_t exact = 0, close = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        int maxDiff = 0;
+        for (int c = 0; c < 3; c++)
+            maxDiff = std::max(maxDiff, std::abs(image.rgb[i * 3 + c] - reference.rgb[i * 3 + c]));
+        if (maxDiff == 0) exact++;
+        if (maxDiff <= 2) close++;
+    }
+    std::printf("  %s: %.3f%% identical, %.3f%% within 2/255\n", path.c_str(),
+                100.0 * exact / pixels, 100.0 * close / pixels);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    CpuRenderOptions options;
+    if (!parseOptions(argc, argv, options)) return -1;
+
+    TileScheduler scheduler(options.threads, options.pinThreads);
+    std::printf("Rendering %ld %s (%s) frame(s) at %dx%d with %s kernels on %d thread(s)\n", options.frames,
+                sceneKindName(options.scene), formulaName(options.formula), options.width, options.height,
+                simdLevelName(options.simd), scheduler.threadCount());
+
+    FrameBuffers frame;
+    frame.resize(options.width, options.height, options.tileSize);
+    std::vector<uint32_t> iters;
+    DeepFrame deep;
+    TemporalCache cache(options.reuseBudget);
+    RenderModes modes;
+    if (options.deep) modes.deep = &deep;
+    if (options.subdivide) modes.subdivision = &options.subdivision;
+    if (cache.enabled()) modes.cache = &cache;
+    for (long frameIndex = 0; frameIndex < options.frames; frameIndex++) {
+        float time = (float)(options.startTime + frameIndex / options.fps);
+        Scene scene = makeScene(options.scene, time, options.width, options.height);
+
+        auto start = std::chrono::steady_clock::now();
+        if (!setupView(options, scene, modes.deep)) return -1;
+        WorkerStats frameStats = renderFrame(scene, options.simd, scheduler, frame, modes);
+        const EscapeStats& stats = frameStats.escape;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("frame %ld (iTime %.3f): %.1f ms, %.1f Mpixel/s, %ld tiles stolen\n", frameIndex, time,
+                    seconds * 1e3, (double)options.width * options.height / seconds / 1e6, scheduler.lastSteals());
+        if (stats.total() > 0) {
+            std::printf("  interior shortcuts: %ld cardioid, %ld bulb, %ld periodic (%.1f%% of pixels)\n",
+                        stats.cardioid, stats.bulb, stats.periodic,
+                        100.0 * stats.total() / ((double)options.width * options.height));
+        }
+        if (options.subdivide) {
+            const SubdivisionStats& subdivided = frameStats.subdivision;
+            double layerPixels = (double)subdivided.evaluated + subdivided.filled;
+            std::printf("  subdivision: %ld pixels evaluated, %ld filled (%.1f%% evaluated)\n",
+                        subdivided.evaluated, subdivided.filled, 100.0 * subdivided.evaluated / layerPixels);
+        }
+        if (modes.cache) {
+            const ReuseStats& reuse = frameStats.reuse;
+            std::printf("  temporal reuse: %ld pixels recomputed (%.1f%%: %ld missing, %ld coarse, %ld edge)\n",
+                        reuse.recomputed(), 100.0 * reuse.recomputed() / ((double)options.width * options.height),
+                        reuse.missing, reuse.coarse, reuse.edge);
+        }
+        if (options.deep) {
+            std::printf("  deep zoom: pixel size %.3g, reference %d iterations, %ld rebases, %ld glitches\n",
+                        deep.view.pixelSize, deep.orbit.length() - 1, deep.stats.rebases.load(),
+                        deep.stats.glitches.load());
+        }
+
+        if (!options.output.empty() && !writePpm(framePath(options.output, frameIndex), frame.image)) return -1;
+        if (!options.itersOutput.empty()) {
+            frame.primary.copyTo(iters);
+            if (!writeIterations(framePath(options.itersOutput, frameIndex), iters)) return -1;
+        }
+        if (!options.compare.empty() && !compareFrame(framePath(options.compare, frameIndex), frame.image))
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+// Perturbation-theory deep zoom for the Mandelbrot set. One reference orbit
+// Z_n is iterated in arbitrary precision at the view centre; every pixel
+// then only iterates its double precision offset from it,
+//
+//   z_n = Z_n + d_n,   d_{n+1} = 2 Z_n d_n + d_n^2 + dc,
+//
+// so the per-pixel cost stays close to the plain double kernel while the
+// usable zoom goes to ~1e300 instead of ~1e5 for 32-bit float.
+//
+// Glitches are avoided by rebasing (Zhuoran): when |z_n| < |d_n| the pixel
+// restarts from the beginning of the reference with d = z, and it also
+// rebases when it runs past the end of a reference that escaped early.
+// Pixels that hit the Pauldelbrot criterion |z_n| << |Z_n| are counted as
+// detected glitches and fixed by the same rebase.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "escape_time.h"
+
+// Signed fixed-point number: magnitude limbs are little-endian 32-bit
+// words, the last limb is the integer part, the others are the fraction.
+class BigFixed {
+public:
+    explicit BigFixed(int fractionLimbs = 4) : limbs(fractionLimbs + 1, 0) {}
+
+    // Fraction limbs needed to resolve offsets of pixelSize with guard bits to spare.
+    static int limbsForPixelSize(double pixelSize) {
+        double bits = std::max(0.0, -std::log2(pixelSize)) + 64.0;
+        return (int)std::ceil(bits / 32.0);
+    }
+
+    // Parses a plain decimal such as "-0.74542800000000000000001234".
+    static bool parse(const std::string& text, int fractionLimbs, BigFixed& out) {
+        out = BigFixed(fractionLimbs);
+        size_t pos = 0;
+        bool negative = false;
+        if (pos < text.size() && (text[pos] == '-' || text[pos] == '+')) negative = text[pos++] == '-';
+
+        uint64_t integer = 0;
+        size_t digits = 0;
+        for (; pos < text.size() && std::isdigit((unsigned char)text[pos]); pos++, digits++)
+            integer = integer * 10 + (text[pos] - '0');
+        if (integer > 0xFFFFFFFFull) return false;
+
+        std::string fraction;
+        if (pos < text.size() && text[pos] == '.') {
+            for (pos++; pos < text.size() && std::isdigit((unsigned char)text[pos]); pos++)
+                fraction += text[pos];
+        }
+        if (pos != text.size() || digits + fraction.size() == 0) return false;
+
+        // Horner from the last digit: f = (f + d) / 10
+        for (size_t i = fraction.size(); i-- > 0;) {
+            out.limbs.back() += fraction[i] - '0';
+            out.divideSmall(10);
+        }
+        out.limbs.back() = (uint32_t)integer;
+        out.negative = negative && !out.isZero();
+        return true;
+    }
+
+    static BigFixed fromDouble(double value, int fractionLimbs) {
+        BigFixed out(fractionLimbs);
+        out.negative = value < 0.0;
+        double magnitude = std::fabs(value);
+        for (size_t i = out.limbs.size(); i-- > 0;) {
+            double limb = std::floor(magnitude);
+            out.limbs[i] = (uint32_t)limb;
+            magnitude = (magnitude - limb) * 4294967296.0;
+        }
+        out.negative = out.negative && !out.isZero();
+        return out;
+    }
+
+    double toDouble() const {
+        double value = 0.0;
+        double scale = 1.0;
+        for (size_t i = limbs.size(); i-- > 0; scale /= 4294967296.0)
+            value += limbs[i] * scale;
+        return negative ? -value : value;
+    }
+
+    int fractionLimbs() const { return (int)limbs.size() - 1; }
+
+    BigFixed operator+(const BigFixed& other) const { return addSigned(other, other.negative); }
+    BigFixed operator-(const BigFixed& other) const { return addSigned(other, !other.negative); }
+
+    BigFixed operator*(const BigFixed& other) const {
+        size_t n = limbs.size();
+        std::vector<uint64_t> wide(2 * n + 1, 0);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < n; j++) {
+                uint64_t t = (uint64_t)limbs[i] * other.limbs[j] + wide[i + j] + carry;
+                wide[i + j] = t & 0xFFFFFFFFull;
+                carry = t >> 32;
+            }
+            wide[i + n] += carry;
+        }
+        // The product has 2F fraction limbs; keep the top F and the integer limb
+        BigFixed out(fractionLimbs());
+        size_t shift = n - 1;
+        for (size_t i = 0; i < n; i++) out.limbs[i] = (uint32_t)wide[i + shift];
+        out.negative = (negative != other.negative) && !out.isZero();
+        return out;
+    }
+
+    BigFixed operator*(int factor) const {
+        BigFixed out = *this;
+        uint64_t carry = 0;
+        uint32_t magnitude = (uint32_t)std::abs(factor);
+        for (uint32_t& limb : out.limbs) {
+            uint64_t t = (uint64_t)limb * magnitude + carry;
+            limb = (uint32_t)t;
+            carry = t >> 32;
+        }
+        out.negative = (negative != (factor < 0)) && !out.isZero();
+        return out;
+    }
+
+    bool isZero() const {
+        return std::all_of(limbs.begin(), limbs.end(), [](uint32_t l) { return l == 0; });
+    }
+
+private:
+    BigFixed addSigned(const BigFixed& other, bool otherNegative) const {
+        BigFixed out(fractionLimbs());
+        if (negative == otherNegative) {
+            uint64_t carry = 0;
+            for (size_t i = 0; i < limbs.size(); i++) {
+                uint64_t t = (uint64_t)limbs[i] + other.limbs[i] + carry;
+                out.limbs[i] = (uint32_t)t;
+                carry = t >> 32;
+            }
+            out.negative = negative;
+        } else {
+            bool thisLarger = compareMagnitude(other) >= 0;
+            const BigFixed& a = thisLarger ? *this : other;
+            const BigFixed& b = thisLarger ? other : *this;
+            int64_t borrow = 0;
+            for (size_t i = 0; i < limbs.size(); i++) {
+                int64_t t = (int64_t)a.limbs[i] - b.limbs[i] - borrow;
+                borrow = t < 0;
+                out.limbs[i] = (uint32_t)(t + (borrow << 32));
+            }
+            out.negative = thisLarger ? negative : otherNegative;
+        }
+        out.negative = out.negative && !out.isZero();
+        return out;
+    }
+
+    int compareMagnitude(const BigFixed& other) const {
+        for (size_t i = limbs.size(); i-- > 0;) {
+            if (limbs[i] != other.limbs[i]) return limbs[i] < other.limbs[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    void divideSmall(uint32_t divisor) {
+        uint64_t remainder = 0;
+        for (size_t i = limbs.size(); i-- > 0;) {
+            uint64_t t = (remainder << 32) | limbs[i];
+            limbs[i] = (uint32_t)(t / divisor);
+            remainder = t % divisor;
+        }
+    }
+
+    std::vector<uint32_t> limbs;
+    bool negative = false;
+};
+
+// High precision view: centre in BigFixed, pixel pitch in double. The pixel
+// to plane mapping is the shader's, with 1 / (iResolution.y * heightScale * zoom)
+// folded into pixelSize.
+struct DeepViewport {
+    int width = 1920;
+    int height = 1080;
+    BigFixed centerX;
+    BigFixed centerY;
+    double pixelSize = 1.0;
+
+    double offsetX(int x) const { return ((x + 0.5) - 0.5 * width) * pixelSize; }
+    double offsetY(int row) const { return ((height - row - 0.5) - 0.5 * height) * pixelSize; }
+};
+
+// Reference orbit Z_0 = 0, Z_1 = C, ... rounded to double, stopping after
+// maxIter + 1 points or once |Z|^2 > 4.
+struct ReferenceOrbit {
+    std::vector<double> re;
+    std::vector<double> im;
+    std::vector<double> glitchThreshold;   // 1e-6 * |Z_n|^2, Pauldelbrot criterion
+
+    int length() const { return (int)re.size(); }
+};
+
+inline ReferenceOrbit computeReferenceOrbit(const BigFixed& cx, const BigFixed& cy, int maxIter) {
+    ReferenceOrbit orbit;
+    BigFixed zx(cx.fractionLimbs()), zy(cx.fractionLimbs());
+    for (int n = 0; n <= maxIter; n++) {
+        double re = zx.toDouble(), im = zy.toDouble();
+        orbit.re.push_back(re);
+        orbit.im.push_back(im);
+        orbit.glitchThreshold.push_back(1e-6 * (re * re + im * im));
+        if (re * re + im * im > 4.0) break;
+
+        BigFixed zx2 = zx * zx;
+        BigFixed zy2 = zy * zy;
+        zy = zx * zy * 2 + cy;
+        zx = zx2 - zy2 + cx;
+    }
+    return orbit;
+}
+
+struct PerturbationStats {
+    std::atomic<long> rebases{0};
+    std::atomic<long> glitches{0};
+};
+
+// Iteration count of one pixel with shader semantics (z starts at c) from its offset dc.
+inline uint32_t perturbPixel(const ReferenceOrbit& orbit, double dcx, double dcy, int maxIter,
+                             long& rebases, long& glitches) {
+    const double* zr = orbit.re.data();
+    const double* zi = orbit.im.data();
+    int last = orbit.length() - 1;
+    double dx = 0.0, dy = 0.0;
+    int m = 0;
+    int iter = 0;
+    for (; iter < maxIter; iter++) {
+        // d' = 2 Z d + d^2 + dc
+        double nx = 2.0 * (zr[m] * dx - zi[m] * dy) + (dx * dx - dy * dy) + dcx;
+        double ny = 2.0 * (zr[m] * dy + zi[m] * dx) + 2.0 * dx * dy + dcy;
+        dx = nx;
+        dy = ny;
+        m++;
+
+        double x = zr[m] + dx, y = zi[m] + dy;
+        double magnitude = x * x + y * y;
+        if (magnitude > 4.0) break;
+
+        bool glitch = magnitude < orbit.glitchThreshold[m];
+        if (glitch || magnitude < dx * dx + dy * dy || m == last) {
+            glitches += glitch;
+            rebases++;
+            dx = x;
+            dy = y;
+            m = 0;
+        }
+    }
+    return (uint32_t)iter;
+}
+
+#ifdef FRACTALS_X86
+
+// Four pixels per AVX2 vector; each lane keeps its own reference index so
+// lanes rebase independently, Z_m is fetched with gathers. Escaped lanes
+// stop advancing their index, so the gathers never read past the orbit.
+__attribute__((target("avx2,fma")))
+inline void perturbRowAvx2(const ReferenceOrbit& orbit, const DeepViewport& view, int row, int x0,
+                           int count, int maxIter, uint32_t* iters, long& rebases, long& glitches) {
+    const double* zr = orbit.re.data();
+    const double* zi = orbit.im.data();
+    const double* threshold = orbit.glitchThreshold.data();
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i last = _mm256_set1_epi64x(orbit.length() - 1);
+    const __m256d dcy = _mm256_set1_pd(view.offsetY(row));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d dcx = _mm256_setr_pd(view.offsetX(x0 + i), view.offsetX(x0 + i + 1),
+                                     view.offsetX(x0 + i + 2), view.offsetX(x0 + i + 3));
+        __m256d dx = _mm256_setzero_pd(), dy = _mm256_setzero_pd();
+        __m256i m = _mm256_setzero_si256();
+        __m256i counter = _mm256_setzero_si256();
+        __m256i active = _mm256_set1_epi64x(-1);
+
+        for (int iter = 0; iter < maxIter; iter++) {
+            __m256d rx = _mm256_i64gather_pd(zr, m, 8);
+            __m256d ry = _mm256_i64gather_pd(zi, m, 8);
+            __m256d nx = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(two, _mm256_sub_pd(_mm256_mul_pd(rx, dx), _mm256_mul_pd(ry, dy))),
+                _mm256_sub_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy))), dcx);
+            __m256d ny = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(two, _mm256_add_pd(_mm256_mul_pd(rx, dy), _mm256_mul_pd(ry, dx))),
+                _mm256_mul_pd(_mm256_mul_pd(two, dx), dy)), dcy);
+            dx = nx;
+            dy = ny;
+            m = _mm256_add_epi64(m, _mm256_and_si256(one, active));
+
+            __m256d x = _mm256_add_pd(_mm256_i64gather_pd(zr, m, 8), dx);
+            __m256d y = _mm256_add_pd(_mm256_i64gather_pd(zi, m, 8), dy);
+            __m256d magnitude = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+            __m256i escaped = _mm256_castpd_si256(_mm256_cmp_pd(magnitude, four, _CMP_GT_OQ));
+            active = _mm256_andnot_si256(escaped, active);
+            if (_mm256_testz_si256(active, active)) break;
+            counter = _mm256_sub_epi64(counter, active);
+
+            __m256d glitch = _mm256_cmp_pd(magnitude, _mm256_i64gather_pd(threshold, m, 8), _CMP_LT_OQ);
+            __m256d deltaLarger = _mm256_cmp_pd(
+                magnitude, _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _CMP_LT_OQ);
+            __m256i rebase = _mm256_or_si256(
+                _mm256_castpd_si256(_mm256_or_pd(glitch, deltaLarger)), _mm256_cmpeq_epi64(m, last));
+            rebase = _mm256_and_si256(rebase, active);
+            int rebaseMask = _mm256_movemask_pd(_mm256_castsi256_pd(rebase));
+            if (rebaseMask) {
+                rebases += __builtin_popcount(rebaseMask);
+                glitches += __builtin_popcount(
+                    _mm256_movemask_pd(glitch) & rebaseMask);
+                __m256d mask = _mm256_castsi256_pd(rebase);
+                dx = _mm256_blendv_pd(dx, x, mask);
+                dy = _mm256_blendv_pd(dy, y, mask);
+                m = _mm256_andnot_si256(rebase, m);
+            }
+        }
+        alignas(32) int64_t counts[4];
+        _mm256_store_si256((__m256i*)counts, counter);
+        for (int lane = 0; lane < 4; lane++) iters[i + lane] = (uint32_t)counts[lane];
+    }
+    for (; i < count; i++)
+        iters[i] = perturbPixel(orbit, view.offsetX(x0 + i), view.offsetY(row), maxIter, rebases, glitches);
+}
+
+#endif
+
+// Deep zoom iteration counts for pixels [x0, x0 + count) of a top-down row.
+// Any SIMD level from AVX2 up uses the 4-wide double kernel.
+inline void perturbRow(const ReferenceOrbit& orbit, const DeepViewport& view, int row, int x0, int count,
+                       int maxIter, uint32_t* iters, SimdLevel level, PerturbationStats& stats) {
+    long rebases = 0, glitches = 0;
+#ifdef FRACTALS_X86
+    if (level >= SimdLevel::Avx2) {
+        perturbRowAvx2(orbit, view, row, x0, count, maxIter, iters, rebases, glitches);
+    } else
+#endif
+    {
+        (void)level;
+        double dcy = view.offsetY(row);
+        for (int i = 0; i < count; i++)
+            iters[i] = perturbPixel(orbit, view.offsetX(x0 + i), dcy, maxIter, rebases, glitches);
+    }
+    stats.rebases += rebases;
+    stats.glitches += glitches;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// Distance-estimation mode for mandelbrot and julia (--distance). The field
+// shaders carry the derivative dz alongside z (dz/dc for the Mandelbrot
+// set, dz/dz0 for a Julia set), and an escaped point gets the estimate
+// 0.5 |z| ln |z| / |dz| of its distance to the set, which by the Koebe
+// quarter theorem does not exceed the true distance (asymptotically: the
+// orbit is followed a few steps past the escape radius of 2 for it, which
+// leaves the iteration counts as they were). It goes into the interior
+// pattern channel of the field, unused outside the set, in field pixels. The
+// colour pass darkens the last pixel before the set, so a filament thinner
+// than a pixel still shows where the iteration bands would skip it. The
+// estimate also saves iterations: a sample of a progressive field level
+// whose coarser neighbours all escaped in the same iteration band, each
+// with the set farther than twice the distance to the sample, is filled
+// from them instead of iterated.
+
+#include <string>
+
+#include "shader_source.h"
+
+// Field shader side. distanceEstimate() takes an orbit that just escaped
+// at z with derivative dz, c its constant and dc 1 for dz/dc or 0 for
+// dz/dz0. distanceFill() fills the sample at cell of a level of stride
+// pixels from the coarser level that holds every other sample, if it can;
+// the filled distance is the nearest neighbour's less the distance to it,
+// which is still a lower bound, so filling can go on level after level.
+inline constexpr const char* kDistanceFieldGlsl = R"(
+    vec2 formulaStep(vec2 z);
+    vec2 formulaDerivative(vec2 z, vec2 dz);
+
+    float distanceEstimate(vec2 z, vec2 dz, vec2 c, float dc) {
+        for (int i = 0; i < 8 && dot(z, z) < 65536.0; i++) {
+            dz = formulaDerivative(z, dz) + vec2(dc, 0.0);
+            z = formulaStep(z) + c;
+        }
+        float radius = length(z);
+        return 0.5 * radius * log(radius) / length(dz);
+    }
+
+    bool distanceFill(sampler2D coarser, ivec2 cell, int stride, out vec4 value) {
+        ivec2 last = textureSize(coarser, 0) - 1;
+        ivec2 base = cell / 2;
+        ivec2 odd = cell % 2;
+        vec4 corners[4] = vec4[4](texelFetch(coarser, base, 0),
+                                  texelFetch(coarser, min(base + ivec2(odd.x, 0), last), 0),
+                                  texelFetch(coarser, min(base + ivec2(0, odd.y), last), 0),
+                                  texelFetch(coarser, min(base + odd, last), 0));
+        // Farthest the sample can be from a coarser one, in field pixels
+        float reach = float(stride) * 1.41421356;
+        float nearest = corners[0].b;
+        float smoothSum = 0.0;
+        for (int i = 0; i < 4; i++) {
+            if (corners[i].a != 0.0 || corners[i].r != corners[0].r) return false;
+            nearest = min(nearest, corners[i].b);
+            smoothSum += corners[i].g;
+        }
+        if (nearest < 2.0 * reach) return false;
+        value = vec4(corners[0].r, smoothSum * 0.25, nearest - reach, 0.0);
+        return true;
+    }
+)";
+
+// Colour pass side: an escaped pixel's colour, darkened within a pixel of
+// the set. distance is in pixels of the field the colour pass reads.
+inline constexpr const char* kDistanceShadeGlsl = R"(
+    vec3 distanceShade(vec3 color, float distance) {
+        return color * sqrt(clamp(distance, 0.0, 1.0));
+    }
+)";
+
+// A field or colour shader (glsl kDistanceFieldGlsl or kDistanceShadeGlsl)
+// built for distance estimation.
+inline std::string distanceVariant(const char* source, const char* glsl) {
+    return insertAfterVersion(source, std::string("    #define DISTANCE_ESTIMATE\n") + glsl);
+}
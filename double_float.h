@@ -0,0 +1,147 @@
+#pragma once
+
+// Double-float ("float-float") arithmetic for the GLSL 3.3 field shaders,
+// which have no doubles. A value is the unevaluated sum hi + lo of two
+// floats, carried in a vec2, for about 48 bits of mantissa instead of 24.
+// Sums and products are made exact with the error-free transformations of
+// Knuth (two-sum) and Dekker (split and two-product). The float kernels run
+// out of resolution around zoom 1e4-1e5, these near 1e12, so mandelbrot and
+// julia compile both variants of their field shader and switch per frame on
+// the pixel size.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "shader_source.h"
+
+enum class FieldPrecision { Auto, Float, DoubleFloat };
+
+inline const char* fieldPrecisionName(FieldPrecision precision) {
+    switch (precision) {
+        case FieldPrecision::Float: return "float";
+        case FieldPrecision::DoubleFloat: return "double";
+        default: return "auto";
+    }
+}
+
+inline bool parseFieldPrecision(const char* name, FieldPrecision& precision) {
+    for (FieldPrecision p : {FieldPrecision::Auto, FieldPrecision::Float, FieldPrecision::DoubleFloat}) {
+        if (std::string(name) == fieldPrecisionName(p)) {
+            precision = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+// GLSL double-float helpers. iDoubleFloatOne is 1.0 at run time but opaque
+// to the shader compiler, which would otherwise be free to simplify the
+// rounding error terms away algebraically (GLSL 3.3 has no `precise`). It
+// also keeps a fused multiply-add from changing any rounding: fusing x * 1.0
+// into the following add or subtract gives the same result.
+inline constexpr const char* kDoubleFloatGlsl = R"(
+    uniform float iDoubleFloatOne;
+
+    // a + b exactly, as hi + lo
+    vec2 twoSum(float a, float b) {
+        float s = a + b;
+        float v = s * iDoubleFloatOne - a;
+        return vec2(s, (a - (s - v)) + (b - v));
+    }
+
+    // The same for |a| >= |b|
+    vec2 quickTwoSum(float a, float b) {
+        float s = a + b;
+        return vec2(s, b - (s * iDoubleFloatOne - a));
+    }
+
+    // a as two halves of 12 significant bits, whose products are exact
+    vec2 dfSplit(float a) {
+        float t = a * 4097.0 * iDoubleFloatOne;
+        float hi = t - (t - a);
+        return vec2(hi, a - hi);
+    }
+
+    // a * b exactly, as hi + lo
+    vec2 twoProduct(float a, float b) {
+        float p = a * b;
+        vec2 as = dfSplit(a);
+        vec2 bs = dfSplit(b);
+        float error = ((as.x * bs.x - p) + as.x * bs.y + as.y * bs.x) + as.y * bs.y;
+        return vec2(p, error);
+    }
+
+    vec2 dfAdd(vec2 a, vec2 b) {
+        vec2 s = twoSum(a.x, b.x);
+        return quickTwoSum(s.x, s.y + (a.y + b.y));
+    }
+
+    vec2 dfMul(vec2 a, vec2 b) {
+        vec2 p = twoProduct(a.x, b.x);
+        return quickTwoSum(p.x, p.y + (a.x * b.y + a.y * b.x));
+    }
+
+    vec2 dfSqr(vec2 a) {
+        vec2 p = twoProduct(a.x, a.x);
+        return quickTwoSum(p.x, p.y + 2.0 * a.x * a.y);
+    }
+)";
+
+// fragmentSource with DOUBLE_FLOAT defined and the helpers above inserted
+// after its #version line.
+inline std::string doubleFloatVariant(const char* fragmentSource) {
+    return insertAfterVersion(fragmentSource, std::string("    #define DOUBLE_FLOAT\n") + kDoubleFloatGlsl);
+}
+
+// hi + lo == value to about 48 bits
+inline void splitDouble(double value, float& hi, float& lo) {
+    hi = (float)value;
+    lo = (float)(value - hi);
+}
+
+// Whether a view with the given distance between pixel centres needs the
+// double-float kernels: once a pixel spans fewer than 8 float steps of the
+// orbit's magnitude (|z| is of the order of 1 near the boundary, or the
+// view centre if that is larger), rounding in the iteration shows up as
+// blocks and noise.
+inline bool needsDoubleFloat(FieldPrecision precision, double pixelSize, double centerX, double centerY) {
+    if (precision != FieldPrecision::Auto) return precision == FieldPrecision::DoubleFloat;
+    double magnitude = std::max({1.0, std::fabs(centerX), std::fabs(centerY)});
+    return pixelSize < std::ldexp(magnitude, -20);
+}
+
+// GPU time of the field passes per precision, from the profiler's timings,
+// for the cost summary at exit.
+class PrecisionCost {
+public:
+    void record(bool doubleFloat, double ms, long samples) {
+        Totals& totals = doubleFloat ? doubleFloatTotals : floatTotals;
+        totals.ms += ms;
+        totals.samples += samples;
+        totals.passes++;
+    }
+
+    void report() const {
+        auto nsPerSample = [](const Totals& t) { return t.ms * 1e6 / std::max(t.samples, 1L); };
+        if (floatTotals.passes > 0)
+            std::fprintf(stderr, "float field: %ld passes, %.2f ns per sample\n", floatTotals.passes,
+                         nsPerSample(floatTotals));
+        if (doubleFloatTotals.passes > 0)
+            std::fprintf(stderr, "double-float field: %ld passes, %.2f ns per sample\n", doubleFloatTotals.passes,
+                         nsPerSample(doubleFloatTotals));
+        if (floatTotals.passes > 0 && doubleFloatTotals.passes > 0)
+            std::fprintf(stderr, "double-float costs %.1fx float per sample (views differ, so this is indicative)\n",
+                         nsPerSample(doubleFloatTotals) / nsPerSample(floatTotals));
+    }
+
+private:
+    struct Totals {
+        double ms = 0.0;
+        long samples = 0;
+        long passes = 0;
+    };
+    Totals floatTotals;
+    Totals doubleFloatTotals;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+// Adaptive antialiasing for the field of mandelbrot and julia. MSAA only
+// multiplies coverage samples of the full-screen quad, and the escape-time
+// shader still runs once per pixel, so it does nothing about iteration
+// aliasing. Instead, once the field of a view is complete, an extra pass
+// finds the pixels whose iteration value differs from a neighbour by more
+// than a threshold and evaluates the fractal again at 4, 9 or 16 jittered
+// positions inside only those pixels. The subsample values go into a
+// texture array (four per layer) that the colour pass averages through the
+// palette, so palette changes still need no iteration. Edge pixels are a
+// few percent of a frame, and so is the cost.
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "field_pipeline.h"
+#include "shader_source.h"
+
+// The edge test, shared by the supersampling pass and the colour pass so
+// both pick the same pixels. edgeValue() is the colour pass's palette
+// input: the smooth or the banded iteration value of a field texel.
+inline constexpr const char* kEdgeTestGlsl = R"(
+    float edgeValue(vec4 field, int smoothValues) {
+        return smoothValues != 0 ? field.g : field.r;
+    }
+
+    bool isEdge(sampler2D field, ivec2 texel, float threshold, int smoothValues) {
+        ivec2 last = textureSize(field, 0) - 1;
+        float value = edgeValue(texelFetch(field, texel, 0), smoothValues);
+        ivec2 offsets[4] = ivec2[4](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+        for (int i = 0; i < 4; i++) {
+            vec4 neighbour = texelFetch(field, clamp(texel + offsets[i], ivec2(0), last), 0);
+            if (abs(edgeValue(neighbour, smoothValues) - value) > threshold) return true;
+        }
+        return false;
+    }
+)";
+
+// Replaces the field shader's main(). fieldValue(pixel) is the field
+// shader's (value, smooth value, interior pattern, interior flag) at a
+// position in pixels. A subsample is stored as its palette input, or as -1 - pattern
+// where the interior pattern is drawn (the palette contributes only 5%
+// there, and is taken at 1.0).
+inline constexpr const char* kEdgeSupersampleGlsl = R"(
+    uniform sampler2D iEdgeField;     // The complete field of the view
+    uniform int iEdgeSamples;         // Subsamples per edge pixel: 4, 9 or 16
+    uniform float iEdgeThreshold;     // Value difference to a neighbour that marks an edge
+    uniform int iEdgeSmooth;          // Compare and store smooth values
+
+    layout(location = 0) out vec4 EdgeSamples[4];
+
+    vec4 fieldValue(vec2 pixel);
+
+    // Jitter in [0, 1)^2 for a subsample, fixed per pixel so a still view stays still
+    vec2 edgeJitter(ivec2 texel, int sampleIndex) {
+        uint h = uint(texel.x) * 73856093u ^ uint(texel.y) * 19349663u ^ uint(sampleIndex) * 83492791u;
+        h = (h ^ (h >> 16)) * 0x45d9f3bu;
+        h = (h ^ (h >> 16)) * 0x45d9f3bu;
+        h ^= h >> 16;
+        return vec2(float(h & 0xffffu), float(h >> 16)) / 65536.0;
+    }
+
+    void main() {
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        if (!isEdge(iEdgeField, texel, iEdgeThreshold, iEdgeSmooth)) discard;
+
+        // One jittered subsample per cell of a side x side grid over the pixel
+        int side = iEdgeSamples == 16 ? 4 : iEdgeSamples == 9 ? 3 : 2;
+        float values[16];
+        for (int i = 0; i < 16; i++) {
+            values[i] = 0.0;
+            if (i >= iEdgeSamples) continue;
+            vec2 cell = vec2(i % side, i / side);
+            vec4 field = fieldValue(vec2(texel) + (cell + edgeJitter(texel, i)) / float(side));
+            values[i] = field.a != 0.0 ? -1.0 - field.b : edgeValue(field, iEdgeSmooth);
+        }
+        for (int layer = 0; layer < 4; layer++)
+            EdgeSamples[layer] = vec4(values[layer * 4], values[layer * 4 + 1], values[layer * 4 + 2],
+                                      values[layer * 4 + 3]);
+    }
+)";
+
+// The colour pass side: edgeColor() averages the stored subsamples of an
+// edge pixel through shade(), the colour pass's own colouring of a palette
+// input and interior pattern, declared here and defined by the shader.
+inline constexpr const char* kEdgeResolveGlsl = R"(
+    uniform sampler2DArray iEdgeSampleTexture;
+    uniform int iEdgeSamples;         // 0 while no supersampled field matches the bound one
+    uniform float iEdgeThreshold;
+
+    vec3 shade(bool interior, float value, float pattern);
+
+    vec3 edgeColor(ivec2 texel) {
+        vec3 sum = vec3(0.0);
+        for (int i = 0; i < iEdgeSamples; i++) {
+            float value = texelFetch(iEdgeSampleTexture, ivec3(texel, i / 4), 0)[i % 4];
+            sum += value < 0.0 ? shade(true, 1.0, -1.0 - value) : shade(false, value, 0.0);
+        }
+        return sum / float(iEdgeSamples);
+    }
+)";
+
+// The supersampling pass built from a field shader, which keeps its own
+// main() and FieldValue output out of the way under EDGE_SUPERSAMPLE.
+inline std::string edgeSupersampleVariant(const char* fieldSource) {
+    return insertAfterVersion(fieldSource, std::string("    #define EDGE_SUPERSAMPLE\n") + kEdgeTestGlsl +
+                                               kEdgeSupersampleGlsl);
+}
+
+// A colour shader with edgeColor() available.
+inline std::string edgeResolveVariant(const char* colorSource) {
+    return insertAfterVersion(colorSource, std::string(kEdgeTestGlsl) + kEdgeResolveGlsl);
+}
+
+// The subsample texture array and its pass. Like IterationField, the
+// samples are kept until the view changes; the share of pixels that were
+// supersampled is counted with an occlusion query, read back on the next
+// pass so it never stalls.
+class EdgeSupersampler {
+public:
+    // samples 0 disables supersampling.
+    void create(int samplesPerPixel, double thresholdIterations, int maxIter) {
+        samples = samplesPerPixel;
+        threshold = (float)(thresholdIterations / maxIter);
+        if (!enabled()) return;
+        layers = (samples + 3) / 4;
+        glGenFramebuffers(1, &framebuffer);
+        glGenTextures(1, &texture);
+        glGenQueries(1, &query);
+    }
+
+    void destroy() {
+        if (!enabled()) return;
+        readQuery();
+        if (passes > 0) {
+            std::fprintf(stderr, "edge supersampling: %ld passes, %.2f%% of pixels at %d samples, "
+                         "%.2f ms per pass\n", passes, 100.0 * edgePixels / std::max(fieldPixels, 1.0), samples,
+                         timedPasses > 0 ? passMs / timedPasses : 0.0);
+        }
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &texture);
+        glDeleteQueries(1, &query);
+    }
+
+    bool enabled() const { return samples > 0; }
+    int sampleCount() const { return samples; }
+    float thresholdValue() const { return threshold; }
+
+    // Whether the subsamples for key still have to be computed.
+    bool stale(const FieldKey& key) {
+        if (!enabled()) return false;
+        if (key.width != current.width || key.height != current.height) {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, key.width, key.height, layers, 0, GL_RGBA, GL_FLOAT,
+                         nullptr);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            GLint previous;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+            for (int layer = 0; layer < layers; layer++)
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + layer, texture, 0, layer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
+            valid = false;
+        } else if (key != current) {
+            valid = false;
+        }
+        current = key;
+        return !valid;
+    }
+
+    // Whether the colour pass can use the subsamples of the current key.
+    bool ready() const { return enabled() && valid; }
+
+    // Redirects drawing into the subsample layers and starts counting the
+    // edge pixels; the supersampling program must be in use.
+    void begin() {
+        readQuery();
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        GLenum buffers[4] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+        glDrawBuffers(layers, buffers);
+        glViewport(0, 0, current.width, current.height);
+        glBeginQuery(GL_SAMPLES_PASSED, query);
+    }
+
+    void end() {
+        glEndQuery(GL_SAMPLES_PASSED);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, savedFramebuffer);
+        queryPending = true;
+        pendingPixels = (double)current.width * current.height;
+        valid = true;
+        passes++;
+    }
+
+    // GPU time of a pass, from the profiler.
+    void recordMs(double ms) {
+        passMs += ms;
+        timedPasses++;
+    }
+
+    void bindTexture(GLenum unit) const {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    }
+
+private:
+    void readQuery() {
+        if (!queryPending) return;
+        GLuint edges = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &edges);
+        edgePixels += edges;
+        fieldPixels += pendingPixels;
+        queryPending = false;
+    }
+
+    int samples = 0;
+    int layers = 0;
+    float threshold = 0.0f;
+    GLuint framebuffer = 0;
+    GLuint texture = 0;
+    GLuint query = 0;
+    GLint savedFramebuffer = 0;
+    FieldKey current;
+    bool valid = false;
+    bool queryPending = false;
+    double pendingPixels = 0.0;
+    double edgePixels = 0.0;
+    double fieldPixels = 0.0;
+    long passes = 0;
+    double passMs = 0.0;
+    long timedPasses = 0;
+};
@@ -0,0 +1,550 @@
+#pragma once
+
+// CPU escape-time engine. Computes the same iteration counts as the
+// mandelbrot()/julia() functions in the GLSL shaders: z starts at c (or at
+// the pixel for Julia), iteration stops once |z|^2 > 4 and the count is the
+// number of steps taken before that, capped at maxIter.
+//
+// Pixel coordinates are generated in float with the shader's operation
+// order, so CPU and GPU frames of the same viewport can be compared. Build
+// with -ffp-contract=off so every SIMD level rounds identically.
+//
+// The kernels are templates over the formula policies of formulas.h. The
+// public entry points pick the instantiation for params.formula once per
+// call, so every loop runs one fixed formula.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "formulas.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRACTALS_X86 1
+#endif
+
+enum class FractalKind { Mandelbrot, Julia };
+
+struct EscapeParams {
+    FractalKind kind = FractalKind::Mandelbrot;
+    Formula formula = Formula::Quadratic;
+    float juliaX = 0.0f;   // Julia constant c
+    float juliaY = 0.0f;
+    int maxIter = 300;
+    bool interiorChecks = true;   // Cardioid/bulb rejection and periodicity detection
+};
+
+// Pixels that the interior shortcuts reported as never escaping, and the
+// iterations they saved: the counts of those pixels say MAX_ITER, so the
+// iterations actually run are the sum of the counts less skipped.
+struct EscapeStats {
+    long cardioid = 0;   // Inside the main cardioid
+    long bulb = 0;       // Inside the period-2 bulb
+    long periodic = 0;   // Orbit repeated exactly (Brent cycle detection)
+    long long skipped = 0;
+
+    EscapeStats& operator+=(const EscapeStats& other) {
+        cardioid += other.cardioid;
+        bulb += other.bulb;
+        periodic += other.periodic;
+        skipped += other.skipped;
+        return *this;
+    }
+    long total() const { return cardioid + bulb + periodic; }
+};
+
+// Mirrors the shader mapping
+//   (fragCoord * iResolution - 0.5 * iResolution) / (iResolution.y * heightScale) / zoom + center
+// with rows stored top-down, i.e. row 0 is the top of the window.
+struct Viewport {
+    int width = 1920;
+    int height = 1080;
+    float centerX = 0.0f;
+    float centerY = 0.0f;
+    float zoom = 1.0f;
+    float heightScale = 1.0f;   // 0.2 in mandelbrot.cpp, 1.0 in julia.cpp and fractal.cpp
+
+    float pixelX(float x) const {
+        return ((x + 0.5f) - 0.5f * width) / (height * heightScale) / zoom + centerX;
+    }
+    float pixelY(float row) const {
+        return ((height - row - 0.5f) - 0.5f * height) / (height * heightScale) / zoom + centerY;
+    }
+};
+
+enum class SimdLevel { Scalar, Sse2, Avx2, Avx512 };
+
+inline const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Sse2: return "sse2";
+        case SimdLevel::Avx2: return "avx2";
+        case SimdLevel::Avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+inline bool parseSimdLevel(const char* name, SimdLevel& level) {
+    for (SimdLevel l : {SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Avx512}) {
+        if (std::string(name) == simdLevelName(l)) {
+            level = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Widest kernel the running CPU supports.
+inline SimdLevel detectSimdLevel() {
+#ifdef FRACTALS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdLevel::Avx2;
+    return SimdLevel::Sse2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+inline int simdLaneCount(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Sse2: return 4;
+        case SimdLevel::Avx2: return 8;
+        case SimdLevel::Avx512: return 16;
+        default: return 1;
+    }
+}
+
+// Closed-form interior test for the two largest components of the
+// Mandelbrot set: 1 = main cardioid, 2 = period-2 bulb, 0 = neither.
+inline int interiorComponent(float x, float y) {
+    float xq = x - 0.25f;
+    float q = xq * xq + y * y;
+    if (q * (q + xq) <= 0.25f * (y * y)) return 1;
+    if ((x + 1.0f) * (x + 1.0f) + y * y <= 0.0625f) return 2;
+    return 0;
+}
+
+// Single point, shader semantics. (x, y) is c for Mandelbrot and z for Julia.
+//
+// Periodicity detection saves z at every power of two step (Brent) and stops
+// once the orbit returns to that exact float value. A float orbit that
+// repeats can never escape, so the count is the same maxIter the full loop
+// would reach.
+template <typename F>
+inline uint32_t escapePointFormula(const EscapeParams& params, float x, float y, EscapeStats* stats) {
+    bool julia = params.kind == FractalKind::Julia;
+    if (F::kInteriorTest && params.interiorChecks && !julia) {
+        int component = interiorComponent(x, y);
+        if (component) {
+            if (stats) {
+                (component == 1 ? stats->cardioid : stats->bulb)++;
+                stats->skipped += params.maxIter;
+            }
+            return (uint32_t)params.maxIter;
+        }
+    }
+
+    float zx = x, zy = y;
+    float cx = julia ? params.juliaX : x;
+    float cy = julia ? params.juliaY : y;
+    float savedX = zx, savedY = zy;
+    int nextSave = 2;
+    int iter = 0;
+    for (; iter < params.maxIter; iter++) {
+        float zx2 = zx * zx;
+        float zy2 = zy * zy;
+        if (zx2 + zy2 > 4.0f) break;
+        F::step(zx, zy, zx2, zy2, cx, cy);
+        if (!params.interiorChecks) continue;
+        if (zx == savedX && zy == savedY) {
+            if (stats) {
+                stats->periodic++;
+                stats->skipped += params.maxIter - (iter + 1);
+            }
+            return (uint32_t)params.maxIter;
+        }
+        if (iter + 1 == nextSave) {
+            savedX = zx;
+            savedY = zy;
+            nextSave *= 2;
+        }
+    }
+    return (uint32_t)iter;
+}
+
+inline uint32_t escapePoint(const EscapeParams& params, float x, float y, EscapeStats* stats = nullptr) {
+    uint32_t iter = 0;
+    withFormula(params.formula, [&](auto formula) {
+        iter = escapePointFormula<decltype(formula)>(params, x, y, stats);
+    });
+    return iter;
+}
+
+template <typename F>
+inline void escapeRowScalar(const EscapeParams& params, const Viewport& view, int row, int x0,
+                            int count, uint32_t* iters, EscapeStats* stats) {
+    float y = view.pixelY((float)row);
+    for (int i = 0; i < count; i++)
+        iters[i] = escapePointFormula<F>(params, view.pixelX((float)(x0 + i)), y, stats);
+}
+
+template <typename F>
+inline void escapePointsScalar(const EscapeParams& params, const float* xs, const float* ys, int count,
+                               uint32_t* iters, EscapeStats* stats) {
+    for (int i = 0; i < count; i++) iters[i] = escapePointFormula<F>(params, xs[i], ys[i], stats);
+}
+
+#ifdef FRACTALS_X86
+
+// Each SIMD kernel iterates one lane group of points. Lanes inside the
+// cardioid or bulb start out finished; a lane stops counting once it escapes
+// or its orbit repeats, and the group exits when no lane is left. The row
+// kernels feed adjacent pixels, the point kernels arbitrary (x, y) lists.
+
+template <typename F>
+inline __m128i escapeLanesSse2(const EscapeParams& params, __m128 x, __m128 y, int lanes, EscapeStats& local) {
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128i maxIter = _mm_set1_epi32(params.maxIter);
+    const bool julia = params.kind == FractalKind::Julia;
+
+    __m128 zx = x, zy = y;
+    __m128 cx = julia ? _mm_set1_ps(params.juliaX) : zx;
+    __m128 cy = julia ? _mm_set1_ps(params.juliaY) : zy;
+    __m128i counter = _mm_setzero_si128();
+    // Only the first `lanes` lanes hold real points
+    __m128 active = _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(lanes)));
+
+    if (F::kInteriorTest && params.interiorChecks && !julia) {
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        __m128 xq = _mm_sub_ps(zx, quarter);
+        __m128 y2 = _mm_mul_ps(zy, zy);
+        __m128 q = _mm_add_ps(_mm_mul_ps(xq, xq), y2);
+        __m128 cardioid = _mm_and_ps(active, _mm_cmple_ps(_mm_mul_ps(q, _mm_add_ps(q, xq)), _mm_mul_ps(quarter, y2)));
+        __m128 x1 = _mm_add_ps(zx, _mm_set1_ps(1.0f));
+        __m128 bulb = _mm_and_ps(_mm_andnot_ps(cardioid, active),
+            _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(x1, x1), y2), _mm_set1_ps(0.0625f)));
+        __m128 interior = _mm_or_ps(cardioid, bulb);
+        local.cardioid += __builtin_popcount(_mm_movemask_ps(cardioid));
+        local.bulb += __builtin_popcount(_mm_movemask_ps(bulb));
+        local.skipped += (long long)__builtin_popcount(_mm_movemask_ps(interior)) * params.maxIter;
+        counter = _mm_and_si128(_mm_castps_si128(interior), maxIter);
+        active = _mm_andnot_ps(interior, active);
+    }
+
+    __m128 savedX = zx, savedY = zy;
+    int nextSave = 2;
+    for (int iter = 0; iter < params.maxIter; iter++) {
+        __m128 zx2 = _mm_mul_ps(zx, zx);
+        __m128 zy2 = _mm_mul_ps(zy, zy);
+        active = _mm_andnot_ps(_mm_cmpgt_ps(_mm_add_ps(zx2, zy2), four), active);
+        if (_mm_movemask_ps(active) == 0) break;
+        counter = _mm_sub_epi32(counter, _mm_castps_si128(active));
+        F::step(zx, zy, zx2, zy2, cx, cy);
+        if (!params.interiorChecks) continue;
+
+        __m128 repeated = _mm_and_ps(active, _mm_and_ps(_mm_cmpeq_ps(zx, savedX), _mm_cmpeq_ps(zy, savedY)));
+        int repeatedMask = _mm_movemask_ps(repeated);
+        if (repeatedMask) {
+            local.periodic += __builtin_popcount(repeatedMask);
+            local.skipped += (long long)__builtin_popcount(repeatedMask) * (params.maxIter - (iter + 1));
+            __m128i lanes = _mm_castps_si128(repeated);
+            counter = _mm_or_si128(_mm_andnot_si128(lanes, counter), _mm_and_si128(lanes, maxIter));
+            active = _mm_andnot_ps(repeated, active);
+        }
+        if (iter + 1 == nextSave) {
+            savedX = zx;
+            savedY = zy;
+            nextSave *= 2;
+        }
+    }
+    return counter;
+}
+
+template <typename F>
+inline void escapeRowSse2(const EscapeParams& params, const Viewport& view, int row, int x0,
+                          int count, uint32_t* iters, EscapeStats* stats) {
+    const __m128 y0 = _mm_set1_ps(view.pixelY((float)row));
+    EscapeStats local;
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        alignas(16) float xs[4];
+        for (int lane = 0; lane < 4; lane++) xs[lane] = view.pixelX((float)(x0 + i + lane));
+        _mm_storeu_si128((__m128i*)(iters + i), escapeLanesSse2<F>(params, _mm_load_ps(xs), y0, 4, local));
+    }
+    escapeRowScalar<F>(params, view, row, x0 + i, count - i, iters + i, &local);
+    if (stats) *stats += local;
+}
+
+template <typename F>
+inline void escapePointsSse2(const EscapeParams& params, const float* xs, const float* ys, int count,
+                             uint32_t* iters, EscapeStats* stats) {
+    EscapeStats local;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i counter = escapeLanesSse2<F>(params, _mm_loadu_ps(xs + i), _mm_loadu_ps(ys + i), 4, local);
+        _mm_storeu_si128((__m128i*)(iters + i), counter);
+    }
+    if (i < count) {
+        // One more lane group, with the spare lanes finished from the start
+        float tailX[4], tailY[4];
+        uint32_t tailIters[4];
+        for (int lane = 0; lane < 4; lane++) {
+            int point = std::min(i + lane, count - 1);
+            tailX[lane] = xs[point];
+            tailY[lane] = ys[point];
+        }
+        __m128i counter = escapeLanesSse2<F>(params, _mm_loadu_ps(tailX), _mm_loadu_ps(tailY), count - i, local);
+        _mm_storeu_si128((__m128i*)tailIters, counter);
+        std::memcpy(iters + i, tailIters, (count - i) * sizeof(uint32_t));
+    }
+    if (stats) *stats += local;
+}
+
+template <typename F>
+__attribute__((target("avx2,fma")))
+inline __m256i escapeLanesAvx2(const EscapeParams& params, __m256 x, __m256 y, int lanes, EscapeStats& local) {
+    const __m256 four = _mm256_set1_ps(4.0f);
+    const __m256i maxIter = _mm256_set1_epi32(params.maxIter);
+    const bool julia = params.kind == FractalKind::Julia;
+
+    __m256 zx = x, zy = y;
+    __m256 cx = julia ? _mm256_set1_ps(params.juliaX) : zx;
+    __m256 cy = julia ? _mm256_set1_ps(params.juliaY) : zy;
+    __m256i counter = _mm256_setzero_si256();
+    // Only the first `lanes` lanes hold real points
+    __m256 active = _mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+    if (F::kInteriorTest && params.interiorChecks && !julia) {
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+        __m256 xq = _mm256_sub_ps(zx, quarter);
+        __m256 y2 = _mm256_mul_ps(zy, zy);
+        __m256 q = _mm256_add_ps(_mm256_mul_ps(xq, xq), y2);
+        __m256 cardioid = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, xq)),
+                                                              _mm256_mul_ps(quarter, y2), _CMP_LE_OQ));
+        __m256 x1 = _mm256_add_ps(zx, _mm256_set1_ps(1.0f));
+        __m256 bulb = _mm256_and_ps(_mm256_andnot_ps(cardioid, active), _mm256_cmp_ps(
+            _mm256_add_ps(_mm256_mul_ps(x1, x1), y2), _mm256_set1_ps(0.0625f), _CMP_LE_OQ));
+        __m256 interior = _mm256_or_ps(cardioid, bulb);
+        local.cardioid += __builtin_popcount(_mm256_movemask_ps(cardioid));
+        local.bulb += __builtin_popcount(_mm256_movemask_ps(bulb));
+        local.skipped += (long long)__builtin_popcount(_mm256_movemask_ps(interior)) * params.maxIter;
+        counter = _mm256_and_si256(_mm256_castps_si256(interior), maxIter);
+        active = _mm256_andnot_ps(interior, active);
+    }
+
+    __m256 savedX = zx, savedY = zy;
+    int nextSave = 2;
+    for (int iter = 0; iter < params.maxIter; iter++) {
+        __m256 zx2 = _mm256_mul_ps(zx, zx);
+        __m256 zy2 = _mm256_mul_ps(zy, zy);
+        __m256 escaped = _mm256_cmp_ps(_mm256_add_ps(zx2, zy2), four, _CMP_GT_OQ);
+        active = _mm256_andnot_ps(escaped, active);
+        if (_mm256_movemask_ps(active) == 0) break;
+        counter = _mm256_sub_epi32(counter, _mm256_castps_si256(active));
+        F::step(zx, zy, zx2, zy2, cx, cy);
+        if (!params.interiorChecks) continue;
+
+        __m256 repeated = _mm256_and_ps(active, _mm256_and_ps(
+            _mm256_cmp_ps(zx, savedX, _CMP_EQ_OQ), _mm256_cmp_ps(zy, savedY, _CMP_EQ_OQ)));
+        int repeatedMask = _mm256_movemask_ps(repeated);
+        if (repeatedMask) {
+            local.periodic += __builtin_popcount(repeatedMask);
+            local.skipped += (long long)__builtin_popcount(repeatedMask) * (params.maxIter - (iter + 1));
+            counter = _mm256_blendv_epi8(counter, maxIter, _mm256_castps_si256(repeated));
+            active = _mm256_andnot_ps(repeated, active);
+        }
+        if (iter + 1 == nextSave) {
+            savedX = zx;
+            savedY = zy;
+            nextSave *= 2;
+        }
+    }
+    return counter;
+}
+
+template <typename F>
+__attribute__((target("avx2,fma")))
+inline void escapeRowAvx2(const EscapeParams& params, const Viewport& view, int row, int x0,
+                          int count, uint32_t* iters, EscapeStats* stats) {
+    const __m256 y0 = _mm256_set1_ps(view.pixelY((float)row));
+    EscapeStats local;
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        alignas(32) float xs[8];
+        for (int lane = 0; lane < 8; lane++) xs[lane] = view.pixelX((float)(x0 + i + lane));
+        _mm256_storeu_si256((__m256i*)(iters + i), escapeLanesAvx2<F>(params, _mm256_load_ps(xs), y0, 8, local));
+    }
+    escapeRowScalar<F>(params, view, row, x0 + i, count - i, iters + i, &local);
+    if (stats) *stats += local;
+}
+
+template <typename F>
+__attribute__((target("avx2,fma")))
+inline void escapePointsAvx2(const EscapeParams& params, const float* xs, const float* ys, int count,
+                             uint32_t* iters, EscapeStats* stats) {
+    EscapeStats local;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i counter = escapeLanesAvx2<F>(params, _mm256_loadu_ps(xs + i), _mm256_loadu_ps(ys + i), 8, local);
+        _mm256_storeu_si256((__m256i*)(iters + i), counter);
+    }
+    if (i < count) {
+        // One more lane group, with the spare lanes finished from the start
+        float tailX[8], tailY[8];
+        uint32_t tailIters[8];
+        for (int lane = 0; lane < 8; lane++) {
+            int point = std::min(i + lane, count - 1);
+            tailX[lane] = xs[point];
+            tailY[lane] = ys[point];
+        }
+        __m256i counter = escapeLanesAvx2<F>(params, _mm256_loadu_ps(tailX), _mm256_loadu_ps(tailY), count - i, local);
+        _mm256_storeu_si256((__m256i*)tailIters, counter);
+        std::memcpy(iters + i, tailIters, (count - i) * sizeof(uint32_t));
+    }
+    if (stats) *stats += local;
+}
+
+template <typename F>
+__attribute__((target("avx512f")))
+inline __m512i escapeLanesAvx512(const EscapeParams& params, __m512 x, __m512 y, int lanes, EscapeStats& local) {
+    const __m512 four = _mm512_set1_ps(4.0f);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i maxIter = _mm512_set1_epi32(params.maxIter);
+    const bool julia = params.kind == FractalKind::Julia;
+
+    __m512 zx = x, zy = y;
+    __m512 cx = julia ? _mm512_set1_ps(params.juliaX) : zx;
+    __m512 cy = julia ? _mm512_set1_ps(params.juliaY) : zy;
+    __m512i counter = _mm512_setzero_si512();
+    // Only the first `lanes` lanes hold real points
+    __mmask16 active = (__mmask16)(lanes >= 16 ? 0xFFFF : (1u << lanes) - 1);
+
+    if (F::kInteriorTest && params.interiorChecks && !julia) {
+        const __m512 quarter = _mm512_set1_ps(0.25f);
+        __m512 xq = _mm512_sub_ps(zx, quarter);
+        __m512 y2 = _mm512_mul_ps(zy, zy);
+        __m512 q = _mm512_add_ps(_mm512_mul_ps(xq, xq), y2);
+        __mmask16 cardioid = _mm512_mask_cmp_ps_mask(active, _mm512_mul_ps(q, _mm512_add_ps(q, xq)),
+                                                     _mm512_mul_ps(quarter, y2), _CMP_LE_OQ);
+        __m512 x1 = _mm512_add_ps(zx, _mm512_set1_ps(1.0f));
+        __mmask16 bulb = _mm512_mask_cmp_ps_mask(active & (__mmask16)~cardioid,
+            _mm512_add_ps(_mm512_mul_ps(x1, x1), y2), _mm512_set1_ps(0.0625f), _CMP_LE_OQ);
+        local.cardioid += __builtin_popcount(cardioid);
+        local.bulb += __builtin_popcount(bulb);
+        local.skipped += (long long)__builtin_popcount(cardioid | bulb) * params.maxIter;
+        counter = _mm512_mask_mov_epi32(counter, cardioid | bulb, maxIter);
+        active &= (__mmask16)~(cardioid | bulb);
+    }
+
+    __m512 savedX = zx, savedY = zy;
+    int nextSave = 2;
+    for (int iter = 0; iter < params.maxIter; iter++) {
+        __m512 zx2 = _mm512_mul_ps(zx, zx);
+        __m512 zy2 = _mm512_mul_ps(zy, zy);
+        active = _mm512_mask_cmp_ps_mask(active, _mm512_add_ps(zx2, zy2), four, _CMP_LE_OQ);
+        if (active == 0) break;
+        counter = _mm512_mask_add_epi32(counter, active, counter, one);
+        F::step(zx, zy, zx2, zy2, cx, cy);
+        if (!params.interiorChecks) continue;
+
+        __mmask16 repeated = _mm512_mask_cmp_ps_mask(active, zx, savedX, _CMP_EQ_OQ);
+        repeated = _mm512_mask_cmp_ps_mask(repeated, zy, savedY, _CMP_EQ_OQ);
+        if (repeated) {
+            local.periodic += __builtin_popcount(repeated);
+            local.skipped += (long long)__builtin_popcount(repeated) * (params.maxIter - (iter + 1));
+            counter = _mm512_mask_mov_epi32(counter, repeated, maxIter);
+            active &= (__mmask16)~repeated;
+        }
+        if (iter + 1 == nextSave) {
+            savedX = zx;
+            savedY = zy;
+            nextSave *= 2;
+        }
+    }
+    return counter;
+}
+
+template <typename F>
+__attribute__((target("avx512f")))
+inline void escapeRowAvx512(const EscapeParams& params, const Viewport& view, int row, int x0,
+                            int count, uint32_t* iters, EscapeStats* stats) {
+    const __m512 y0 = _mm512_set1_ps(view.pixelY((float)row));
+    EscapeStats local;
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        alignas(64) float xs[16];
+        for (int lane = 0; lane < 16; lane++) xs[lane] = view.pixelX((float)(x0 + i + lane));
+        _mm512_storeu_si512((void*)(iters + i), escapeLanesAvx512<F>(params, _mm512_load_ps(xs), y0, 16, local));
+    }
+    escapeRowScalar<F>(params, view, row, x0 + i, count - i, iters + i, &local);
+    if (stats) *stats += local;
+}
+
+template <typename F>
+__attribute__((target("avx512f")))
+inline void escapePointsAvx512(const EscapeParams& params, const float* xs, const float* ys, int count,
+                               uint32_t* iters, EscapeStats* stats) {
+    EscapeStats local;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i counter = escapeLanesAvx512<F>(params, _mm512_loadu_ps(xs + i), _mm512_loadu_ps(ys + i), 16,
+                                              local);
+        _mm512_storeu_si512((void*)(iters + i), counter);
+    }
+    if (i < count) {
+        // One more lane group, with the spare lanes finished from the start
+        float tailX[16], tailY[16];
+        uint32_t tailIters[16];
+        for (int lane = 0; lane < 16; lane++) {
+            int point = std::min(i + lane, count - 1);
+            tailX[lane] = xs[point];
+            tailY[lane] = ys[point];
+        }
+        __m512i counter = escapeLanesAvx512<F>(params, _mm512_loadu_ps(tailX), _mm512_loadu_ps(tailY), count - i, local);
+        _mm512_storeu_si512((void*)tailIters, counter);
+        std::memcpy(iters + i, tailIters, (count - i) * sizeof(uint32_t));
+    }
+    if (stats) *stats += local;
+}
+
+#endif
+
+// Iteration counts for pixels [x0, x0 + count) of a top-down row. Pixels
+// resolved by the interior shortcuts are added to stats when given.
+inline void escapeRow(const EscapeParams& params, const Viewport& view, int row, int x0, int count,
+                      uint32_t* iters, SimdLevel level, EscapeStats* stats = nullptr) {
+    withFormula(params.formula, [&](auto formula) {
+        using F = decltype(formula);
+        switch (level) {
+#ifdef FRACTALS_X86
+            case SimdLevel::Avx512: escapeRowAvx512<F>(params, view, row, x0, count, iters, stats); return;
+            case SimdLevel::Avx2: escapeRowAvx2<F>(params, view, row, x0, count, iters, stats); return;
+            case SimdLevel::Sse2: escapeRowSse2<F>(params, view, row, x0, count, iters, stats); return;
+#endif
+            default: escapeRowScalar<F>(params, view, row, x0, count, iters, stats); return;
+        }
+    });
+}
+
+// Iteration counts for count arbitrary points, for callers whose pixels are
+// scattered (subdivision borders) but should still fill whole lane groups.
+inline void escapePoints(const EscapeParams& params, const float* xs, const float* ys, int count,
+                         uint32_t* iters, SimdLevel level, EscapeStats* stats = nullptr) {
+    withFormula(params.formula, [&](auto formula) {
+        using F = decltype(formula);
+        switch (level) {
+#ifdef FRACTALS_X86
+            case SimdLevel::Avx512: escapePointsAvx512<F>(params, xs, ys, count, iters, stats); return;
+            case SimdLevel::Avx2: escapePointsAvx2<F>(params, xs, ys, count, iters, stats); return;
+            case SimdLevel::Sse2: escapePointsSse2<F>(params, xs, ys, count, iters, stats); return;
+#endif
+            default: escapePointsScalar<F>(params, xs, ys, count, iters, stats); return;
+        }
+    });
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+// Input state of the interactive explorer, shared between the event thread
+// and the render thread. GLFW delivers events on the main thread only, so
+// that thread waits for events and records them here with their time, and
+// rendering runs on a thread of its own. The camera pans at a fixed speed
+// in fractal units per second while an arrow key is held: each key change
+// folds the motion so far into the position, so the position at any time
+// follows from the last change and the velocity, whatever the frame rate.
+// The animation clock likewise only advances while not paused. The render
+// thread asks for the state at the time it draws, and when nothing on
+// screen can change (paused, camera still, no palette cycling, same size,
+// and the field itself settled) it sleeps until the next event instead of
+// drawing the same frame again.
+
+#include <condition_variable>
+#include <mutex>
+
+// Arrow keys, for ExplorerInput::key()
+enum PanKey { kPanLeft = 1, kPanRight = 2, kPanUp = 4, kPanDown = 8 };
+
+class ExplorerInput {
+public:
+    // The state at one time, as the render thread draws it.
+    struct Frame {
+        double time = 0.0;          // Clock the state was taken at
+        float cameraX = 0.0f;
+        float cameraY = 0.0f;
+        float animationTime = 0.0f; // Animation clock, stopped while paused
+        int width = 0;
+        int height = 0;
+        bool moving = false;
+        bool paused = false;
+        bool closing = false;
+    };
+
+    ExplorerInput(float cameraX, float cameraY, float panSpeed, int width, int height, double time)
+        : x(cameraX), y(cameraY), speed(panSpeed), changedAt(time), resumedAt(time), width(width), height(height) {}
+
+    // Event thread: an arrow key went down or up at time.
+    void key(PanKey which, bool pressed, double time) {
+        std::lock_guard<std::mutex> lock(mutex);
+        advance(time);
+        held = pressed ? held | which : held & ~which;
+        changed.notify_one();
+    }
+
+    // Event thread: Space.
+    void togglePause(double time) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (paused) resumedAt = time;
+        else animationBase += time - resumedAt;
+        paused = !paused;
+        changed.notify_one();
+    }
+
+    void resize(int newWidth, int newHeight) {
+        std::lock_guard<std::mutex> lock(mutex);
+        width = newWidth;
+        height = newHeight;
+        changed.notify_one();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        changed.notify_one();
+    }
+
+    // Render thread: the state at now() once it differs from last (the
+    // frame drawn before), waiting for an event until then. A frame that
+    // is still moving, animating or (with cycling) recolouring differs by
+    // definition, as does one whose field will change on its own
+    // (fieldChanging: the renderer has a histogram to read or a budget
+    // other than last's). A minimized window (size 0) waits until it is
+    // restored. Returns the time spent waiting through idleSeconds.
+    template <typename Clock>
+    Frame next(const Frame& last, bool first, bool cycling, bool fieldChanging, Clock now, double& idleSeconds) {
+        std::unique_lock<std::mutex> lock(mutex);
+        idleSeconds = 0.0;
+        for (;;) {
+            Frame frame = snapshot(now());
+            if (frame.closing) return frame;
+            bool visible = frame.width > 0 && frame.height > 0;
+            if (visible && (first || frame.moving || !frame.paused || cycling || fieldChanging ||
+                            frame.width != last.width || frame.height != last.height ||
+                            frame.cameraX != last.cameraX || frame.cameraY != last.cameraY ||
+                            frame.animationTime != last.animationTime))
+                return frame;
+            double waitStart = now();
+            changed.wait(lock);
+            idleSeconds += now() - waitStart;
+        }
+    }
+
+private:
+    // Folds the motion up to time into the position.
+    void advance(double time) {
+        float dx = 0.0f, dy = 0.0f;
+        velocity(dx, dy);
+        x += dx * (float)(time - changedAt);
+        y += dy * (float)(time - changedAt);
+        changedAt = time;
+    }
+
+    void velocity(float& dx, float& dy) const {
+        dx = ((held & kPanRight) ? speed : 0.0f) - ((held & kPanLeft) ? speed : 0.0f);
+        dy = ((held & kPanUp) ? speed : 0.0f) - ((held & kPanDown) ? speed : 0.0f);
+    }
+
+    Frame snapshot(double time) const {
+        Frame frame;
+        frame.time = time;
+        float dx = 0.0f, dy = 0.0f;
+        velocity(dx, dy);
+        frame.cameraX = x + dx * (float)(time - changedAt);
+        frame.cameraY = y + dy * (float)(time - changedAt);
+        frame.moving = dx != 0.0f || dy != 0.0f;
+        frame.animationTime = (float)(paused ? animationBase : animationBase + time - resumedAt);
+        frame.width = width;
+        frame.height = height;
+        frame.paused = paused;
+        frame.closing = closing;
+        return frame;
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    float x, y;
+    float speed;
+    unsigned held = 0;
+    double changedAt;          // Time of the last key change
+    bool paused = false;
+    double animationBase = 0.0; // Animation clock up to the last pause
+    double resumedAt;
+    int width, height;
+    bool closing = false;
+};
@@ -0,0 +1,685 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "cpu_renderer.h"
+#include "farm_protocol.h"
+#include "scenes.h"
+
+// Render farm: a coordinator splits an animation into frame ranges, or one
+// large frame into rows of tiles, and leases them to worker processes that
+// connect over a Unix or TCP socket. Workers stream every finished frame or
+// tile row back; the coordinator writes them in order and re-dispatches the
+// unfinished part of a job whose worker disconnects or goes quiet for
+// longer than the lease.
+
+// What is rendered; the same on the coordinator and every worker.
+struct FarmSettings {
+    SceneKind scene = SceneKind::Mandelbrot;
+    Formula formula = Formula::Quadratic;
+    int width = 1920;
+    int height = 1080;
+    double fps = 60.0;
+    double startTime = 0.0;
+    long frames = 1;
+    bool splitTiles = false;  // Rows of tiles of the frame at --start instead of frames
+    int tileSize = 64;
+    int maxIter = 0;          // 0 = the scene's MAX_ITER
+    bool interiorChecks = true;
+    bool deep = false;
+    bool subdivide = false;
+    SubdivisionOptions subdivision;
+    std::string centerRe;     // Fixed view centre as decimal strings, empty = animated
+    std::string centerIm;
+    double zoom = 0.0;        // Fixed zoom, 0 = animated
+
+    // Items are frames, or rows of tiles of the single frame
+    long items() const { return splitTiles ? (height + tileSize - 1) / tileSize : frames; }
+    int itemRows(long item) const { return splitTiles ? std::min(tileSize, height - (int)item * tileSize) : height; }
+    size_t itemBytes(long item) const { return (size_t)width * itemRows(item) * 3; }
+};
+
+struct CoordinatorOptions {
+    std::string listen = "unix:/tmp/fractals-farm.sock";
+    int spawn = 0;            // Local workers to fork
+    long chunk = 4;           // Items per job
+    double leaseSeconds = 10.0;
+    long window = 64;         // Items dispatched ahead of the output writer
+    std::string output;
+};
+
+struct WorkerOptions {
+    std::string connect = "unix:/tmp/fractals-farm.sock";
+    int threads = 0;          // 0 = one per hardware thread
+    SimdLevel simd = detectSimdLevel();
+    bool pinThreads = false;
+};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " coordinator [options]\n"
+              << "       " << program << " worker [options]\n"
+              << "Coordinator:\n"
+              << "  --listen ADDRESS     unix:/path or host:port (default unix:/tmp/fractals-farm.sock)\n"
+              << "  --spawn N            Fork N local workers (default 0: wait for workers to connect)\n"
+              << "  --split MODE         frames: frame ranges of an animation (default), or tiles: rows\n"
+              << "                       of tiles of the single frame at --start\n"
+              << "  --chunk N            Frames or tile rows per job (default 4)\n"
+              << "  --lease S            Seconds a worker may stay silent before its job is\n"
+              << "                       re-dispatched (default 10)\n"
+              << "  --window N           Frames or tile rows rendered ahead of the writer (default 64)\n"
+              << "  --out PATH           frames: PPM pattern (e.g. out/frame_%05d.ppm) or '-' for raw\n"
+              << "                       RGB24 on stdout; tiles: one PPM file or '-' for stdout\n"
+              << "  Render settings as in cpurender: --scene, --formula, --size, --fps, --start, --frames,\n"
+              << "  --tile, --max-iter, --no-interior-checks, --subdivide, --min-rect, --filament-dwell,\n"
+              << "  --deep, --center, --zoom\n"
+              << "Worker:\n"
+              << "  --connect ADDRESS    Coordinator address (default unix:/tmp/fractals-farm.sock)\n"
+              << "  --threads N          Render threads (default: one per hardware thread)\n"
+              << "  --simd LEVEL         scalar, sse2, avx2 or avx512 (default: widest supported)\n"
+              << "  --pin                Pin render threads to CPUs" << std::endl;
+}
+
+// Parses the render setting at args[i], if it is one; false on a bad value.
+bool parseSetting(const std::vector<std::string>& args, size_t& i, FarmSettings& settings, bool& handled) {
+    const std::string& arg = args[i];
+    bool hasValue = i + 1 < args.size();
+    handled = true;
+    if (arg == "--scene" && hasValue) {
+        if (!parseSceneKind(args[++i].c_str(), settings.scene)) {
+            std::cerr << "Unknown scene " << args[i] << std::endl;
+            return false;
+        }
+    } else if (arg == "--formula" && hasValue) {
+        if (!parseFormula(args[++i].c_str(), settings.formula)) {
+            std::cerr << "Unknown formula " << args[i] << std::endl;
+            return false;
+        }
+    } else if (arg == "--size" && hasValue) {
+        if (std::sscanf(args[++i].c_str(), "%dx%d", &settings.width, &settings.height) != 2 ||
+            settings.width <= 0 || settings.height <= 0) {
+            std::cerr << "Invalid --size, expected WxH" << std::endl;
+            return false;
+        }
+    } else if (arg == "--fps" && hasValue) {
+        settings.fps = std::atof(args[++i].c_str());
+    } else if (arg == "--start" && hasValue) {
+        settings.startTime = std::atof(args[++i].c_str());
+    } else if (arg == "--frames" && hasValue) {
+        settings.frames = std::atol(args[++i].c_str());
+    } else if (arg == "--split" && hasValue) {
+        std::string mode = args[++i];
+        if (mode != "frames" && mode != "tiles") {
+            std::cerr << "Unknown --split " << mode << ", expected frames or tiles" << std::endl;
+            return false;
+        }
+        settings.splitTiles = mode == "tiles";
+    } else if (arg == "--tile" && hasValue) {
+        settings.tileSize = std::atoi(args[++i].c_str());
+    } else if (arg == "--max-iter" && hasValue) {
+        settings.maxIter = std::atoi(args[++i].c_str());
+    } else if (arg == "--no-interior-checks") {
+        settings.interiorChecks = false;
+    } else if (arg == "--subdivide") {
+        settings.subdivide = true;
+    } else if (arg == "--min-rect" && hasValue) {
+        settings.subdivision.minSize = std::max(2, std::atoi(args[++i].c_str()));
+    } else if (arg == "--filament-dwell" && hasValue) {
+        settings.subdivision.filamentDwell = std::atoi(args[++i].c_str());
+    } else if (arg == "--deep") {
+        settings.deep = true;
+    } else if (arg == "--center" && hasValue) {
+        std::string center = args[++i];
+        size_t comma = center.find(',');
+        if (comma == std::string::npos) {
+            std::cerr << "Invalid --center, expected RE,IM" << std::endl;
+            return false;
+        }
+        settings.centerRe = center.substr(0, comma);
+        settings.centerIm = center.substr(comma + 1);
+    } else if (arg == "--zoom" && hasValue) {
+        settings.zoom = std::atof(args[++i].c_str());
+    } else {
+        handled = false;
+    }
+    return true;
+}
+
+bool validateSettings(const FarmSettings& settings) {
+    if (settings.fps <= 0.0 || settings.frames < 1 || settings.tileSize < 1) {
+        std::cerr << "--fps, --frames and --tile must be positive" << std::endl;
+        return false;
+    }
+    if (settings.deep && settings.scene != SceneKind::Mandelbrot) {
+        std::cerr << "--deep is only available for the mandelbrot scene" << std::endl;
+        return false;
+    }
+    if (settings.deep && settings.formula != Formula::Quadratic) {
+        std::cerr << "--deep is only available for the quadratic formula" << std::endl;
+        return false;
+    }
+    if (settings.deep && settings.subdivide) {
+        std::cerr << "--subdivide cannot be combined with --deep" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The settings as the arguments that parse back into them, for Config.
+std::vector<std::string> settingArguments(const FarmSettings& settings) {
+    char number[64];
+    auto real = [&](double value) {
+        std::snprintf(number, sizeof(number), "%.17g", value);
+        return std::string(number);
+    };
+    std::vector<std::string> args = {
+        "--scene", sceneKindName(settings.scene), "--formula", formulaName(settings.formula),
+        "--size", std::to_string(settings.width) + "x" + std::to_string(settings.height),
+        "--fps", real(settings.fps), "--start", real(settings.startTime),
+        "--frames", std::to_string(settings.frames), "--split", settings.splitTiles ? "tiles" : "frames",
+        "--tile", std::to_string(settings.tileSize), "--max-iter", std::to_string(settings.maxIter),
+        "--min-rect", std::to_string(settings.subdivision.minSize),
+        "--filament-dwell", std::to_string(settings.subdivision.filamentDwell), "--zoom", real(settings.zoom)};
+    if (!settings.interiorChecks) args.push_back("--no-interior-checks");
+    if (settings.subdivide) args.push_back("--subdivide");
+    if (settings.deep) args.push_back("--deep");
+    if (!settings.centerRe.empty()) args.insert(args.end(), {"--center", settings.centerRe + "," + settings.centerIm});
+    return args;
+}
+
+bool parseOptions(int argc, char** argv, bool& worker, FarmSettings& settings, CoordinatorOptions& coordinator,
+                  WorkerOptions& workerOptions) {
+    if (argc < 2 || (std::string(argv[1]) != "coordinator" && std::string(argv[1]) != "worker")) {
+        printUsage(argv[0]);
+        return false;
+    }
+    worker = std::string(argv[1]) == "worker";
+    std::vector<std::string> args(argv + 2, argv + argc);
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+
+        bool handled = false;
+        if (!worker && !parseSetting(args, i, settings, handled)) return false;
+        if (handled) continue;
+        if (!worker && arg == "--listen" && hasValue) {
+            coordinator.listen = args[++i];
+        } else if (!worker && arg == "--spawn" && hasValue) {
+            coordinator.spawn = std::atoi(args[++i].c_str());
+        } else if (!worker && arg == "--chunk" && hasValue) {
+            coordinator.chunk = std::atol(args[++i].c_str());
+        } else if (!worker && arg == "--lease" && hasValue) {
+            coordinator.leaseSeconds = std::atof(args[++i].c_str());
+        } else if (!worker && arg == "--window" && hasValue) {
+            coordinator.window = std::atol(args[++i].c_str());
+        } else if (!worker && arg == "--out" && hasValue) {
+            coordinator.output = args[++i];
+        } else if (worker && arg == "--connect" && hasValue) {
+            workerOptions.connect = args[++i];
+        } else if (worker && arg == "--threads" && hasValue) {
+            workerOptions.threads = std::atoi(args[++i].c_str());
+        } else if (worker && arg == "--simd" && hasValue) {
+            if (!parseSimdLevel(args[++i].c_str(), workerOptions.simd)) {
+                std::cerr << "Unknown SIMD level " << args[i] << std::endl;
+                return false;
+            }
+        } else if (worker && arg == "--pin") {
+            workerOptions.pinThreads = true;
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (worker) {
+        if (workerOptions.simd > detectSimdLevel()) {
+            std::cerr << simdLevelName(workerOptions.simd) << " is not supported on this CPU" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (coordinator.chunk < 1 || coordinator.window < 1 || coordinator.leaseSeconds <= 0.0 || coordinator.spawn < 0) {
+        std::cerr << "--chunk, --window and --lease must be positive" << std::endl;
+        return false;
+    }
+    return validateSettings(settings);
+}
+
+// Renders items for a worker: whole frames through the frame pipeline, or
+// rows of tiles straight into the result buffer.
+class FarmRenderer {
+public:
+    FarmRenderer(const FarmSettings& settings, const WorkerOptions& options)
+        : settings(settings), simd(options.simd), scheduler(options.threads, options.pinThreads),
+          scratch(scheduler.threadCount()), workerStats(scheduler.threadCount()) {
+        if (settings.deep) modes.deep = &deep;
+        if (settings.subdivide) modes.subdivision = &this->settings.subdivision;
+        if (!settings.splitTiles) frame.resize(settings.width, settings.height, settings.tileSize);
+        else tiles = makeTiles(settings.width, settings.height, settings.tileSize);
+    }
+
+    int threadCount() const { return scheduler.threadCount(); }
+
+    bool render(long item, std::vector<uint8_t>& rgb) {
+        // A tile row belongs to the frame at --start; its scene is set up once
+        long frameIndex = settings.splitTiles ? 0 : item;
+        if (!sceneReady || frameIndex != sceneFrame) {
+            if (!setupScene(frameIndex)) return false;
+        }
+        if (!settings.splitTiles) {
+            renderFrame(scene, simd, scheduler, frame, modes);
+            rgb.insert(rgb.end(), frame.image.rgb.begin(), frame.image.rgb.end());
+            return true;
+        }
+
+        int y0 = (int)item * settings.tileSize;
+        size_t offset = rgb.size();
+        rgb.resize(offset + settings.itemBytes(item));
+        uint8_t* rows = rgb.data() + offset;
+        int across = (settings.width + settings.tileSize - 1) / settings.tileSize;
+        std::vector<Tile> row(tiles.begin() + item * across, tiles.begin() + (item + 1) * across);
+        scheduler.run(row, [&](const Tile& tile, int worker) {
+            renderTileRgb(scene, simd, modes, tile, rows + ((size_t)(tile.y0 - y0) * settings.width + tile.x0) * 3,
+                          settings.width, scratch[worker], workerStats[worker]);
+        });
+        return true;
+    }
+
+private:
+    // As cpurender: the animated scene at the frame's iTime with the fixed
+    // view and iteration overrides applied.
+    bool setupScene(long frameIndex) {
+        float time = (float)(settings.startTime + frameIndex / settings.fps);
+        scene = makeScene(settings.scene, time, settings.width, settings.height);
+        if (settings.maxIter > 0) scene.primary.maxIter = scene.secondary.maxIter = settings.maxIter;
+        scene.primary.interiorChecks = scene.secondary.interiorChecks = settings.interiorChecks;
+        scene.primary.formula = scene.secondary.formula = settings.formula;
+        double zoom = settings.zoom > 0.0 ? settings.zoom : std::exp((double)scene.time * 0.13);
+        if (settings.zoom > 0.0) scene.viewport.zoom = (float)std::min(settings.zoom, 1e30);
+        if (!settings.centerRe.empty()) {
+            scene.viewport.centerX = (float)std::atof(settings.centerRe.c_str());
+            scene.viewport.centerY = (float)std::atof(settings.centerIm.c_str());
+        }
+        if (settings.deep && !setupDeepFrame(scene, zoom, settings.centerRe, settings.centerIm, deep)) return false;
+        sceneReady = true;
+        sceneFrame = frameIndex;
+        return true;
+    }
+
+    FarmSettings settings;
+    SimdLevel simd;
+    TileScheduler scheduler;
+    FrameBuffers frame;
+    std::vector<Tile> tiles;
+    std::vector<TileScratch> scratch;
+    std::vector<WorkerStats> workerStats;
+    DeepFrame deep;
+    RenderModes modes;
+    Scene scene;
+    bool sceneReady = false;
+    long sceneFrame = -1;
+};
+
+int runWorker(const WorkerOptions& options) {
+    int fd = connectFarm(options.connect);
+    if (fd < 0) return -1;
+
+    std::vector<uint8_t> hello;
+    putU32(hello, (uint32_t)(options.threads > 0 ? options.threads : std::thread::hardware_concurrency()));
+    Message message;
+    if (!sendMessage(fd, FarmMessage::Hello, hello) || !readMessage(fd, message) ||
+        message.type != FarmMessage::Config) {
+        std::cerr << "worker: no configuration from the coordinator" << std::endl;
+        close(fd);
+        return -1;
+    }
+    std::vector<std::string> args;
+    std::string text(message.payload.begin(), message.payload.end());
+    for (size_t begin = 0; begin < text.size();) {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos) end = text.size();
+        args.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    FarmSettings settings;
+    for (size_t i = 0; i < args.size(); i++) {
+        bool handled;
+        if (!parseSetting(args, i, settings, handled) || !handled) {
+            std::cerr << "worker: bad configuration" << std::endl;
+            close(fd);
+            return -1;
+        }
+    }
+    FarmRenderer renderer(settings, options);
+
+    // Heartbeats keep the lease of a long job alive; sends share the socket
+    std::mutex sendMutex;
+    std::condition_variable stopped;
+    bool stopping = false;
+    std::thread heartbeat([&] {
+        std::unique_lock<std::mutex> lock(sendMutex);
+        while (!stopped.wait_for(lock, std::chrono::seconds(1), [&] { return stopping; }))
+            sendMessage(fd, FarmMessage::Heartbeat, {});
+    });
+
+    int result = 0;
+    std::vector<uint8_t> payload;
+    while (readMessage(fd, message) && message.type == FarmMessage::Job) {
+        PayloadReader reader(message.payload);
+        uint64_t jobId;
+        uint32_t first, count;
+        if (!reader.u64(jobId) || !reader.u32(first) || !reader.u32(count)) break;
+        bool ok = true;
+        for (uint32_t item = first; ok && item < first + count; item++) {
+            payload.clear();
+            putU64(payload, jobId);
+            putU32(payload, item);
+            if (!renderer.render(item, payload)) {
+                result = -1;
+                ok = false;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(sendMutex);
+            ok = sendMessage(fd, FarmMessage::Result, payload);
+        }
+        if (!ok) break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        stopping = true;
+    }
+    stopped.notify_one();
+    heartbeat.join();
+    close(fd);
+    return result;
+}
+
+// Writes results in item order: numbered PPM frames, raw frames on stdout,
+// or the rows of one PPM image.
+class FarmOutput {
+public:
+    bool open(const FarmSettings& settings, const std::string& path) {
+        this->settings = settings;
+        this->path = path;
+        if (!settings.splitTiles || path.empty()) return true;
+        file = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cerr << "Failed to open " << path << " for writing" << std::endl;
+            return false;
+        }
+        std::fprintf(file, "P6\n%d %d\n255\n", settings.width, settings.height);
+        return true;
+    }
+
+    bool write(long item, std::vector<uint8_t>& rgb) {
+        if (path.empty()) return true;
+        if (settings.splitTiles || path == "-") {
+            FILE* out = file ? file : stdout;
+            if (std::fwrite(rgb.data(), 1, rgb.size(), out) != rgb.size()) {
+                std::cerr << "Failed to write " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+        Image image;
+        image.width = settings.width;
+        image.height = settings.height;
+        image.rgb.swap(rgb);
+        return writePpm(framePath(path, item), image);
+    }
+
+    bool close() {
+        if (!file) return std::fflush(stdout) == 0;
+        bool ok = file == stdout ? std::fflush(stdout) == 0 : std::fclose(file) == 0;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    FarmSettings settings;
+    std::string path;
+    FILE* file = nullptr;
+};
+
+using FarmClock = std::chrono::steady_clock;
+
+struct FarmWorkerConnection {
+    int fd = -1;
+    int number = 0;
+    MessageBuffer inbox;
+    bool ready = false;       // Hello received, Config sent
+    bool busy = false;
+    uint64_t jobId = 0;
+    long first = 0;           // The job's items still to come are first .. first + remaining - 1
+    long remaining = 0;
+    FarmClock::time_point lastHeard;
+    long items = 0;
+};
+
+class Coordinator {
+public:
+    Coordinator(const FarmSettings& settings, const CoordinatorOptions& options)
+        : settings(settings), options(options) {}
+
+    int run() {
+        listenFd = listenFarm(options.listen);
+        if (listenFd < 0) return -1;
+        if (!output.open(settings, options.output)) return -1;
+        total = settings.items();
+        pending[0] = total;
+
+        for (int i = 0; i < options.spawn; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                ::close(listenFd);
+                WorkerOptions worker;
+                worker.connect = options.listen;
+                worker.threads = std::max(1, (int)std::thread::hardware_concurrency() / options.spawn);
+                std::_Exit(runWorker(worker) == 0 ? 0 : 1);
+            }
+            if (pid > 0) children.push_back(pid);
+        }
+        std::fprintf(stderr, "coordinator: %ld %s on %s, %ld per job\n", total,
+                     settings.splitTiles ? "tile rows" : "frames", options.listen.c_str(), options.chunk);
+
+        auto start = FarmClock::now();
+        bool ok = true;
+        while (ok && written < total) {
+            ok = step();
+        }
+        for (FarmWorkerConnection& worker : workers) {
+            sendMessage(worker.fd, FarmMessage::Shutdown, {});
+            ::close(worker.fd);
+        }
+        ::close(listenFd);
+        if (options.listen.compare(0, 5, "unix:") == 0) unlink(options.listen.c_str() + 5);
+        for (pid_t child : children) waitpid(child, nullptr, 0);
+        ok = output.close() && ok;
+
+        double seconds = std::chrono::duration<double>(FarmClock::now() - start).count();
+        std::fprintf(stderr, "coordinator: %ld of %ld %s in %.2f s (%.1f per second), %ld re-dispatched\n",
+                     written, total, settings.splitTiles ? "tile rows" : "frames", seconds, written / seconds,
+                     redispatched);
+        for (const auto& entry : itemsByWorker)
+            std::fprintf(stderr, "  worker %d: %ld\n", entry.first, entry.second);
+        return ok ? 0 : -1;
+    }
+
+private:
+    // One round of the event loop: accept, read, lease check, dispatch.
+    bool step() {
+        std::vector<pollfd> fds = {{listenFd, POLLIN, 0}};
+        for (const FarmWorkerConnection& worker : workers) fds.push_back({worker.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), 250) < 0 && errno != EINTR) return false;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                FarmWorkerConnection worker;
+                worker.fd = fd;
+                worker.number = ++connections;
+                worker.lastHeard = FarmClock::now();
+                workers.push_back(std::move(worker));
+            }
+        }
+
+        std::vector<int> lost;
+        for (size_t i = 0; i + 1 < fds.size(); i++) {
+            if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            FarmWorkerConnection& worker = workers[i];
+            if (!worker.inbox.receive(worker.fd)) {
+                lost.push_back(worker.number);
+                continue;
+            }
+            Message message;
+            bool error = false;
+            while (worker.inbox.next(message, error)) {
+                if (!handle(worker, message)) {
+                    error = true;
+                    break;
+                }
+            }
+            if (error) lost.push_back(worker.number);
+            if (!flush()) return false;
+        }
+
+        auto now = FarmClock::now();
+        for (const FarmWorkerConnection& worker : workers) {
+            double silent = std::chrono::duration<double>(now - worker.lastHeard).count();
+            if (worker.busy && silent > options.leaseSeconds) {
+                std::fprintf(stderr, "coordinator: worker %d silent for %.1f s\n", worker.number, silent);
+                lost.push_back(worker.number);
+            }
+        }
+        for (int number : lost) drop(number);
+
+        dispatch();
+        if (workers.empty() && lastWaitNotice + std::chrono::seconds(10) < now) {
+            std::fprintf(stderr, "coordinator: waiting for workers on %s\n", options.listen.c_str());
+            lastWaitNotice = now;
+        }
+        return true;
+    }
+
+    bool handle(FarmWorkerConnection& worker, const Message& message) {
+        worker.lastHeard = FarmClock::now();
+        PayloadReader reader(message.payload);
+        if (message.type == FarmMessage::Hello) {
+            uint32_t threads = 0;
+            reader.u32(threads);
+            std::string config;
+            for (const std::string& arg : settingArguments(settings)) config += arg + "\n";
+            worker.ready = sendMessage(worker.fd, FarmMessage::Config,
+                                       std::vector<uint8_t>(config.begin(), config.end()));
+            std::fprintf(stderr, "coordinator: worker %d connected with %u thread(s)\n", worker.number, threads);
+            return worker.ready;
+        }
+        if (message.type == FarmMessage::Heartbeat) return true;
+        if (message.type != FarmMessage::Result) return false;
+
+        // Results arrive in order within the job
+        uint64_t jobId;
+        uint32_t item;
+        if (!reader.u64(jobId) || !reader.u32(item) || !worker.busy || jobId != worker.jobId ||
+            (long)item != worker.first || message.payload.size() - reader.position() != settings.itemBytes(item))
+            return false;
+        results[item].assign(message.payload.begin() + reader.position(), message.payload.end());
+        worker.first++;
+        worker.items++;
+        itemsByWorker[worker.number]++;
+        worker.busy = --worker.remaining > 0;
+        return true;
+    }
+
+    // Writes the results that are next in order.
+    bool flush() {
+        for (auto it = results.begin(); it != results.end() && it->first == written; it = results.erase(it)) {
+            if (!output.write(written, it->second)) return false;
+            written++;
+        }
+        return true;
+    }
+
+    // Closes a worker and puts the unfinished rest of its job back in front.
+    void drop(int number) {
+        for (size_t i = 0; i < workers.size(); i++) {
+            FarmWorkerConnection& worker = workers[i];
+            if (worker.number != number) continue;
+            if (worker.busy) {
+                pending[worker.first] = worker.remaining;
+                redispatched += worker.remaining;
+                std::fprintf(stderr, "coordinator: worker %d lost, re-dispatching %ld item(s) from %ld\n",
+                             worker.number, worker.remaining, worker.first);
+            } else {
+                std::fprintf(stderr, "coordinator: worker %d disconnected\n", worker.number);
+            }
+            ::close(worker.fd);
+            workers.erase(workers.begin() + i);
+            return;
+        }
+    }
+
+    // Leases the lowest pending items to idle workers, staying within the
+    // window ahead of the writer so out-of-order results stay bounded.
+    void dispatch() {
+        for (FarmWorkerConnection& worker : workers) {
+            if (!worker.ready || worker.busy || pending.empty()) continue;
+            auto it = pending.begin();
+            long first = it->first;
+            if (first >= written + options.window) return;
+            long count = std::min({it->second, options.chunk, written + options.window - first});
+            long rest = it->second - count;
+            pending.erase(it);
+            if (rest > 0) pending[first + count] = rest;
+
+            std::vector<uint8_t> job;
+            putU64(job, ++jobs);
+            putU32(job, (uint32_t)first);
+            putU32(job, (uint32_t)count);
+            worker.busy = true;
+            worker.jobId = jobs;
+            worker.first = first;
+            worker.remaining = count;
+            worker.lastHeard = FarmClock::now();
+            // A failed send shows up as a lost connection on the next read
+            sendMessage(worker.fd, FarmMessage::Job, job);
+        }
+    }
+
+    FarmSettings settings;
+    CoordinatorOptions options;
+    FarmOutput output;
+    int listenFd = -1;
+    std::vector<pid_t> children;
+    std::vector<FarmWorkerConnection> workers;
+    int connections = 0;
+    uint64_t jobs = 0;
+    long total = 0;
+    long written = 0;
+    long redispatched = 0;
+    std::map<long, long> pending;                    // First item -> count, not yet leased
+    std::map<long, std::vector<uint8_t>> results;    // Finished items waiting for the writer
+    std::map<int, long> itemsByWorker;
+    FarmClock::time_point lastWaitNotice = FarmClock::now();
+};
+
+int main(int argc, char** argv) {
+    bool worker = false;
+    FarmSettings settings;
+    CoordinatorOptions coordinator;
+    WorkerOptions workerOptions;
+    if (!parseOptions(argc, argv, worker, settings, coordinator, workerOptions)) return -1;
+    if (worker) return runWorker(workerOptions);
+    return Coordinator(settings, coordinator).run();
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+// Wire protocol of the render farm. Coordinator and workers talk over a
+// Unix socket ("unix:/path") or TCP ("host:port") in length-prefixed
+// messages: a 32-bit type, a 32-bit payload length and the payload, all
+// integers little-endian.
+//
+//   worker -> coordinator   Hello      worker thread count
+//   coordinator -> worker   Config     render settings as command line arguments
+//   coordinator -> worker   Job        job id, first item, item count
+//   worker -> coordinator   Result     job id, item, RGB24 pixels (one per item, in order)
+//   worker -> coordinator   Heartbeat  (while rendering, keeps the lease alive)
+//   coordinator -> worker   Shutdown
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum class FarmMessage : uint32_t { Hello = 1, Config, Job, Result, Heartbeat, Shutdown };
+
+// Largest payload accepted, well above a row of tiles of a 100k pixel wide frame
+constexpr uint32_t kMaxFarmPayload = 1u << 30;
+
+struct Message {
+    FarmMessage type = FarmMessage::Hello;
+    std::vector<uint8_t> payload;
+};
+
+// Little-endian payload building and parsing
+inline void putU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back((uint8_t)(value >> (8 * i)));
+}
+inline void putU64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out.push_back((uint8_t)(value >> (8 * i)));
+}
+
+class PayloadReader {
+public:
+    PayloadReader(const std::vector<uint8_t>& payload) : data(payload) {}
+
+    bool u32(uint32_t& value) {
+        if (offset + 4 > data.size()) return false;
+        value = 0;
+        for (int i = 0; i < 4; i++) value |= (uint32_t)data[offset + i] << (8 * i);
+        offset += 4;
+        return true;
+    }
+    bool u64(uint64_t& value) {
+        if (offset + 8 > data.size()) return false;
+        value = 0;
+        for (int i = 0; i < 8; i++) value |= (uint64_t)data[offset + i] << (8 * i);
+        offset += 8;
+        return true;
+    }
+    size_t position() const { return offset; }
+
+private:
+    const std::vector<uint8_t>& data;
+    size_t offset = 0;
+};
+
+// Resolves "unix:/path" or "host:port" into a socket address.
+inline bool resolveFarmAddress(const std::string& address, sockaddr_storage& storage, socklen_t& length) {
+    std::memset(&storage, 0, sizeof(storage));
+    if (address.compare(0, 5, "unix:") == 0) {
+        std::string path = address.substr(5);
+        sockaddr_un* un = (sockaddr_un*)&storage;
+        if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+            std::cerr << "Invalid socket path " << path << std::endl;
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        length = sizeof(sockaddr_un);
+        return true;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Invalid address " << address << ", expected unix:/path or host:port" << std::endl;
+        return false;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0 || !found) {
+        std::cerr << "Cannot resolve " << address << std::endl;
+        return false;
+    }
+    std::memcpy(&storage, found->ai_addr, found->ai_addrlen);
+    length = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+inline int listenFarm(const std::string& address) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveFarmAddress(address, storage, length)) return -1;
+    if (storage.ss_family == AF_UNIX) unlink(((sockaddr_un*)&storage)->sun_path);
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    int yes = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (fd < 0 || bind(fd, (sockaddr*)&storage, length) != 0 || listen(fd, 64) != 0) {
+        std::cerr << "Cannot listen on " << address << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connects to the coordinator, retrying for a while so workers may be
+// started before it.
+inline int connectFarm(const std::string& address, int attempts = 50) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveFarmAddress(address, storage, length)) return -1;
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+        if (fd < 0) break;
+        if (connect(fd, (sockaddr*)&storage, length) == 0) {
+            int yes = 1;
+            if (storage.ss_family != AF_UNIX) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    std::cerr << "Cannot connect to " << address << std::endl;
+    return -1;
+}
+
+inline bool sendAll(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+inline bool sendMessage(int fd, FarmMessage type, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> header;
+    putU32(header, (uint32_t)type);
+    putU32(header, (uint32_t)payload.size());
+    return sendAll(fd, header.data(), header.size()) && sendAll(fd, payload.data(), payload.size());
+}
+
+// Collects received bytes and splits them into messages; for the
+// coordinator, which reads whatever poll() says is available.
+class MessageBuffer {
+public:
+    // Appends what can be read from fd without blocking; false on EOF or error.
+    bool receive(int fd) {
+        uint8_t chunk[65536];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (n == 0) return false;
+        bytes.insert(bytes.end(), chunk, chunk + n);
+        return true;
+    }
+
+    // Takes the next complete message; error is set for a malformed stream.
+    bool next(Message& message, bool& error) {
+        error = false;
+        if (bytes.size() - consumed < 8) return compact();
+        std::vector<uint8_t> header(bytes.begin() + consumed, bytes.begin() + consumed + 8);
+        PayloadReader reader(header);
+        uint32_t type, length;
+        reader.u32(type);
+        reader.u32(length);
+        if (length > kMaxFarmPayload) {
+            error = true;
+            return false;
+        }
+        if (bytes.size() - consumed < 8 + (size_t)length) return compact();
+        message.type = (FarmMessage)type;
+        message.payload.assign(bytes.begin() + consumed + 8, bytes.begin() + consumed + 8 + length);
+        consumed += 8 + length;
+        return true;
+    }
+
+private:
+    bool compact() {
+        bytes.erase(bytes.begin(), bytes.begin() + consumed);
+        consumed = 0;
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    size_t consumed = 0;
+};
+
+// Blocking read of one message, for the worker.
+inline bool readMessage(int fd, Message& message) {
+    auto readAll = [&](uint8_t* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = recv(fd, data, size, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= (size_t)n;
+        }
+        return true;
+    };
+    std::vector<uint8_t> header(8);
+    if (!readAll(header.data(), header.size())) return false;
+    PayloadReader reader(header);
+    uint32_t type, length;
+    reader.u32(type);
+    reader.u32(length);
+    if (length > kMaxFarmPayload) return false;
+    message.type = (FarmMessage)type;
+    message.payload.resize(length);
+    return readAll(message.payload.data(), length);
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+// Two-stage rendering for the GL programs. The field pass runs the
+// escape-time shader into a float texture (normalized and smooth iteration
+// values per fractal layer); the colour pass maps that texture through a
+// palette lookup table into the frame. The field only depends on the view,
+// so recolouring, palette cycling and blend weight changes re-run just the
+// cheap colour pass.
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <vector>
+
+// Everything a field depends on; equal keys mean the stored field is current.
+struct FieldKey {
+    int width = 0;
+    int height = 0;
+    float zoom = 0.0f;
+    float centerX = 0.0f;
+    float centerY = 0.0f;
+    float juliaX = 0.0f;
+    float juliaY = 0.0f;
+    int maxIter = 0;
+    bool doubleFloat = false;  // Computed by the double-float field shader
+
+    bool operator==(const FieldKey& other) const {
+        return width == other.width && height == other.height && zoom == other.zoom &&
+               centerX == other.centerX && centerY == other.centerY && juliaX == other.juliaX &&
+               juliaY == other.juliaY && maxIter == other.maxIter && doubleFloat == other.doubleFloat;
+    }
+    bool operator!=(const FieldKey& other) const { return !(*this == other); }
+};
+
+// Channel bits for IterationField layers
+constexpr unsigned kFieldR = 1, kFieldG = 2, kFieldB = 4, kFieldA = 8;
+
+// RGBA32F render target holding the iteration field of the current view.
+// Each layer (a fractal the colour pass may read) owns some of the channels
+// and is only recomputed when the view changes or it was skipped before.
+// Optional coarser levels hold every 2nd, 4th... sample of the full field
+// (level l samples the pixels whose coordinates are multiples of 1 << l)
+// for progressive refinement; level 0 is the full field.
+class IterationField {
+public:
+    // layerChannels[i] is the kField* channel mask written by layer i.
+    void create(const std::vector<unsigned>& layerChannels, int levelCount = 1) {
+        channels = layerChannels;
+        levels.resize(levelCount);
+        for (Level& level : levels) {
+            glGenFramebuffers(1, &level.framebuffer);
+            glGenTextures(1, &level.texture);
+        }
+    }
+
+    void destroy() {
+        for (Level& level : levels) {
+            glDeleteFramebuffers(1, &level.framebuffer);
+            glDeleteTextures(1, &level.texture);
+        }
+        levels.clear();
+    }
+
+    int levelCount() const { return (int)levels.size(); }
+
+    // Returns the layers out of wanted (bit i = layer i) that have to be
+    // computed for key; reallocates the textures when the frame size changed.
+    unsigned stale(const FieldKey& key, unsigned wanted) {
+        if (key.width != current.width || key.height != current.height) {
+            GLint previous;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+            for (size_t l = 0; l < levels.size(); l++) {
+                int stride = 1 << l;
+                glBindTexture(GL_TEXTURE_2D, levels[l].texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (key.width + stride - 1) / stride,
+                             (key.height + stride - 1) / stride, 0, GL_RGBA, GL_FLOAT, nullptr);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, levels[l].framebuffer);
+                glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                                       levels[l].texture, 0);
+            }
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
+            invalidate();
+        } else if (key != current) {
+            invalidate();
+        }
+        current = key;
+        return wanted & ~levels[0].validLayers;
+    }
+
+    // Finest level holding all of layers, or -1 if none does yet.
+    int finestLevel(unsigned layers) const {
+        for (size_t l = 0; l < levels.size(); l++)
+            if ((levels[l].validLayers & layers) == layers) return (int)l;
+        return -1;
+    }
+
+    // Redirects drawing into a level of the field, writing only the
+    // channels of layers.
+    void begin(unsigned layers, int level = 0) {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, levels[level].framebuffer);
+        int stride = 1 << level;
+        glViewport(0, 0, (current.width + stride - 1) / stride, (current.height + stride - 1) / stride);
+        unsigned mask = 0;
+        for (size_t i = 0; i < channels.size(); i++)
+            if (layers & (1u << i)) mask |= channels[i];
+        glColorMask(mask & kFieldR ? GL_TRUE : GL_FALSE, mask & kFieldG ? GL_TRUE : GL_FALSE,
+                    mask & kFieldB ? GL_TRUE : GL_FALSE, mask & kFieldA ? GL_TRUE : GL_FALSE);
+        pendingLayers = layers;
+        pendingLevel = level;
+    }
+
+    void end() {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, savedFramebuffer);
+        levels[pendingLevel].validLayers |= pendingLayers;
+        passes++;
+    }
+
+    void bindTexture(GLenum unit, int level = 0) const {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, levels[level].texture);
+    }
+
+    long passCount() const { return passes; }
+
+private:
+    struct Level {
+        GLuint framebuffer = 0;
+        GLuint texture = 0;
+        unsigned validLayers = 0;
+    };
+
+    void invalidate() {
+        for (Level& level : levels) level.validLayers = 0;
+    }
+
+    std::vector<unsigned> channels;
+    std::vector<Level> levels;
+    FieldKey current;
+    unsigned pendingLayers = 0;
+    int pendingLevel = 0;
+    GLint savedFramebuffer = 0;
+    long passes = 0;
+};
+
+// Lookup table for the shaders' four colour palette(t), which runs color1
+// -> color2 -> color3 -> color4 and back to color1 and so wraps around
+// seamlessly; GL_REPEAT lets the colour pass cycle it with an offset.
+// Entry i holds palette(i / kPaletteSize). Sampled at (t * kPaletteSize +
+// 0.5) / kPaletteSize the palette's corners land on texel centres, so
+// linear filtering reproduces the piecewise linear palette exactly.
+constexpr int kPaletteSize = 256;
+
+inline GLuint createPaletteTexture(const float colors[4][3]) {
+    const int size = kPaletteSize;
+    std::vector<float> texels(size * 4);
+    for (int i = 0; i < size; i++) {
+        float t = (float)i / size;
+        int segment = std::min((int)(t * 4.0f), 3);
+        float f = t * 4.0f - segment;
+        const float* from = colors[segment];
+        const float* to = colors[(segment + 1) % 4];
+        for (int c = 0; c < 3; c++) texels[i * 4 + c] = from[c] + (to[c] - from[c]) * f;
+        texels[i * 4 + 3] = 1.0f;
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, 1, 0, GL_RGBA, GL_FLOAT, texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
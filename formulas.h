@@ -0,0 +1,216 @@
+#pragma once
+
+// Escape-time formulas z -> f(z) + c. Every formula is a compile-time
+// specialization: on the CPU a policy struct whose step() is instantiated
+// into each SIMD kernel of escape_time.h, on the GPU a block of #defines
+// that selects the same step in the GLSL field shaders. No inner loop
+// branches on the formula or calls a generic pow(); z^n is unrolled into
+// complex multiplications, with the same operation order on both sides.
+// Julia variants are the same formulas with a fixed c.
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "shader_source.h"
+
+enum class Formula { Quadratic, Multibrot3, Multibrot4, Multibrot5, BurningShip, Tricorn };
+
+inline const char* formulaName(Formula formula) {
+    switch (formula) {
+        case Formula::Multibrot3: return "multibrot3";
+        case Formula::Multibrot4: return "multibrot4";
+        case Formula::Multibrot5: return "multibrot5";
+        case Formula::BurningShip: return "burning-ship";
+        case Formula::Tricorn: return "tricorn";
+        default: return "quadratic";
+    }
+}
+
+inline bool parseFormula(const char* name, Formula& formula) {
+    for (Formula f : {Formula::Quadratic, Formula::Multibrot3, Formula::Multibrot4, Formula::Multibrot5,
+                      Formula::BurningShip, Formula::Tricorn}) {
+        if (std::string(name) == formulaName(f)) {
+            formula = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Degree of the polynomial, for the smooth iteration count.
+inline int formulaDegree(Formula formula) {
+    switch (formula) {
+        case Formula::Multibrot3: return 3;
+        case Formula::Multibrot4: return 4;
+        case Formula::Multibrot5: return 5;
+        default: return 2;
+    }
+}
+
+// v = |v| per lane, for float and for the GCC vector types behind __m128,
+// __m256 and __m512 (a sign bit mask needs no target-specific intrinsic).
+// In place, so no vector is passed by value outside its target.
+inline void laneAbs(float& v) {
+    v = std::fabs(v);
+}
+
+template <typename V>
+inline __attribute__((always_inline)) void laneAbs(V& v) {
+    typedef int Bits __attribute__((vector_size(sizeof(V))));
+    v = (V)((Bits)v & 0x7fffffff);
+}
+
+// The policies below are written once for float and the vector types. They
+// are always inlined, so each instantiation compiles with the target of the
+// kernel it lands in. zx2 = zx * zx and zy2 = zy * zy come from the escape
+// test. kInteriorTest marks the formula whose Mandelbrot set has the main
+// cardioid and period-2 bulb that interiorComponent() tests for.
+
+// z^2 + c
+struct QuadraticFormula {
+    static constexpr bool kInteriorTest = true;
+
+    template <typename V>
+    static inline __attribute__((always_inline)) void step(V& zx, V& zy, const V& zx2, const V& zy2,
+                                                           const V& cx, const V& cy) {
+        zy = 2.0f * zx * zy + cy;
+        zx = zx2 - zy2 + cx;
+    }
+};
+
+// z^N + c, as z^2 times z N - 2 times
+template <int N>
+struct MultibrotFormula {
+    static_assert(N >= 3, "z^2 is QuadraticFormula");
+    static constexpr bool kInteriorTest = false;
+
+    template <typename V>
+    static inline __attribute__((always_inline)) void step(V& zx, V& zy, const V& zx2, const V& zy2,
+                                                           const V& cx, const V& cy) {
+        V wx = zx2 - zy2;
+        V wy = 2.0f * zx * zy;
+        for (int i = 2; i < N; i++) {
+            V nextX = wx * zx - wy * zy;
+            wy = wx * zy + wy * zx;
+            wx = nextX;
+        }
+        zx = wx + cx;
+        zy = wy + cy;
+    }
+};
+
+// (|Re z| + i |Im z|)^2 + c
+struct BurningShipFormula {
+    static constexpr bool kInteriorTest = false;
+
+    template <typename V>
+    static inline __attribute__((always_inline)) void step(V& zx, V& zy, const V& zx2, const V& zy2,
+                                                           const V& cx, const V& cy) {
+        V xy = zx * zy;
+        laneAbs(xy);
+        zy = 2.0f * xy + cy;
+        zx = zx2 - zy2 + cx;
+    }
+};
+
+// conj(z)^2 + c
+struct TricornFormula {
+    static constexpr bool kInteriorTest = false;
+
+    template <typename V>
+    static inline __attribute__((always_inline)) void step(V& zx, V& zy, const V& zx2, const V& zy2,
+                                                           const V& cx, const V& cy) {
+        zy = -2.0f * zx * zy + cy;
+        zx = zx2 - zy2 + cx;
+    }
+};
+
+// Calls fn with a value of the policy for formula. The switch runs once
+// per call, outside of any kernel; fn is instantiated for every policy.
+template <typename Fn>
+inline void withFormula(Formula formula, Fn&& fn) {
+    switch (formula) {
+        case Formula::Multibrot3: fn(MultibrotFormula<3>()); return;
+        case Formula::Multibrot4: fn(MultibrotFormula<4>()); return;
+        case Formula::Multibrot5: fn(MultibrotFormula<5>()); return;
+        case Formula::BurningShip: fn(BurningShipFormula()); return;
+        case Formula::Tricorn: fn(TricornFormula()); return;
+        default: fn(QuadraticFormula()); return;
+    }
+}
+
+// GLSL counterparts of the policies. formulaStep(z) is f(z) without c;
+// dfFormulaStep() is the double-float version for the DOUBLE_FLOAT field
+// shaders and adds c itself, as their loops did.
+inline constexpr const char* kFormulaGlsl = R"(
+    vec2 formulaStep(vec2 z) {
+    #if defined(FORMULA_BURNING_SHIP)
+        return vec2(z.x * z.x - z.y * z.y, 2.0 * abs(z.x * z.y));
+    #elif defined(FORMULA_TRICORN)
+        return vec2(z.x * z.x - z.y * z.y, -2.0 * z.x * z.y);
+    #else
+        vec2 w = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y);
+        for (int i = 2; i < FORMULA_POWER; i++) w = vec2(w.x * z.x - w.y * z.y, w.x * z.y + w.y * z.x);
+        return w;
+    #endif
+    }
+
+    // dz carried through one step, f'(z) dz, for distance estimation. The
+    // burning ship and tricorn steps are not complex differentiable; they
+    // carry |dz| in x, scaled by 2 |z|, exact for the tricorn's conjugate
+    // and the usual approximation for the burning ship.
+    vec2 formulaDerivative(vec2 z, vec2 dz) {
+    #if defined(FORMULA_BURNING_SHIP) || defined(FORMULA_TRICORN)
+        return vec2(2.0 * length(z) * length(dz), 0.0);
+    #else
+        vec2 w = z;
+        for (int i = 2; i < FORMULA_POWER; i++) w = vec2(w.x * z.x - w.y * z.y, w.x * z.y + w.y * z.x);
+        w *= float(FORMULA_POWER);
+        return vec2(w.x * dz.x - w.y * dz.y, w.x * dz.y + w.y * dz.x);
+    #endif
+    }
+
+    // Continuous part of the smooth iteration count for an escaped |z|
+    float formulaSmooth(float radius) {
+        return log2(log(radius)) / FORMULA_LOG2_DEGREE;
+    }
+
+    #ifdef DOUBLE_FLOAT
+    // re2 and im2 are the squares of zRe and zIm from the escape test
+    void dfFormulaStep(inout vec2 zRe, inout vec2 zIm, vec2 re2, vec2 im2, vec2 cRe, vec2 cIm) {
+        vec2 reIm = dfMul(zRe, zIm);
+    #if defined(FORMULA_BURNING_SHIP)
+        if (reIm.x < 0.0) reIm = -reIm;
+    #elif defined(FORMULA_TRICORN)
+        reIm = -reIm;
+    #endif
+        vec2 wRe = dfAdd(re2, -im2);
+        vec2 wIm = 2.0 * reIm;
+    #if !defined(FORMULA_BURNING_SHIP) && !defined(FORMULA_TRICORN)
+        for (int i = 2; i < FORMULA_POWER; i++) {
+            vec2 nextRe = dfAdd(dfMul(wRe, zRe), -dfMul(wIm, zIm));
+            wIm = dfAdd(dfMul(wRe, zIm), dfMul(wIm, zRe));
+            wRe = nextRe;
+        }
+    #endif
+        zRe = dfAdd(wRe, cRe);
+        zIm = dfAdd(wIm, cIm);
+    }
+    #endif
+)";
+
+// fragmentSource specialized to formula: its #defines and the helpers above
+// inserted after the #version line. Apply doubleFloatVariant() to the
+// result, not the other way round, so the double-float helpers come first.
+inline std::string formulaVariant(const char* fragmentSource, Formula formula) {
+    std::string defines;
+    if (formula == Formula::BurningShip) defines += "    #define FORMULA_BURNING_SHIP\n";
+    if (formula == Formula::Tricorn) defines += "    #define FORMULA_TRICORN\n";
+    if (formula == Formula::Quadratic) defines += "    #define FORMULA_INTERIOR_TEST\n";
+    char line[96];
+    std::snprintf(line, sizeof(line), "    #define FORMULA_POWER %d\n    #define FORMULA_LOG2_DEGREE %.9f\n",
+                  formulaDegree(formula), std::log2((double)formulaDegree(formula)));
+    defines += line;
+    return insertAfterVersion(fragmentSource, defines + kFormulaGlsl);
+}
@@ -2,6 +2,17 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <cmath>
+#include <cstdio>
+#include <thread>
+
+#include "explorer_input.h"
+#include "field_pipeline.h"
+#include "frame_profiler.h"
+#include "headless.h"
+#include "iteration_histogram.h"
+#include "program_cache.h"
+#include "scenes.h"
+#include "shortcut_stats.h"
 
 const char* vertexShaderSource = R"(
     #version 330 core
@@ -13,139 +24,197 @@ const char* vertexShaderSource = R"(
     }
 )";
 
-const char* fragmentShaderSource = R"(
+// Field pass: iteration values of both fractals, (mandelbrot, julia,
+// smooth mandelbrot, smooth julia), each normalized by ITER_SCALE; interior
+// points have value 1 and smooth value -1 where a shortcut proved them, -2
+// where they reached the iteration budget
+const char* fieldShaderSource = R"(
     #version 330 core
-    out vec4 FragColor;
-    in vec2 fragCoord;
+    out vec4 FieldValue;
 
     uniform vec2 iResolution;
-    uniform float iTime;
+    uniform float iZoom;
     uniform vec2 iCenter;
-
-    const int MAX_ITER = 256;
-
-    vec3 palette(float t) {
-        vec3 color1 = vec3(0.996, 0.976, 0.882); // #FEF9E1
-        vec3 color2 = vec3(0.898, 0.816, 0.675); // #E5D0AC
-        vec3 color3 = vec3(0.639, 0.114, 0.114); // #A31D1D
-        vec3 color4 = vec3(0.427, 0.137, 0.137); // #6D2323
-
-        if (t < 0.25) return mix(color1, color2, t * 4.0);
-        else if (t < 0.5) return mix(color2, color3, (t - 0.25) * 4.0);
-        else if (t < 0.75) return mix(color3, color4, (t - 0.5) * 4.0);
-        else return mix(color4, color1, (t - 0.75) * 4.0);
-    }
-
-    float mandelbrot(vec2 c) {
-        vec2 z = c;
+    uniform int iLayers;          // Bit 0: Mandelbrot, bit 1: Julia
+    uniform int iMaxIter;         // Iteration budget
+    uniform int iShortcutProbe;   // Non-zero: keep only pixels resolved by this shortcut
+
+    const float ITER_SCALE = 256.0;   // Iterations per unit of field value
+
+    // Early-out that resolved the last mandelbrot()/julia() call:
+    // 0 none, 1 main cardioid, 2 period-2 bulb, 3 periodic orbit
+    int shortcut = 0;
+    // Continuous iteration count of the last call, normalized like its result
+    float smoothIter = 0.0;
+
+    // Iterates z until it escapes, stopping early once the orbit returns to
+    // the value saved at the last power of two step (Brent cycle detection)
+    float escapeTime(vec2 z, vec2 c) {
+        vec2 saved = z;
+        float nextSave = 2.0;
         float iter;
-        for (iter = 0.0; iter < MAX_ITER; iter++) {
-            if (length(z) > 2.0) break;
-            z = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y) + c;
+        for (iter = 0.0; iter < iMaxIter; iter++) {
+            if (dot(z, z) > 4.0) break;
+            z = formulaStep(z) + c;
+            if (z == saved) { shortcut = 3; smoothIter = -1.0; return 1.0; }
+            if (iter + 1.0 == nextSave) { saved = z; nextSave *= 2.0; }
         }
-        return iter / MAX_ITER;
+        shortcut = 0;
+        if (iter == iMaxIter) { smoothIter = -2.0; return 1.0; }
+        smoothIter = clamp((iter + 1.0 - formulaSmooth(length(z))) / ITER_SCALE, 0.0, float(iMaxIter) / ITER_SCALE);
+        return iter / ITER_SCALE;
     }
 
-    float julia(vec2 c, vec2 z) {
-        float iter;
-        for (iter = 0.0; iter < MAX_ITER; iter++) {
-            if (length(z) > 2.0) break;
-            z = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y) + c;
-        }
-        return iter / MAX_ITER;
+    float mandelbrot(vec2 c) {
+    #ifdef FORMULA_INTERIOR_TEST
+        // The main cardioid and the period-2 bulb are interior, skip iterating
+        float xq = c.x - 0.25;
+        float q = xq * xq + c.y * c.y;
+        smoothIter = -1.0;
+        if (q * (q + xq) <= 0.25 * (c.y * c.y)) { shortcut = 1; return 1.0; }
+        if ((c.x + 1.0) * (c.x + 1.0) + c.y * c.y <= 0.0625) { shortcut = 2; return 1.0; }
+    #endif
+        return escapeTime(c, c);
     }
 
-    // Smooth easing function for smooth camera transition
-    float smoothEaseInOut(float t) {
-        return t * t * (3.0 - 2.0 * t);
+    float julia(vec2 c, vec2 z) {
+        return escapeTime(z, c);
     }
 
 void main() {
-    float totalTime = 125.0;  // Total animation time for one zoom cycle
-    float phase = mod(iTime, totalTime) / totalTime;  // Normalize iTime to the [0, 1] range
-
-    // Zoom timing parameters
-    float zoomInDuration = 80.0;  // Zoom-in duration in seconds
-    float zoomOutDuration = 45.0; // Zoom-out duration in seconds
-    float maxZoom = 10;          // Maximum zoom factor
-    float baseZoom = 0.5;         // Base zoom factor
-
-    // Smooth transition of zoom factor over time
-    float zoom;
-    if (phase < (zoomInDuration / totalTime)) {
-        // Zoom-in phase
-        float zoomPhase = smoothEaseInOut(phase / (zoomInDuration / totalTime));
-        zoom = baseZoom + zoomPhase * (maxZoom - baseZoom);
-    } else {
-        // Zoom-out phase
-        float zoomPhase = smoothEaseInOut((phase - zoomInDuration / totalTime) / (zoomOutDuration / totalTime));
-        zoom = maxZoom - zoomPhase * (maxZoom - baseZoom);
+    vec2 c = vec2(-0.8, 0.156);  // Julia constant
+
+    // Fractal coordinates of the pixel centre, exact like the CPU Viewport
+    // mapping; the interpolated fragCoord * iResolution is not
+    vec2 z = (gl_FragCoord.xy - 0.5 * iResolution.xy) / iResolution.y / iZoom + iCenter;
+
+    // Only the layers the host asked for; the others keep their channels
+    vec4 field = vec4(0.0);
+    int mandelbrotShortcut = 0, juliaShortcut = 0;
+    if ((iLayers & 1) != 0) {
+        field.r = mandelbrot(z);
+        field.b = smoothIter;
+        mandelbrotShortcut = shortcut;
+    }
+    if ((iLayers & 2) != 0) {
+        field.g = julia(c, z);
+        field.a = smoothIter;
+        juliaShortcut = shortcut;
     }
+    // Probe 4 counts Julia-layer orbits found periodic
+    int resolvedBy = iShortcutProbe == 4 && juliaShortcut == 3 ? 4 : mandelbrotShortcut;
+    if (iShortcutProbe != 0 && resolvedBy != iShortcutProbe) discard;
 
-    vec2 center = iCenter; // Use uniform for camera position
-    vec2 c = vec2(-0.8, 0.156);  // Julia constant
+    FieldValue = field;
+}
+)";
+
+// Colour pass: blends the two layers and looks the result up in the palette
+const char* colorShaderSource = R"(
+    #version 330 core
+    out vec4 FragColor;
+
+    uniform sampler2D iField;
+    uniform sampler2D iPalette;   // palette(t) as a wrapping 256 entry lookup table
+    uniform float iBlend;         // Julia weight
+    uniform float iPaletteShift;
+    uniform int iSmooth;
 
-    // Calculate fractal coordinates based on zoom
-    vec2 z = (fragCoord * iResolution - 0.5 * iResolution.xy) / iResolution.y / zoom + center;
+    const float ITER_SCALE = 256.0;   // Iterations per unit of field value
 
-    // Compute Mandelbrot and Julia set values
-    float mandelbrotVal = mandelbrot(z);
-    float juliaVal = julia(c, z);
+    // Palette input of one layer; interior points keep 1.0 in either mode
+    float layerValue(float value, float smoothValue) {
+        if (smoothValue < 0.0) return 1.0;
+        if (iSmooth != 0) value = smoothValue;
+        return iEqualizeBudget > 0.0 ? equalize(value * ITER_SCALE) : value;
+    }
+
+void main() {
+    vec4 field = texelFetch(iField, ivec2(gl_FragCoord.xy), 0);
+    vec2 values = vec2(layerValue(field.r, field.b), layerValue(field.g, field.a));
 
     // Blend Mandelbrot and Julia fractals
-    float blendFactor = sin(iTime * 0.2);  // Blending factor
-    float blendedVal = mix(mandelbrotVal, juliaVal, (blendFactor + 1.0) * 0.4);  // Smooth blending
+    float blendedVal = mix(values.x, values.y, iBlend);
 
     // Apply a color palette based on blended fractal value
-    vec3 color = palette(blendedVal);
+    float t = blendedVal + iPaletteShift;
+    vec3 color = texture(iPalette, vec2((t * 256.0 + 0.5) / 256.0, 0.5)).rgb;
 
     FragColor = vec4(color, 1.0);  // Set the final output color
 }
 )";
 
-void checkCompileErrors(GLuint shader, std::string type) {
-    GLint success;
-    GLchar infoLog[1024];
-    if (type != "PROGRAM") {
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-            std::cout << "Shader Compilation Error (" << type << "):\n" << infoLog << std::endl;
-        }
-    } else {
-        glGetProgramiv(shader, GL_LINK_STATUS, &success);
-        if (!success) {
-            glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-            std::cout << "Program Linking Error:\n" << infoLog << std::endl;
-        }
+// Escape iterations of a field texel in one layer, for IterationHistogram;
+// ITER_SCALE comes from fieldIterationsVariant()
+const char* fieldIterationsSource = R"(
+    float fieldIterations(vec4 field, int layer) {
+        float smoothValue = layer == 0 ? field.b : field.a;
+        return smoothValue < 0.0 ? smoothValue : (layer == 0 ? field.r : field.g) * ITER_SCALE;
     }
+)";
+
+// Colour stops of palette(t): #FEF9E1, #E5D0AC, #A31D1D, #6D2323
+const float paletteColors[4][3] = {
+    {0.996f, 0.976f, 0.882f}, {0.898f, 0.816f, 0.675f}, {0.639f, 0.114f, 0.114f}, {0.427f, 0.137f, 0.137f}};
+
+// A layer weighted below half an 8-bit step cannot change the output colour
+const float kInvisibleWeight = 0.5f / 255.0f;
+
+// The explorer's camera pans this many fractal units per second while an
+// arrow key is held (the former 0.01 per frame at 60 Hz)
+const float kPanSpeed = 0.6f;
+
+// Events go to the ExplorerInput behind the window's user pointer, stamped
+// with the time they arrived
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    ExplorerInput* input = (ExplorerInput*)glfwGetWindowUserPointer(window);
+    if (!input || action == GLFW_REPEAT) return;
+    double time = glfwGetTime();
+    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) input->togglePause(time);
+    int pan = key == GLFW_KEY_LEFT ? kPanLeft : key == GLFW_KEY_RIGHT ? kPanRight
+            : key == GLFW_KEY_UP ? kPanUp : key == GLFW_KEY_DOWN ? kPanDown : 0;
+    if (pan) input->key((PanKey)pan, action == GLFW_PRESS, time);
 }
 
-int main() {
-    // Initialize GLFW
-    if (!glfwInit()) {
-        std::cerr << "GLFW initialization failed!" << std::endl;
-        return -1;
-    }
+void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
+    ExplorerInput* input = (ExplorerInput*)glfwGetWindowUserPointer(window);
+    if (input) input->resize(width, height);
+}
 
-    // Set GLFW window hints
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_CORE_PROFILE, GLFW_TRUE);
-
-    // Create GLFW window
-    GLFWwindow* window = glfwCreateWindow(1920, 1080, "Fractal Renderer", nullptr, nullptr);
-    if (!window) {
-        std::cerr << "Failed to create GLFW window!" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
+int main(int argc, char** argv) {
+    RenderOptions options;
+    if (!parseRenderOptions(argc, argv, options)) return -1;
 
-    glfwMakeContextCurrent(window);
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-        std::cerr << "GLEW initialization failed!" << std::endl;
-        return -1;
+    HeadlessContext headless;
+    GLFWwindow* window = nullptr;
+    if (options.headless) {
+        if (!createHeadlessContext(headless)) return -1;
+    } else {
+        // Initialize GLFW
+        if (!glfwInit()) {
+            std::cerr << "GLFW initialization failed!" << std::endl;
+            return -1;
+        }
+
+        // Set GLFW window hints
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_CORE_PROFILE, GLFW_TRUE);
+
+        // Create GLFW window
+        window = glfwCreateWindow(1920, 1080, "Fractal Renderer", nullptr, nullptr);
+        if (!window) {
+            std::cerr << "Failed to create GLFW window!" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+
+        glfwMakeContextCurrent(window);
+        glewExperimental = GL_TRUE;
+        if (glewInit() != GLEW_OK) {
+            std::cerr << "GLEW initialization failed!" << std::endl;
+            return -1;
+        }
     }
 
     GLuint VAO, VBO;
@@ -163,72 +232,211 @@ int main() {
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    // Compile shaders
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-    glCompileShader(vertexShader);
-    checkCompileErrors(vertexShader, "VERTEX");
-
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-    glCompileShader(fragmentShader);
-    checkCompileErrors(fragmentShader, "FRAGMENT");
-
-    // Create shader program
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    checkCompileErrors(shaderProgram, "PROGRAM");
-
-    // Cleanup shaders as they are no longer needed after linking
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    glUseProgram(shaderProgram);
-
-    GLuint iTimeLocation = glGetUniformLocation(shaderProgram, "iTime");
-    GLuint iResolutionLocation = glGetUniformLocation(shaderProgram, "iResolution");
-    GLuint iCenterLocation = glGetUniformLocation(shaderProgram, "iCenter");
+    // Compile shaders, or load them from the binary cache; the field shader
+    // is specialized to --formula
+    ProgramCache programs;
+    programs.create(programCacheDir(options.shaderCache));
+    GLuint fieldProgram = programs.program(vertexShaderSource,
+                                           formulaVariant(fieldShaderSource, options.formula).c_str());
+    GLuint colorProgram = programs.program(vertexShaderSource, equalizeVariant(colorShaderSource).c_str());
+
+    GLint iResolutionLocation = glGetUniformLocation(fieldProgram, "iResolution");
+    GLint iZoomLocation = glGetUniformLocation(fieldProgram, "iZoom");
+    GLint iCenterLocation = glGetUniformLocation(fieldProgram, "iCenter");
+    GLint iLayersLocation = glGetUniformLocation(fieldProgram, "iLayers");
+    GLint iMaxIterLocation = glGetUniformLocation(fieldProgram, "iMaxIter");
+    GLint iBlendLocation = glGetUniformLocation(colorProgram, "iBlend");
+    GLint iPaletteShiftLocation = glGetUniformLocation(colorProgram, "iPaletteShift");
+    GLint iEqualizeBudgetLocation = glGetUniformLocation(colorProgram, "iEqualizeBudget");
+    glUseProgram(colorProgram);
+    glUniform1i(glGetUniformLocation(colorProgram, "iField"), 0);
+    glUniform1i(glGetUniformLocation(colorProgram, "iPalette"), 1);
+    glUniform1i(glGetUniformLocation(colorProgram, "iSmooth"), options.smooth ? 1 : 0);
+    glUniform1i(glGetUniformLocation(colorProgram, "iEqualization"), 3);
+
+    // Escape histograms of the layer with the larger weight steer the budget
+    // of both layers, and the palette equalization they share; ITER_SCALE
+    // of the shaders is the default budget
+    const int iterationScale = 256;
+    IterationBudget budget(options.maxIter, options.adaptiveIter, iterationScale);
+    bool countHistograms = budget.isAdaptive() || options.equalize;
+    IterationHistogram histogram;
+    if (countHistograms)
+        histogram.create(programs, fieldIterationsVariant(fieldIterationsSource, iterationScale).c_str());
+    EqualizationTable equalization;
+    if (options.equalize) equalization.create();
+    EscapeHistogram escapes;
+
+    IterationField field;
+    field.create({kFieldR | kFieldB, kFieldG | kFieldA});
+    GLuint paletteTexture = createPaletteTexture(paletteColors);
 
     float posX = 0.15f; // Initial camera position
     float posY = 0.0f;
-    float moveSpeed = 0.01f;
-    float startTime = glfwGetTime();
 
-    while (!glfwWindowShouldClose(window)) {
-        // Auto-close after 50 seconds
-        if (glfwGetTime() - startTime > 125.0) {
-            glfwSetWindowShouldClose(window, true);
+    ShortcutProbe shortcutProbe;
+    shortcutProbe.create(fieldProgram, {{1, "cardioid"}, {2, "bulb"}, {3, "periodic"}, {4, "julia periodic"}},
+                         options.shortcutStats);
+    long frame = 0;
+    FrameProfiler profiler;
+    if (!profiler.create(options)) return -1;
+    auto drawQuad = [&] { glDrawArrays(GL_TRIANGLES, 0, 6); };
+
+    // Recomputes the layers of the field the blend can see if the view
+    // changed, then colours the frame from it
+    auto drawFrame = [&](float time, double paletteShift, int width, int height) {
+        Scene scene = makeScene(SceneKind::Fractal, time, width, height, posX, posY);
+        FieldKey key;
+        key.width = width;
+        key.height = height;
+        key.zoom = scene.viewport.zoom;
+        key.centerX = posX;
+        key.centerY = posY;
+
+        // The histogram of the last field pass moves the budget
+        if (histogram.take(escapes)) {
+            budget.update(escapes);
+            if (options.equalize) equalization.update(escapes);
+            if (budget.isAdaptive()) profiler.value("capped share", budget.cappedShare());
         }
-
-        // Handle arrow key camera movement
-        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-            posX -= moveSpeed;
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-            posX += moveSpeed;
-        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-            posY += moveSpeed;
-        if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-            posY -= moveSpeed;
-
-        float currentTime = static_cast<float>(glfwGetTime());
-
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        int width, height;
-        glfwGetWindowSize(window, &width, &height);
-        glUniform2f(iResolutionLocation, width, height);
-        glUniform1f(iTimeLocation, currentTime);
-        glUniform2f(iCenterLocation, posX, posY);
+        budget.recordFrame();
+        key.maxIter = budget.iterations();
+        profiler.value("iterations", key.maxIter);
+        unsigned visible = (1.0f - scene.blend >= kInvisibleWeight ? 1u : 0u) |
+                           (scene.blend >= kInvisibleWeight ? 2u : 0u);
 
         glBindVertexArray(VAO);
+        unsigned layers = field.stale(key, visible);
+        if (layers) {
+            profiler.beginCpu("upload");
+            field.begin(layers);
+            glUseProgram(fieldProgram);
+            glUniform2f(iResolutionLocation, (float)width, (float)height);
+            glUniform1f(iZoomLocation, scene.viewport.zoom);
+            glUniform2f(iCenterLocation, posX, posY);
+            glUniform1i(iLayersLocation, (GLint)layers);
+            glUniform1i(iMaxIterLocation, key.maxIter);
+            profiler.endCpu();
+            profiler.beginCpu("draw");
+            profiler.beginGpu("field");
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            profiler.endGpu();
+            profiler.endCpu();
+            field.end();
+
+            int counted = scene.blend < 0.5f ? 0 : 1;
+            if (countHistograms && (layers & (1u << counted))) {
+                field.bindTexture(GL_TEXTURE0);
+                CpuSection section(profiler, "draw");
+                profiler.beginGpu("histogram");
+                histogram.count(width, height, key.maxIter, counted);
+                profiler.endGpu();
+            }
+        }
+
+        profiler.beginCpu("upload");
+        glUseProgram(colorProgram);
+        field.bindTexture(GL_TEXTURE0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, paletteTexture);
+        // A skipped layer's channels hold stale data, give it no weight at all
+        float blend = visible == 1u ? 0.0f : visible == 2u ? 1.0f : scene.blend;
+        glUniform1f(iBlendLocation, blend);
+        glUniform1f(iPaletteShiftLocation, (float)(paletteShift - std::floor(paletteShift)));
+        equalization.bindTexture(GL_TEXTURE3);
+        glUniform1f(iEqualizeBudgetLocation, options.equalize ? (float)equalization.budget() : 0.0f);
+        profiler.endCpu();
+        profiler.beginCpu("draw");
+        profiler.beginGpu("colour");
         glDrawArrays(GL_TRIANGLES, 0, 6);
+        profiler.endGpu();
+        profiler.endCpu();
+        shortcutProbe.update(frame++, width, height, drawQuad);
+    };
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+    if (options.headless) {
+        // One full 125 second zoom cycle at the requested frame rate
+        long cycleFrames = (long)(125.0 * options.fps);
+        int result = runHeadless(options, cycleFrames, [&](float time, int width, int height) {
+            drawFrame(time, time * options.paletteCycle, width, height);
+        }, &profiler);
+        std::cerr << field.passCount() << " field passes for " << frame << " frames" << std::endl;
+        profiler.destroy();
+        budget.report();
+        histogram.destroy();
+        equalization.destroy();
+        programs.destroy();
+        shortcutProbe.destroy();
+        field.destroy();
+        destroyHeadlessContext(headless);
+        return result;
     }
 
+    // The main thread waits for events and hands them to the input state;
+    // a render thread draws whenever that state says the picture changed,
+    // and sleeps otherwise. The window closes after one 125 second zoom
+    // cycle.
+    int windowWidth, windowHeight;
+    glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+    double startTime = glfwGetTime();
+    ExplorerInput input(posX, posY, kPanSpeed, windowWidth, windowHeight, startTime);
+    glfwSetWindowUserPointer(window, &input);
+    glfwSetKeyCallback(window, keyCallback);
+    glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+
+    long framesDrawn = 0;
+    double idleSeconds = 0.0;
+    glfwMakeContextCurrent(nullptr);
+    std::thread renderThread([&] {
+        glfwMakeContextCurrent(window);
+        ExplorerInput::Frame last;
+        int drawnIterations = 0;
+        for (bool first = true;; first = false) {
+            double idle = 0.0;
+            // Space pauses the zoom; the palette keeps cycling on the wall
+            // clock. A paused view is drawn until the adaptive budget and
+            // the equalization settle: each histogram may move them, and a
+            // new budget recomputes the field and counts another.
+            bool fieldChanging = histogram.pending() || budget.iterations() != drawnIterations;
+            ExplorerInput::Frame now =
+                input.next(last, first, options.paletteCycle != 0.0, fieldChanging, glfwGetTime, idle);
+            idleSeconds += idle;
+            if (now.closing) break;
+
+            profiler.beginFrame();
+            glClear(GL_COLOR_BUFFER_BIT);
+            posX = now.cameraX;
+            posY = now.cameraY;
+            drawFrame(now.animationTime, now.time * options.paletteCycle, now.width, now.height);
+            profiler.drawOverlay(now.width, now.height);
+
+            profiler.beginCpu("swap");
+            glfwSwapBuffers(window);
+            profiler.endCpu();
+            profiler.endFrame();
+            framesDrawn++;
+            last = now;
+            drawnIterations = budget.iterations();
+        }
+        glfwMakeContextCurrent(nullptr);
+    });
+
+    for (double now = startTime; !glfwWindowShouldClose(window) && now - startTime < 125.0; now = glfwGetTime())
+        glfwWaitEventsTimeout(startTime + 125.0 - now);
+    input.close();
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+    double seconds = glfwGetTime() - startTime;
+    std::fprintf(stderr, "explorer: %ld frames in %.1f s, render thread idle %.0f%% of the time\n", framesDrawn,
+                 seconds, seconds > 0.0 ? 100.0 * idleSeconds / seconds : 0.0);
+
+    profiler.destroy();
+    budget.report();
+    histogram.destroy();
+    equalization.destroy();
+    programs.destroy();
+    shortcutProbe.destroy();
+    field.destroy();
     glfwTerminate();
     return 0;
 }
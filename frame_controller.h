@@ -0,0 +1,139 @@
+#pragma once
+
+// Frame-time control for the GL programs. The field is refined
+// progressively through the IterationField levels, computing every 8th,
+// 4th, 2nd and finally every pixel of the internal resolution; each pass
+// copies the samples the coarser level already holds instead of iterating
+// them again. Levels are dense textures, so a coarse pass launches only the
+// fragments it needs. A frame runs as many passes as fit its time budget
+// and shows the finest one done, so a dense region costs resolution for a
+// frame instead of stalling it. Between frames the controller moves the
+// internal resolution and the iteration budget so that a complete field
+// fits the target, and the colour pass upscales the field to the window.
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+
+// Field levels of the progressive passes: strides 8, 4, 2 and 1
+constexpr int kProgressiveLevels = 4;
+
+// Samples the pass for level of a width x height field iterates, i.e.
+// those the next coarser level does not hold.
+inline long levelSamples(int width, int height, int level, bool coarserDone) {
+    auto grid = [&](int s) { return (long)((width + s - 1) / s) * ((height + s - 1) / s); };
+    return grid(1 << level) - (coarserDone ? grid(2 << level) : 0);
+}
+
+// Picks the internal resolution and iteration budget from measured field
+// pass times. Cost is modelled per sample at the current budget, for the
+// float and the double-float kernels separately; the budget's effect on it
+// depends on how many pixels reach it, so it is learned from the passes
+// that follow a change rather than predicted.
+class FrameController {
+public:
+    // targetMs 0 disables the controller: full resolution, full budget.
+    FrameController(double targetMs, double minScale, int maxIterations)
+        : target(targetMs), minScale(std::min(std::max(minScale, 0.05), 1.0)), maxIterations(maxIterations),
+          minIterations(std::max(maxIterations / 4, 1)), iterationBudget(maxIterations) {}
+
+    bool enabled() const { return target > 0.0; }
+    double targetMs() const { return target; }
+    float scale() const { return (float)currentScale; }
+    int iterations() const { return iterationBudget; }
+
+    // Internal field size for a window.
+    int fieldWidth(int width) const { return std::max(1, (int)std::lround(width * currentScale)); }
+    int fieldHeight(int height) const { return std::max(1, (int)std::lround(height * currentScale)); }
+
+    // Predicted GPU time of computing samples at the current budget.
+    double estimateMs(long samples) const {
+        const CostModel& model = models[doubleFloat];
+        // Until the double-float kernels have been timed, guess from float
+        if (doubleFloat && !model.measured) return models[0].costPerSample * kDoubleFloatCostGuess * samples;
+        return model.costPerSample * samples;
+    }
+
+    // Moves the full-quality budget, e.g. to follow an IterationBudget.
+    void setMaxIterations(int iterations) {
+        maxIterations = std::max(iterations, 1);
+        minIterations = std::max(maxIterations / 4, 1);
+        if (!enabled() || iterationBudget > maxIterations) iterationBudget = maxIterations;
+    }
+
+    // Selects the cost model of the float or the double-float kernels,
+    // which cost several times as much per sample.
+    void setDoubleFloat(bool on) { doubleFloat = on; }
+
+    // Measured GPU time of a pass over samples at the given budget (timed
+    // through FrameProfiler, so it arrives a few frames late).
+    void record(double ms, long samples, int iterations, bool passDoubleFloat = false) {
+        // Passes timed under an older budget say little about this one
+        if (iterations != iterationBudget) return;
+        CostModel& model = models[passDoubleFloat];
+        model.recordedMs += ms;
+        model.recordedSamples += samples;
+    }
+
+    // Call once per frame: moves the scale and budget towards a complete
+    // field of the given window fitting the target. Cuts are applied at once,
+    // increases in small steps and only with clear headroom, so the settings
+    // do not oscillate (every change restarts the refinement). A view that
+    // holds still goes to full quality, spread over as many frames as the
+    // progressive passes need.
+    void update(int width, int height, bool viewMoving) {
+        // Pooling a frame's passes weights them by size, so the fixed cost of
+        // the small coarse passes (and one-off stalls) do not skew the estimate
+        for (CostModel& model : models) {
+            if (model.recordedSamples == 0) continue;
+            double cost = model.recordedMs / model.recordedSamples;
+            // A new level replaces the estimate quickly, noise averages out
+            model.costPerSample = model.measured ? model.costPerSample * 0.7 + cost * 0.3 : cost;
+            model.measured = true;
+            model.recordedMs = 0.0;
+            model.recordedSamples = 0;
+        }
+        if (!enabled()) return;
+        if (!viewMoving) {
+            currentScale = 1.0;
+            iterationBudget = maxIterations;
+            return;
+        }
+        if (!models[0].measured && !models[doubleFloat].measured) return;
+        double full = estimateMs((long)fieldWidth(width) * fieldHeight(height));
+        if (full > target) {
+            double ratio = target * 0.9 / full;
+            if (currentScale > minScale) {
+                currentScale = std::max(minScale, currentScale * std::sqrt(ratio));
+            } else {
+                iterationBudget = std::max(minIterations, (int)(iterationBudget * ratio));
+            }
+        } else if (full < target * 0.5) {
+            if (iterationBudget < maxIterations) {
+                iterationBudget = std::min(maxIterations, (int)(iterationBudget * 1.25) + 1);
+            } else if (currentScale < 1.0) {
+                currentScale = std::min(1.0, currentScale * 1.1);
+            }
+        }
+    }
+
+private:
+    double target;
+    double minScale;
+    int maxIterations;
+    int minIterations;
+    int iterationBudget;
+    // Double-float over float cost per sample before the former is measured
+    static constexpr double kDoubleFloatCostGuess = 6.0;
+
+    struct CostModel {
+        double costPerSample = 0.0;
+        bool measured = false;
+        double recordedMs = 0.0;
+        long recordedSamples = 0;
+    };
+
+    double currentScale = 1.0;
+    CostModel models[2];      // Float and double-float kernels
+    bool doubleFloat = false;
+};
@@ -0,0 +1,417 @@
+#pragma once
+
+// Frame-time instrumentation for the GL programs. CPU sections are timed
+// with steady_clock; GPU sections with GL_TIME_ELAPSED queries from a ring
+// of frame slots that is only read back when a slot comes round again,
+// kProfileSlots frames later, so timing never stalls the pipeline. Finished
+// frames go to a CSV file (one row per section), a Chrome trace
+// (chrome://tracing, Perfetto) and an optional on-screen graph. Frames can
+// also carry values, such as the iteration budget they were drawn with,
+// which go to the CSV and to the trace as counters.
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+// Frames in flight before a GPU section is read back
+constexpr int kProfileSlots = 4;
+// Frames shown by the overlay graph
+constexpr int kOverlayFrames = 120;
+
+class FrameProfiler {
+public:
+    using GpuResult = std::function<void(double ms)>;
+
+    // Enables whichever outputs options ask for. timeGpu keeps the GPU
+    // sections (and their result callbacks) running without any output.
+    bool create(const RenderOptions& options, bool timeGpu = false) {
+        overlay = options.profileOverlay;
+        enabled = timeGpu || overlay || !options.profileCsv.empty() || !options.profileTrace.empty();
+        epoch = std::chrono::steady_clock::now();
+        if (!options.profileCsv.empty()) {
+            csv = std::fopen(options.profileCsv.c_str(), "w");
+            if (!csv) {
+                std::fprintf(stderr, "Failed to open %s for writing\n", options.profileCsv.c_str());
+                return false;
+            }
+            std::fprintf(csv, "frame,kind,section,start_ms,duration_ms\n");
+        }
+        if (!options.profileTrace.empty()) {
+            trace = std::fopen(options.profileTrace.c_str(), "w");
+            if (!trace) {
+                std::fprintf(stderr, "Failed to open %s for writing\n", options.profileTrace.c_str());
+                return false;
+            }
+            std::fprintf(trace, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+                                "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+                                "\"args\": {\"name\": \"CPU\"}},\n"
+                                "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, "
+                                "\"args\": {\"name\": \"GPU\"}}");
+        }
+        if (overlay) createOverlay();
+        return true;
+    }
+
+    // Completes every outstanding frame (waiting for the GPU), closes the
+    // outputs and prints a summary on stderr.
+    void destroy() {
+        if (!enabled) return;
+        for (int i = 1; i <= kProfileSlots; i++) {
+            Slot& slot = slots[(current + i) % kProfileSlots];
+            if (slot.frame >= 0) resolve(slot, true);
+        }
+        for (Slot& slot : slots)
+            if (!slot.queries.empty()) glDeleteQueries((GLsizei)slot.queries.size(), slot.queries.data());
+        if (overlay) {
+            glDeleteProgram(overlayProgram);
+            glDeleteVertexArrays(1, &overlayVao);
+            glDeleteBuffers(1, &overlayVbo);
+        }
+        if (csv) std::fclose(csv);
+        if (trace) {
+            std::fprintf(trace, "\n]}\n");
+            std::fclose(trace);
+        }
+        if (resolvedFrames > 0 && (csv || trace || overlay)) {
+            std::fprintf(stderr, "profile: %ld frames, %.2f ms CPU and %.2f ms GPU per frame", resolvedFrames,
+                         cpuTotalMs / resolvedFrames, gpuTotalMs / resolvedFrames);
+            if (droppedGpu > 0) std::fprintf(stderr, ", %ld GPU sections not ready in time", droppedGpu);
+            std::fprintf(stderr, "\n");
+        }
+        csv = trace = nullptr;
+        enabled = false;
+    }
+
+    bool active() const { return enabled; }
+
+    void beginFrame() {
+        if (!enabled) return;
+        current = (int)(frameCount % kProfileSlots);
+        Slot& slot = slots[current];
+        // The slot's GPU work was submitted kProfileSlots frames ago
+        if (slot.frame >= 0) resolve(slot, false);
+        slot.frame = frameCount++;
+        slot.startMs = now();
+        slot.cpu.clear();
+        slot.gpu.clear();
+        slot.values.clear();
+        openCpu.clear();
+        gpuOpen = false;
+    }
+
+    void endFrame() {
+        if (!enabled) return;
+        Slot& slot = slots[current];
+        slot.endMs = now();
+    }
+
+    // CPU sections may nest; the overlay stacks the outermost ones.
+    void beginCpu(const char* name) {
+        if (!enabled) return;
+        Slot& slot = slots[current];
+        openCpu.push_back(slot.cpu.size());
+        slot.cpu.push_back({name, now(), 0.0, (int)openCpu.size() - 1});
+    }
+
+    void endCpu() {
+        if (!enabled || openCpu.empty()) return;
+        Sample& sample = slots[current].cpu[openCpu.back()];
+        sample.ms = now() - sample.startMs;
+        openCpu.pop_back();
+    }
+
+    // GPU sections cannot nest (one GL_TIME_ELAPSED query at a time).
+    // onResult receives the section's time once it has been read back.
+    void beginGpu(const char* name, GpuResult onResult = nullptr) {
+        if (!enabled || gpuOpen) return;
+        Slot& slot = slots[current];
+        if (slot.gpu.size() == slot.queries.size()) {
+            slot.queries.push_back(0);
+            glGenQueries(1, &slot.queries.back());
+        }
+        slot.gpu.push_back({name, now(), -1.0, std::move(onResult)});
+        glBeginQuery(GL_TIME_ELAPSED, slot.queries[slot.gpu.size() - 1]);
+        gpuOpen = true;
+    }
+
+    void endGpu() {
+        if (!enabled || !gpuOpen) return;
+        glEndQuery(GL_TIME_ELAPSED);
+        gpuOpen = false;
+    }
+
+    // A named value of the current frame, e.g. a setting chosen for it.
+    void value(const char* name, double v) {
+        if (!enabled) return;
+        slots[current].values.push_back({name, now(), v});
+    }
+
+    // Draws the CPU (bottom) and GPU (top) time graphs of the last frames
+    // into the lower left corner of the bound framebuffer. Each column is a
+    // frame with its sections stacked; the white line marks 16.7 ms.
+    void drawOverlay(int width, int height) {
+        if (!overlay || history.empty()) return;
+        const float column = 2.0f, graphHeight = 80.0f, fullScaleMs = 33.3f, margin = 8.0f;
+        std::vector<float>& v = overlayVertices;
+        v.clear();
+        auto rect = [&](float x0, float y0, float x1, float y1, const float* color) {
+            const float corners[6][2] = {{x0, y0}, {x1, y0}, {x0, y1}, {x0, y1}, {x1, y0}, {x1, y1}};
+            for (const auto& corner : corners) v.insert(v.end(), {corner[0], corner[1], color[0], color[1], color[2]});
+        };
+
+        const float background[3] = {0.05f, 0.05f, 0.05f};
+        const float white[3] = {1.0f, 1.0f, 1.0f};
+        float graphWidth = column * kOverlayFrames;
+        for (int graph = 0; graph < 2; graph++) {
+            float y0 = margin + graph * (graphHeight + margin);
+            rect(margin, y0, margin + graphWidth, y0 + graphHeight, background);
+            size_t first = history.size() > (size_t)kOverlayFrames ? history.size() - kOverlayFrames : 0;
+            for (size_t i = first; i < history.size(); i++) {
+                float x = margin + (i - first) * column;
+                float y = y0;
+                for (const auto& section : graph == 0 ? history[i].cpu : history[i].gpu) {
+                    float h = (float)(section.second / fullScaleMs) * graphHeight;
+                    h = std::min(h, y0 + graphHeight - y);
+                    rect(x, y, x + column, y + h, kSectionColors[section.first % kSectionColorCount]);
+                    y += h;
+                }
+            }
+            float target = y0 + graphHeight * 16.7f / fullScaleMs;
+            rect(margin, target, margin + graphWidth, target + 1.0f, white);
+        }
+
+        GLint previousVao, previousProgram;
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glViewport(0, 0, width, height);
+        glUseProgram(overlayProgram);
+        glUniform2f(overlayResolution, (float)width, (float)height);
+        glBindVertexArray(overlayVao);
+        glBindBuffer(GL_ARRAY_BUFFER, overlayVbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(v.size() * sizeof(float)), v.data(), GL_STREAM_DRAW);
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(v.size() / 5));
+        glBindVertexArray((GLuint)previousVao);
+        glUseProgram((GLuint)previousProgram);
+    }
+
+private:
+    struct Sample {
+        const char* name;
+        double startMs;
+        double ms;
+        int depth;
+    };
+
+    struct GpuSample {
+        const char* name;
+        double issueMs;     // CPU time the section's commands were issued
+        double ms;          // -1 until read back
+        GpuResult onResult;
+    };
+
+    struct Value {
+        const char* name;
+        double startMs;
+        double value;
+    };
+
+    struct Slot {
+        long frame = -1;
+        double startMs = 0.0;
+        double endMs = 0.0;
+        std::vector<Sample> cpu;
+        std::vector<GpuSample> gpu;
+        std::vector<GLuint> queries;
+        std::vector<Value> values;
+    };
+
+    // Per frame (section index, ms) lists for the overlay
+    struct HistoryEntry {
+        std::vector<std::pair<int, double>> cpu;
+        std::vector<std::pair<int, double>> gpu;
+    };
+
+    static constexpr int kSectionColorCount = 6;
+    static constexpr float kSectionColors[kSectionColorCount][3] = {
+        {0.90f, 0.30f, 0.25f}, {0.25f, 0.60f, 0.90f}, {0.95f, 0.75f, 0.20f},
+        {0.40f, 0.80f, 0.35f}, {0.70f, 0.45f, 0.85f}, {0.55f, 0.55f, 0.55f}};
+
+    double now() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Stable colour index per section name, in order of first appearance
+    int sectionIndex(const char* name) {
+        for (size_t i = 0; i < sectionNames.size(); i++)
+            if (std::strcmp(sectionNames[i], name) == 0) return (int)i;
+        sectionNames.push_back(name);
+        return (int)sectionNames.size() - 1;
+    }
+
+    // Reads the slot's GPU sections back (waiting for them only if wait is
+    // set) and emits the finished frame.
+    void resolve(Slot& slot, bool wait) {
+        for (size_t i = 0; i < slot.gpu.size(); i++) {
+            GLint available = 1;
+            if (!wait) glGetQueryObjectiv(slot.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                droppedGpu++;
+                continue;
+            }
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &elapsed);
+            slot.gpu[i].ms = elapsed * 1e-6;
+            if (slot.gpu[i].onResult) slot.gpu[i].onResult(slot.gpu[i].ms);
+        }
+        emit(slot);
+        slot.frame = -1;
+    }
+
+    void emit(const Slot& slot) {
+        double frameMs = slot.endMs - slot.startMs;
+        double gpuMs = 0.0;
+        HistoryEntry entry;
+        for (const Sample& s : slot.cpu)
+            if (s.depth == 0) entry.cpu.push_back({sectionIndex(s.name), s.ms});
+        for (const GpuSample& s : slot.gpu) {
+            if (s.ms < 0.0) continue;
+            gpuMs += s.ms;
+            entry.gpu.push_back({sectionIndex(s.name), s.ms});
+        }
+        resolvedFrames++;
+        cpuTotalMs += frameMs;
+        gpuTotalMs += gpuMs;
+        if (overlay) {
+            history.push_back(std::move(entry));
+            if (history.size() > 2 * (size_t)kOverlayFrames)
+                history.erase(history.begin(), history.end() - kOverlayFrames);
+        }
+
+        if (csv) {
+            std::fprintf(csv, "%ld,cpu,frame,%.4f,%.4f\n", slot.frame, slot.startMs, frameMs);
+            for (const Sample& s : slot.cpu)
+                std::fprintf(csv, "%ld,cpu,%s,%.4f,%.4f\n", slot.frame, s.name, s.startMs, s.ms);
+            for (const GpuSample& s : slot.gpu)
+                if (s.ms >= 0.0) std::fprintf(csv, "%ld,gpu,%s,%.4f,%.4f\n", slot.frame, s.name, s.issueMs, s.ms);
+            // Values fill the duration column
+            for (const Value& v : slot.values)
+                std::fprintf(csv, "%ld,value,%s,%.4f,%g\n", slot.frame, v.name, v.startMs, v.value);
+        }
+        if (trace) {
+            traceEvent("frame", "cpu", 1, slot.startMs, frameMs, slot.frame);
+            for (const Sample& s : slot.cpu) traceEvent(s.name, "cpu", 1, s.startMs, s.ms, slot.frame);
+            // The GPU runs sections in order, no earlier than they were issued
+            for (const GpuSample& s : slot.gpu) {
+                if (s.ms < 0.0) continue;
+                double start = std::max(s.issueMs, gpuCursorMs);
+                traceEvent(s.name, "gpu", 2, start, s.ms, slot.frame);
+                gpuCursorMs = start + s.ms;
+            }
+            for (const Value& v : slot.values) {
+                std::fprintf(trace,
+                             ",\n{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.1f, "
+                             "\"args\": {\"value\": %g}}",
+                             v.name, v.startMs * 1e3, v.value);
+            }
+        }
+    }
+
+    void traceEvent(const char* name, const char* category, int thread, double startMs, double ms, long frame) {
+        std::fprintf(trace,
+                     ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                     "\"ts\": %.1f, \"dur\": %.1f, \"args\": {\"frame\": %ld}}",
+                     name, category, thread, startMs * 1e3, ms * 1e3, frame);
+    }
+
+    void createOverlay() {
+        const char* vertexSource = R"(
+            #version 330 core
+            layout(location = 0) in vec2 aPos;     // Pixels from the lower left corner
+            layout(location = 1) in vec3 aColor;
+            uniform vec2 iResolution;
+            out vec3 color;
+            void main() {
+                color = aColor;
+                gl_Position = vec4(aPos / iResolution * 2.0 - 1.0, 0.0, 1.0);
+            }
+        )";
+        const char* fragmentSource = R"(
+            #version 330 core
+            in vec3 color;
+            out vec4 FragColor;
+            void main() {
+                FragColor = vec4(color, 1.0);
+            }
+        )";
+        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertexShader, 1, &vertexSource, nullptr);
+        glCompileShader(vertexShader);
+        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
+        glCompileShader(fragmentShader);
+        overlayProgram = glCreateProgram();
+        glAttachShader(overlayProgram, vertexShader);
+        glAttachShader(overlayProgram, fragmentShader);
+        glLinkProgram(overlayProgram);
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        overlayResolution = glGetUniformLocation(overlayProgram, "iResolution");
+
+        GLint previousVao;
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+        glGenVertexArrays(1, &overlayVao);
+        glGenBuffers(1, &overlayVbo);
+        glBindVertexArray(overlayVao);
+        glBindBuffer(GL_ARRAY_BUFFER, overlayVbo);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glBindVertexArray((GLuint)previousVao);
+    }
+
+    bool enabled = false;
+    bool overlay = false;
+    std::chrono::steady_clock::time_point epoch;
+    FILE* csv = nullptr;
+    FILE* trace = nullptr;
+
+    Slot slots[kProfileSlots];
+    int current = 0;
+    long frameCount = 0;
+    std::vector<size_t> openCpu;
+    bool gpuOpen = false;
+
+    std::vector<const char*> sectionNames;
+    std::vector<HistoryEntry> history;
+    std::vector<float> overlayVertices;
+    GLuint overlayProgram = 0;
+    GLuint overlayVao = 0;
+    GLuint overlayVbo = 0;
+    GLint overlayResolution = -1;
+
+    long resolvedFrames = 0;
+    long droppedGpu = 0;
+    double cpuTotalMs = 0.0;
+    double gpuTotalMs = 0.0;
+    double gpuCursorMs = 0.0;
+};
+
+// Times the enclosing scope as a CPU section.
+class CpuSection {
+public:
+    CpuSection(FrameProfiler& profiler, const char* name) : profiler(profiler) { profiler.beginCpu(name); }
+    ~CpuSection() { profiler.endCpu(); }
+    CpuSection(const CpuSection&) = delete;
+    CpuSection& operator=(const CpuSection&) = delete;
+
+private:
+    FrameProfiler& profiler;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+// Offscreen rendering for display-less render nodes: an EGL surfaceless
+// context (Mesa llvmpipe works on CPU-only machines), a framebuffer object
+// as render target and a ring of pixel buffer objects so that the readback
+// of frame N overlaps with rendering frame N+1.
+
+#include <GL/glew.h>
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "frame_profiler.h"
+#include "options.h"
+#include "video_export.h"
+
+struct HeadlessContext {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+};
+
+inline bool createHeadlessContext(HeadlessContext& ctx) {
+    // Prefer the surfaceless platform so no X server or DRM device is needed
+    auto getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        ctx.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (ctx.display == EGL_NO_DISPLAY)
+        ctx.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, &major, &minor)) {
+        std::cerr << "Failed to initialize EGL display" << std::endl;
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint numConfigs = 0;
+    eglChooseConfig(ctx.display, configAttribs, &config, 1, &numConfigs);
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "EGL does not support desktop OpenGL" << std::endl;
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    // A config is optional with EGL_KHR_no_config_context, which surfaceless Mesa exposes
+    ctx.context = eglCreateContext(ctx.display, numConfigs > 0 ? config : EGL_NO_CONFIG_KHR,
+                                   EGL_NO_CONTEXT, contextAttribs);
+    if (ctx.context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx.context)) {
+        std::cerr << "Failed to create EGL OpenGL 3.3 core context" << std::endl;
+        return false;
+    }
+
+    // glewInit() also probes GLX, which fails without an X display
+    glewExperimental = GL_TRUE;
+    if (glewContextInit() != GLEW_OK) {
+        std::cerr << "GLEW initialization failed!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline void destroyHeadlessContext(HeadlessContext& ctx) {
+    if (ctx.display == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (ctx.context != EGL_NO_CONTEXT) eglDestroyContext(ctx.display, ctx.context);
+    eglTerminate(ctx.display);
+    ctx = HeadlessContext();
+}
+
+// Deterministic replacement for glfwGetTime(): iTime advances by exactly
+// 1/fps per rendered frame, independent of how long a frame takes.
+struct FrameClock {
+    double startTime = 0.0;
+    double fps = 60.0;
+    long frame = 0;
+
+    double time() const { return startTime + frame / fps; }
+    void advance() { frame++; }
+};
+
+// Framebuffer object with a single RGBA8 colour attachment.
+struct OffscreenTarget {
+    GLuint fbo = 0;
+    GLuint colorBuffer = 0;
+    int width = 0;
+    int height = 0;
+
+    bool create(int w, int h) {
+        width = w;
+        height = h;
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+            return false;
+        }
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    void destroy() {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        fbo = colorBuffer = 0;
+    }
+};
+
+// Ring of pixel pack buffers. queue() starts an asynchronous glReadPixels of
+// the current framebuffer; a frame is only mapped once the ring wraps around
+// to it (or on flush), by which time its fence has normally been signalled
+// and mapping does not stall the GPU.
+class PboReadback {
+public:
+    using FrameCallback = std::function<bool(long frame, const unsigned char* rgba)>;
+
+    void create(int w, int h, int ringSize) {
+        width = w;
+        height = h;
+        slots.resize(ringSize);
+        for (Slot& slot : slots) {
+            glGenBuffers(1, &slot.pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    void destroy() {
+        for (Slot& slot : slots) {
+            if (slot.fence) glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        slots.clear();
+    }
+
+    // Queues frame for readback; completes the oldest frame first if its slot is needed.
+    bool queue(long frame, const FrameCallback& onFrame) {
+        Slot& slot = slots[next];
+        if (slot.frame >= 0 && !complete(slot, onFrame)) return false;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = frame;
+        next = (next + 1) % slots.size();
+        return true;
+    }
+
+    // Completes every outstanding frame in submission order.
+    bool flush(const FrameCallback& onFrame) {
+        for (size_t i = 0; i < slots.size(); i++) {
+            Slot& slot = slots[(next + i) % slots.size()];
+            if (slot.frame >= 0 && !complete(slot, onFrame)) return false;
+        }
+        return true;
+    }
+
+private:
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        long frame = -1;
+    };
+
+    bool complete(Slot& slot, const FrameCallback& onFrame) {
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        auto* pixels = (const unsigned char*)glMapBufferRange(
+            GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * 4, GL_MAP_READ_BIT);
+        bool ok = pixels && onFrame(slot.frame, pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.frame = -1;
+        return ok;
+    }
+
+    std::vector<Slot> slots;
+    size_t next = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Writes one bottom-up RGBA frame as top-down RGB, either as a PPM file named
+// from the printf pattern or as raw RGB24 appended to stdout.
+inline bool writeFrame(const std::string& pattern, long frame, int width, int height,
+                       const unsigned char* rgba) {
+    bool toStdout = pattern == "-";
+    FILE* file = stdout;
+    if (!toStdout) {
+        char path[4096];
+        std::snprintf(path, sizeof(path), pattern.c_str(), frame);
+        file = std::fopen(path, "wb");
+        if (!file) {
+            std::cerr << "Failed to open " << path << " for writing" << std::endl;
+            return false;
+        }
+        std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    }
+
+    std::vector<unsigned char> row(width * 3);
+    bool ok = true;
+    for (int y = height - 1; y >= 0 && ok; y--) {
+        const unsigned char* src = rgba + (size_t)y * width * 4;
+        for (int x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        ok = std::fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+
+    if (toStdout) std::fflush(stdout);
+    else std::fclose(file);
+    if (!ok) std::cerr << "Failed to write frame " << frame << std::endl;
+    return ok;
+}
+
+// Renders options.frames frames (or defaultFrames) into an offscreen target,
+// driving iTime from a FrameClock. drawFrame issues the draw for one frame.
+// A profiler gets the frames' boundaries, the readback and its overlay.
+inline int runHeadless(const RenderOptions& options, long defaultFrames,
+                       const std::function<void(float time, int width, int height)>& drawFrame,
+                       FrameProfiler* profiler = nullptr) {
+    FrameProfiler disabled;
+    FrameProfiler& profile = profiler ? *profiler : disabled;
+    OffscreenTarget target;
+    if (!target.create(options.width, options.height)) return -1;
+
+    PboReadback readback;
+    readback.create(options.width, options.height, options.pboRing);
+
+    // Video frames are handed to a writer thread while the buffer is mapped
+    VideoWriter video;
+    if (!options.video.empty() &&
+        !video.open(options.video, options.width, options.height, options.fps, options.videoQueue)) {
+        readback.destroy();
+        target.destroy();
+        return -1;
+    }
+
+    auto onFrame = [&](long frame, const unsigned char* rgba) {
+        if (!options.video.empty() && !video.submit(rgba)) return false;
+        if (options.output.empty()) return true;
+        return writeFrame(options.output, frame, options.width, options.height, rgba);
+    };
+
+    FrameClock clock;
+    clock.startTime = options.startTime;
+    clock.fps = options.fps;
+    long frames = options.frames > 0 ? options.frames : defaultFrames;
+
+    int result = 0;
+    for (; clock.frame < frames; clock.advance()) {
+        profile.beginFrame();
+        glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+        glClear(GL_COLOR_BUFFER_BIT);
+        drawFrame((float)clock.time(), target.width, target.height);
+        profile.drawOverlay(target.width, target.height);
+        profile.beginCpu("readback");
+        bool queued = readback.queue(clock.frame, onFrame);
+        profile.endCpu();
+        profile.endFrame();
+        if (!queued) {
+            result = -1;
+            break;
+        }
+    }
+    if (result == 0 && !readback.flush(onFrame)) result = -1;
+    if (!video.close()) result = -1;
+
+    readback.destroy();
+    target.destroy();
+    return result;
+}
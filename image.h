@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Top-down RGB24 image as produced by the CPU renderers.
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> rgb;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        rgb.assign((size_t)w * h * 3, 0);
+    }
+    uint8_t* pixel(int x, int y) { return rgb.data() + ((size_t)y * width + x) * 3; }
+};
+
+inline bool writePpm(const std::string& path, const Image& image) {
+    FILE* file = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+    std::fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    bool ok = std::fwrite(image.rgb.data(), 1, image.rgb.size(), file) == image.rgb.size();
+    if (file == stdout) std::fflush(stdout);
+    else std::fclose(file);
+    if (!ok) std::cerr << "Failed to write " << path << std::endl;
+    return ok;
+}
+
+inline bool readPpm(const std::string& path, Image& image) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    int w = 0, h = 0, maxValue = 0;
+    bool ok = std::fscanf(file, "P6 %d %d %d", &w, &h, &maxValue) == 3 && maxValue == 255 &&
+              std::fgetc(file) != EOF;
+    if (ok) {
+        image.resize(w, h);
+        ok = std::fread(image.rgb.data(), 1, image.rgb.size(), file) == image.rgb.size();
+    }
+    std::fclose(file);
+    if (!ok) std::cerr << path << " is not a binary 8-bit PPM" << std::endl;
+    return ok;
+}
+
+// Expands a printf pattern such as "out/frame_%05d.ppm" for one frame.
+inline std::string framePath(const std::string& pattern, long frame) {
+    char path[4096];
+    std::snprintf(path, sizeof(path), pattern.c_str(), frame);
+    return path;
+}
+
+// Encodes image as a PNG with stored (uncompressed) deflate blocks, which
+// every decoder accepts and which costs no more than a copy to produce.
+inline void encodePng(const Image& image, std::vector<uint8_t>& out) {
+    static uint32_t crcTable[256];
+    static bool tableReady = [] {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+        return true;
+    }();
+    (void)tableReady;
+
+    out.clear();
+    auto put32 = [&](uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t)(v >> shift));
+    };
+    auto chunk = [&](const char* type, const std::vector<uint8_t>& data) {
+        put32((uint32_t)data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = start; i < out.size(); i++) crc = crcTable[(crc ^ out[i]) & 0xFF] ^ (crc >> 8);
+        put32(crc ^ 0xFFFFFFFFu);
+    };
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.insert(out.end(), signature, signature + 8);
+
+    std::vector<uint8_t> header;
+    for (uint32_t v : {(uint32_t)image.width, (uint32_t)image.height})
+        for (int shift = 24; shift >= 0; shift -= 8) header.push_back((uint8_t)(v >> shift));
+    header.insert(header.end(), {8, 2, 0, 0, 0});   // 8-bit RGB, no interlace
+    chunk("IHDR", header);
+
+    // Scanlines with filter type 0, in a zlib stream of stored blocks
+    std::vector<uint8_t> raw;
+    size_t rowBytes = (size_t)image.width * 3;
+    raw.reserve((rowBytes + 1) * image.height);
+    for (int y = 0; y < image.height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), image.rgb.begin() + y * rowBytes, image.rgb.begin() + (y + 1) * rowBytes);
+    }
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535) {
+        size_t length = std::min<size_t>(65535, raw.size() - offset);
+        bool last = offset + length >= raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.insert(zlib.end(),
+                    {(uint8_t)length, (uint8_t)(length >> 8), (uint8_t)~length, (uint8_t)(~length >> 8)});
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+        if (last) break;
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    for (int shift = 24; shift >= 0; shift -= 8) zlib.push_back((uint8_t)(((b << 16) | a) >> shift));
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+// Escape-iteration histograms of the field, and the iteration budget they
+// steer. After a field pass, a sampled grid of its texels is scattered as
+// points into a one-row R32F target with additive blending, one pixel per
+// bin: kHistogramBins bins over the escape iterations [0, budget), then one
+// for samples that reached the budget and one for interior points a
+// shortcut proved. The row is read back through a pixel buffer on the next
+// histogram, so the histogram never stalls the pipeline. It feeds
+// IterationBudget, which raises the budget when boundary pixels still
+// escape just below it and lowers it when the top of the budget is unused,
+// and the CDF of the escaped bins gives histogram-equalized colouring.
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "program_cache.h"
+#include "shader_source.h"
+
+constexpr int kHistogramBins = 256;
+// Field texels a histogram samples, at most
+constexpr long kHistogramSamples = 1 << 16;
+// Bounds of an adaptive budget when --max-iter does not set the ceiling
+constexpr int kAdaptiveIterationCeiling = 4096;
+constexpr int kMinimumIterationBudget = 32;
+
+// Counts of one histogram; escaped[i] covers the iterations
+// [i, i + 1) * budget / kHistogramBins.
+struct EscapeHistogram {
+    std::vector<double> escaped = std::vector<double>(kHistogramBins, 0.0);
+    double capped = 0.0;      // Reached the budget
+    double interior = 0.0;    // Proven interior by a shortcut
+    int budget = 0;
+
+    double samples() const {
+        double total = capped + interior;
+        for (double count : escaped) total += count;
+        return total;
+    }
+
+    // Escaped samples in the bins [first, kHistogramBins)
+    double escapedFrom(int first) const {
+        double total = 0.0;
+        for (int i = first; i < kHistogramBins; i++) total += escaped[i];
+        return total;
+    }
+};
+
+// fieldIterationsGlsl preceded by ITER_SCALE, the iterations per unit of
+// field value the field shader stores, so the snippet can scale field
+// values back to iterations without its own copy of the constant.
+inline std::string fieldIterationsVariant(const char* fieldIterationsGlsl, int iterationScale) {
+    return "    const float ITER_SCALE = " + std::to_string(iterationScale) + ".0;\n" + fieldIterationsGlsl;
+}
+
+// The histogram pass. fieldIterationsGlsl defines, for the field shader's
+// encoding, float fieldIterations(vec4 field, int layer): the escape
+// iterations of a field texel, -1 for proven interior and -2 for a sample
+// that reached the budget.
+class IterationHistogram {
+public:
+    void create(ProgramCache& programs, const char* fieldIterationsGlsl) {
+        std::string vertexSource = std::string(R"(
+            #version 330 core
+            uniform sampler2D iHistogramField;
+            uniform int iHistogramStep;      // Field texels between samples
+            uniform int iHistogramColumns;   // Samples per row
+            uniform float iHistogramBudget;  // Iterations spanned by the escaped bins
+            uniform int iHistogramLayer;     // Field layer to count
+            const int BINS = )") + std::to_string(kHistogramBins) + R"(;
+
+            float fieldIterations(vec4 field, int layer);
+
+            void main() {
+                ivec2 texel = ivec2(gl_VertexID % iHistogramColumns, gl_VertexID / iHistogramColumns) * iHistogramStep;
+                float iterations = fieldIterations(texelFetch(iHistogramField, texel, 0), iHistogramLayer);
+                int bin = iterations == -1.0 ? BINS + 1 : iterations == -2.0 ? BINS
+                        : clamp(int(iterations / iHistogramBudget * float(BINS)), 0, BINS - 1);
+                gl_Position = vec4((float(bin) + 0.5) / float(BINS + 2) * 2.0 - 1.0, 0.0, 0.0, 1.0);
+            }
+        )" + fieldIterationsGlsl;
+        const char* fragmentSource = R"(
+            #version 330 core
+            out vec4 Count;
+            void main() {
+                Count = vec4(1.0);
+            }
+        )";
+        program = programs.program(vertexSource.c_str(), fragmentSource);
+        stepLocation = glGetUniformLocation(program, "iHistogramStep");
+        columnsLocation = glGetUniformLocation(program, "iHistogramColumns");
+        budgetLocation = glGetUniformLocation(program, "iHistogramBudget");
+        layerLocation = glGetUniformLocation(program, "iHistogramLayer");
+        GLint previousProgram;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "iHistogramField"), 0);
+        glUseProgram((GLuint)previousProgram);
+
+        glGenVertexArrays(1, &vao);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, kHistogramBins + 2, 1, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GLint previous;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+        glGenBuffers(1, &pixelBuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (kHistogramBins + 2) * sizeof(float), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    void destroy() {
+        glDeleteProgram(program);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteTextures(1, &texture);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteBuffers(1, &pixelBuffer);
+    }
+
+    // Counts the field texture bound to unit 0, width x height texels
+    // computed at budget iterations.
+    void count(int width, int height, int budget, int layer = 0) {
+        int step = std::max(1, (int)std::ceil(std::sqrt((double)width * height / kHistogramSamples)));
+        int columns = (width + step - 1) / step;
+        int rows = (height + step - 1) / step;
+
+        GLint previousFramebuffer, previousVao, previousProgram, viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVao);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, kHistogramBins + 2, 1);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glUseProgram(program);
+        glUniform1i(stepLocation, step);
+        glUniform1i(columnsLocation, columns);
+        glUniform1f(budgetLocation, (float)budget);
+        glUniform1i(layerLocation, layer);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        // Points read no attributes, but core profile draws need a VAO
+        glBindVertexArray(vao);
+        glDrawArrays(GL_POINTS, 0, columns * rows);
+        glBindVertexArray((GLuint)previousVao);
+        glUseProgram((GLuint)previousProgram);
+        glDisable(GL_BLEND);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+        glReadPixels(0, 0, kHistogramBins + 2, 1, GL_RED, GL_FLOAT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        pendingBudget = budget;
+    }
+
+    // Whether a histogram was counted and not taken yet
+    bool pending() const { return pendingBudget != 0; }
+
+    // The last histogram counted, if there is one not taken yet. Reading it
+    // back waits for its pass, which was issued a frame or more ago.
+    bool take(EscapeHistogram& histogram) {
+        if (pendingBudget == 0) return false;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+        const float* counts = (const float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (counts) {
+            for (int i = 0; i < kHistogramBins; i++) histogram.escaped[i] = counts[i];
+            histogram.capped = counts[kHistogramBins];
+            histogram.interior = counts[kHistogramBins + 1];
+            histogram.budget = pendingBudget;
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        pendingBudget = 0;
+        return counts != nullptr;
+    }
+
+private:
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLint stepLocation = -1, columnsLocation = -1, budgetLocation = -1, layerLocation = -1;
+    GLuint texture = 0;
+    GLuint framebuffer = 0;
+    GLuint pixelBuffer = 0;
+    int pendingBudget = 0;
+};
+
+// Histogram equalization for the colour passes: equalize(iterations) is the
+// share of the escaped samples that escaped sooner, so every palette band
+// covers about as many pixels. It needs the colour shader to sample the
+// table on a texture unit of its choosing through iEqualization.
+inline constexpr const char* kEqualizeGlsl = R"(
+    uniform sampler2D iEqualization;  // Share of escaped samples below each bin edge
+    uniform float iEqualizeBudget;    // Iterations the table spans, 0 = no equalization
+
+    float equalize(float iterations) {
+        float bins = float(textureSize(iEqualization, 0).x - 1);
+        float u = clamp(iterations / iEqualizeBudget, 0.0, 1.0);
+        return texture(iEqualization, vec2((u * bins + 0.5) / (bins + 1.0), 0.5)).r;
+    }
+)";
+
+// colorSource with equalize() available.
+inline std::string equalizeVariant(const char* colorSource) {
+    return insertAfterVersion(colorSource, kEqualizeGlsl);
+}
+
+// The lookup table behind equalize(): kHistogramBins + 1 bin edges,
+// interpolated linearly in between.
+class EqualizationTable {
+public:
+    void create() {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // Until the first histogram, the identity
+        std::vector<float> identity(kHistogramBins + 1);
+        for (int i = 0; i <= kHistogramBins; i++) identity[i] = (float)i / kHistogramBins;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, kHistogramBins + 1, 1, 0, GL_RED, GL_FLOAT, identity.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    void destroy() { glDeleteTextures(1, &texture); }
+
+    // Replaces the table with the CDF of the escaped bins of histogram.
+    void update(const EscapeHistogram& histogram) {
+        double total = histogram.escapedFrom(0);
+        if (total <= 0.0) return;
+        std::vector<float> cdf(kHistogramBins + 1);
+        double below = 0.0;
+        for (int i = 0; i <= kHistogramBins; i++) {
+            cdf[i] = (float)(below / total);
+            if (i < kHistogramBins) below += histogram.escaped[i];
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, kHistogramBins + 1, 1, GL_RED, GL_FLOAT, cdf.data());
+        spanned = histogram.budget;
+    }
+
+    // Iterations the table spans, 0 before the first histogram.
+    int budget() const { return spanned; }
+
+    void bindTexture(GLenum unit) const {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+private:
+    GLuint texture = 0;
+    int spanned = 0;
+};
+
+// The iteration budget of the field shaders. Fixed unless adaptive; then
+// each histogram moves it between minimum and maximum: up by half when
+// more than kCappedShare of the non-interior samples reached the budget
+// while more than kTailShare still escaped in its top quarter (so raising
+// it would resolve boundary detail that is now flat interior colour), and
+// down by a fifth when less than kUnusedShare escaped in its top half (the
+// iterations there only cost time on interior points). The top half and
+// the top quarter leave room between the two, so the budget settles.
+class IterationBudget {
+public:
+    // From --max-iter (0 if not given) and --adaptive-iter, for a program
+    // whose own budget is defaultIterations. An adaptive budget starts there.
+    IterationBudget(int maxIter, bool adaptive, int defaultIterations)
+        : maximum(maxIter > 0 ? maxIter : adaptive ? kAdaptiveIterationCeiling : defaultIterations),
+          adaptive(adaptive) {
+        budget = adaptive ? std::min(defaultIterations, maximum) : maximum;
+        minimum = std::min(kMinimumIterationBudget, budget);
+    }
+
+    int iterations() const { return budget; }
+    bool isAdaptive() const { return adaptive; }
+
+    // Share of the non-interior samples of the last histogram that reached
+    // the budget, for the metrics.
+    double cappedShare() const { return lastCappedShare; }
+
+    void update(const EscapeHistogram& histogram) {
+        double considered = histogram.samples() - histogram.interior;
+        // A histogram of an older budget says nothing about this one
+        if (!adaptive || histogram.budget != budget || considered <= 0.0) return;
+        lastCappedShare = histogram.capped / considered;
+        double tail = histogram.escapedFrom(kHistogramBins * 3 / 4) / considered;
+        double upperHalf = histogram.escapedFrom(kHistogramBins / 2) / considered;
+        int next = budget;
+        if (lastCappedShare > kCappedShare && tail > kTailShare) {
+            next = std::min(maximum, budget + budget / 2);
+        } else if (upperHalf < kUnusedShare) {
+            next = std::max(minimum, budget - budget / 5);
+        }
+        if (next != budget) changes++;
+        budget = next;
+    }
+
+    // Call once per frame, for the summary.
+    void recordFrame() {
+        frames++;
+        sum += budget;
+        lowest = frames == 1 ? budget : std::min(lowest, budget);
+        highest = std::max(highest, budget);
+    }
+
+    void report() const {
+        if (!adaptive || frames == 0) return;
+        std::fprintf(stderr, "iteration budget: mean %.0f, range %d-%d, %ld changes\n", sum / frames, lowest,
+                     highest, changes);
+    }
+
+private:
+    static constexpr double kCappedShare = 0.001;
+    static constexpr double kTailShare = 0.0005;
+    static constexpr double kUnusedShare = 0.0002;
+
+    int maximum;
+    bool adaptive;
+    int budget;
+    int minimum;
+    double lastCappedShare = 0.0;
+    long changes = 0;
+    long frames = 0;
+    double sum = 0.0;
+    int lowest = 0;
+    int highest = 0;
+};
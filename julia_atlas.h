@@ -0,0 +1,244 @@
+#pragma once
+
+// Julia parameter-space atlas: a grid of small Julia sets, one per constant
+// c of a rectangle of the c-plane, computed by a single instanced draw of
+// the julia field shader (one instance per cell), so a parameter sweep is
+// one frame instead of one run per constant. Cells are numbered row by row
+// from the top left of the image, and the grid is laid out like the plane
+// (imaginary axis up), so the atlas of the default rectangle traces the
+// Mandelbrot set. Per-cell statistics come from the same field: a pass
+// turns every texel into (escaped, escape iterations, proven interior,
+// capped), and as cells are a power of two wide, glGenerateMipmap averages
+// those down to one texel per cell.
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "options.h"
+#include "program_cache.h"
+#include "shader_source.h"
+
+// z of a cell spans [-1 / (2 * zoom), 1 / (2 * zoom)] on each axis: the
+// disc |z| <= 2 that holds every Julia set
+constexpr float kAtlasZoom = 0.25f;
+
+// The grid and the c rectangle it covers.
+struct AtlasLayout {
+    int columns = 0;
+    int rows = 0;
+    int cellSize = 64;
+    double minX = -2.0, minY = -1.25, maxX = 0.5, maxY = 1.25;
+
+    int width() const { return columns * cellSize; }
+    int height() const { return rows * cellSize; }
+    int cells() const { return columns * rows; }
+
+    // c at the centre of a cell
+    double cX(int column) const { return minX + (column + 0.5) / columns * (maxX - minX); }
+    double cY(int row) const { return maxY - (row + 0.5) / rows * (maxY - minY); }
+};
+
+// Averages over the pixels of one cell.
+struct AtlasCell {
+    float escaped = 0.0f;          // Share of pixels that escaped
+    float meanIterations = 0.0f;   // Mean escape iterations of those
+    float interior = 0.0f;         // Share proven interior by a shortcut
+    float capped = 0.0f;           // Share that reached the budget
+};
+
+// The field program, built from the julia field shader, which takes its
+// constant from atlasC under JULIA_ATLAS; the field main() maps fragCoord
+// over a cell of iResolution pixels. fieldIterationsGlsl is the shader's
+// fieldIterations() (see IterationHistogram) for the statistics.
+class JuliaAtlas {
+public:
+    bool create(ProgramCache& programs, const char* fieldSource, const char* fieldIterationsGlsl,
+                const RenderOptions& options) {
+        layout.columns = options.atlasColumns;
+        layout.rows = options.atlasRows;
+        layout.cellSize = options.atlasCell;
+        layout.minX = options.atlasRange[0];
+        layout.minY = options.atlasRange[1];
+        layout.maxX = options.atlasRange[2];
+        layout.maxY = options.atlasRange[3];
+        GLint maxTexture = 0, maxRenderbuffer = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+        glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbuffer);
+        int limit = std::min(maxTexture, maxRenderbuffer);
+        if (layout.width() > limit || layout.height() > limit) {
+            std::cerr << "Atlas of " << layout.width() << "x" << layout.height() << " exceeds the GL limit of "
+                      << limit << " pixels per side" << std::endl;
+            return false;
+        }
+
+        const char* vertexSource = R"(
+            #version 330 core
+            layout(location = 0) in vec2 aPos;
+            uniform ivec2 iAtlasGrid;     // Columns, rows
+            uniform vec4 iAtlasRange;     // c rectangle: min x, min y, max x, max y
+            out vec2 fragCoord;           // Position in the cell, [0, 1]^2
+            flat out vec2 atlasC;
+
+            void main() {
+                // Row 0 is the top of the image and of the rectangle
+                ivec2 cell = ivec2(gl_InstanceID % iAtlasGrid.x, gl_InstanceID / iAtlasGrid.x);
+                vec2 t = (vec2(cell) + 0.5) / vec2(iAtlasGrid);
+                atlasC = vec2(mix(iAtlasRange.x, iAtlasRange.z, t.x), mix(iAtlasRange.w, iAtlasRange.y, t.y));
+                fragCoord = aPos * 0.5 + 0.5;
+                vec2 corner = vec2(cell.x, iAtlasGrid.y - 1 - cell.y);
+                gl_Position = vec4((corner + fragCoord) / vec2(iAtlasGrid) * 2.0 - 1.0, 0.0, 1.0);
+            }
+        )";
+        std::string source = insertAfterVersion(fieldSource, "    #define JULIA_ATLAS\n");
+        fieldProgram = programs.program(vertexSource, source.c_str());
+        resolutionLocation = glGetUniformLocation(fieldProgram, "iResolution");
+        zoomLocation = glGetUniformLocation(fieldProgram, "iZoom");
+        maxIterLocation = glGetUniformLocation(fieldProgram, "iMaxIter");
+        glUseProgram(fieldProgram);
+        glUniform2i(glGetUniformLocation(fieldProgram, "iAtlasGrid"), layout.columns, layout.rows);
+        glUniform4f(glGetUniformLocation(fieldProgram, "iAtlasRange"), (float)layout.minX, (float)layout.minY,
+                    (float)layout.maxX, (float)layout.maxY);
+
+        const char* statsVertexSource = R"(
+            #version 330 core
+            layout(location = 0) in vec2 aPos;
+            void main() {
+                gl_Position = vec4(aPos, 0.0, 1.0);
+            }
+        )";
+        std::string statsSource = std::string(R"(
+            #version 330 core
+            out vec4 Stats;
+            uniform sampler2D iField;
+
+            float fieldIterations(vec4 field, int layer);
+
+            void main() {
+                float iterations = fieldIterations(texelFetch(iField, ivec2(gl_FragCoord.xy), 0), 0);
+                if (iterations >= 0.0) Stats = vec4(1.0, iterations, 0.0, 0.0);
+                else Stats = vec4(0.0, 0.0, iterations == -1.0 ? 1.0 : 0.0, iterations == -2.0 ? 1.0 : 0.0);
+            }
+        )") + fieldIterationsGlsl;
+        statsProgram = programs.program(statsVertexSource, statsSource.c_str());
+        glUseProgram(statsProgram);
+        glUniform1i(glGetUniformLocation(statsProgram, "iField"), 0);
+
+        // Levels down to one texel per cell
+        while ((2 << cellLevel) <= layout.cellSize) cellLevel++;
+        glGenTextures(1, &statsTexture);
+        glBindTexture(GL_TEXTURE_2D, statsTexture);
+        for (int level = 0; level <= cellLevel; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA32F, layout.width() >> level, layout.height() >> level, 0,
+                         GL_RGBA, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cellLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GLint previous;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+        glGenFramebuffers(1, &statsFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, statsFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, statsTexture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        return true;
+    }
+
+    void destroy() {
+        glDeleteProgram(fieldProgram);
+        glDeleteProgram(statsProgram);
+        glDeleteTextures(1, &statsTexture);
+        glDeleteFramebuffers(1, &statsFramebuffer);
+    }
+
+    const AtlasLayout& grid() const { return layout; }
+
+    // Draws every cell into the bound target (an IterationField level of
+    // the atlas size); the quad VAO must be bound.
+    void drawField(int maxIter) {
+        startTime = std::chrono::steady_clock::now();
+        glUseProgram(fieldProgram);
+        glUniform2f(resolutionLocation, (float)layout.cellSize, (float)layout.cellSize);
+        glUniform1f(zoomLocation, kAtlasZoom);
+        glUniform1i(maxIterLocation, maxIter);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, layout.cells());
+    }
+
+    // Reduces the field bound to unit 0 to the per-cell averages and reads
+    // them back, which waits for the field pass.
+    void reduce() {
+        GLint previousFramebuffer, viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, statsFramebuffer);
+        glViewport(0, 0, layout.width(), layout.height());
+        glUseProgram(statsProgram);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        glBindTexture(GL_TEXTURE_2D, statsTexture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        std::vector<float> texels((size_t)layout.cells() * 4);
+        glGetTexImage(GL_TEXTURE_2D, cellLevel, GL_RGBA, GL_FLOAT, texels.data());
+        renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        // Texel rows run bottom-up, cells top-down
+        cells.assign(layout.cells(), AtlasCell());
+        for (int row = 0; row < layout.rows; row++) {
+            for (int column = 0; column < layout.columns; column++) {
+                const float* t = &texels[((size_t)(layout.rows - 1 - row) * layout.columns + column) * 4];
+                AtlasCell& cell = cells[(size_t)row * layout.columns + column];
+                cell.escaped = t[0];
+                cell.meanIterations = t[0] > 0.0f ? t[1] / t[0] : 0.0f;
+                cell.interior = t[2];
+                cell.capped = t[3];
+            }
+        }
+    }
+
+    // Prints a summary and writes the cells as CSV to path (if not empty).
+    bool writeStats(const std::string& path) const {
+        double escaped = 0.0;
+        for (const AtlasCell& cell : cells) escaped += cell.escaped;
+        std::fprintf(stderr, "julia atlas: %dx%d cells of %d px, %.1f%% of pixels escaped, %.1f ms\n",
+                     layout.columns, layout.rows, layout.cellSize,
+                     cells.empty() ? 0.0 : 100.0 * escaped / cells.size(), renderMs);
+        if (path.empty()) return true;
+
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            std::cerr << "Failed to open " << path << " for writing" << std::endl;
+            return false;
+        }
+        std::fprintf(file, "index,column,row,c_re,c_im,escaped,mean_iterations,interior,capped\n");
+        for (int row = 0; row < layout.rows; row++) {
+            for (int column = 0; column < layout.columns; column++) {
+                int index = row * layout.columns + column;
+                const AtlasCell& cell = cells[index];
+                std::fprintf(file, "%d,%d,%d,%.9g,%.9g,%.6f,%.3f,%.6f,%.6f\n", index, column, row,
+                             layout.cX(column), layout.cY(row), cell.escaped, cell.meanIterations, cell.interior,
+                             cell.capped);
+            }
+        }
+        bool ok = std::fclose(file) == 0;
+        if (!ok) std::cerr << "Failed to write " << path << std::endl;
+        return ok;
+    }
+
+private:
+    AtlasLayout layout;
+    GLuint fieldProgram = 0;
+    GLint resolutionLocation = -1, zoomLocation = -1, maxIterLocation = -1;
+    GLuint statsProgram = 0;
+    GLuint statsTexture = 0;
+    GLuint statsFramebuffer = 0;
+    int cellLevel = 0;
+    std::vector<AtlasCell> cells;
+    std::chrono::steady_clock::time_point startTime;
+    double renderMs = 0.0;
+};
@@ -3,6 +3,18 @@
 #include <iostream>
 #include <cmath>
 
+#include "distance_estimate.h"
+#include "double_float.h"
+#include "edge_supersample.h"
+#include "field_pipeline.h"
+#include "frame_controller.h"
+#include "frame_profiler.h"
+#include "headless.h"
+#include "iteration_histogram.h"
+#include "program_cache.h"
+#include "scenes.h"
+#include "shortcut_stats.h"
+
 const char* vertexShaderSource = R"(
     #version 330 core
     layout(location = 0) in vec2 aPos;
@@ -13,43 +25,132 @@ const char* vertexShaderSource = R"(
     }
 )";
 
-const char* fragmentShaderSource = R"(
+// Field pass: (normalized iteration count, smooth iteration count, interior
+// pattern value inside the boundary, outside it 0 or with --distance the
+// estimated distance to the set in field pixels, interior flag: 1 proven by
+// a shortcut, 2 reached the iteration budget, 0 escaped)
+const char* fieldShaderSource = R"(
     #version 330 core
-    out vec4 FragColor;
+    #ifndef EDGE_SUPERSAMPLE
+    out vec4 FieldValue;
+    #endif
     in vec2 fragCoord;
 
     uniform vec2 iResolution;
-    uniform float iTime;
-
-    const int MAX_ITER = 300;
+    uniform float iZoom;
+    uniform vec2 iCenter;
+    uniform int iMaxIter;         // Iteration budget
+    uniform int iStride;          // Field level being drawn holds every iStride-th pixel
+    uniform sampler2D iCoarser;   // Level at 2 * iStride, already holding every other sample
+    uniform int iHasCoarser;
+    uniform int iShortcutProbe;   // Non-zero: keep only pixels resolved by this shortcut
 
-    // Color palette from Color Hunt: #FEF9E1, #E5D0AC, #A31D1D, #6D2323
-    vec3 palette(float t) {
-        vec3 color1 = vec3(0.996, 0.976, 0.882); // #FEF9E1
-        vec3 color2 = vec3(0.898, 0.816, 0.675); // #E5D0AC
-        vec3 color3 = vec3(0.639, 0.114, 0.114); // #A31D1D
-        vec3 color4 = vec3(0.427, 0.137, 0.137); // #6D2323
+    const float ITER_SCALE = 300.0;   // Iterations per unit of field value
 
-        // Smooth transitions between colors
-        if (t < 0.25) return mix(color1, color2, t * 4.0);
-        else if (t < 0.5) return mix(color2, color3, (t - 0.25) * 4.0);
-        else if (t < 0.75) return mix(color3, color4, (t - 0.5) * 4.0);
-        else return mix(color4, color1, (t - 0.75) * 4.0);
-    }
+    // Early-out that resolved the last mandelbrot() call:
+    // 0 none, 1 main cardioid, 2 period-2 bulb, 3 periodic orbit
+    int shortcut = 0;
+    // Whether the last call reached the budget without escaping
+    bool capped = false;
+    // Continuous iteration count of the last call, normalized like its result
+    float smoothIter = 0.0;
+    #ifdef DISTANCE_ESTIMATE
+    // Estimated distance of the last escaped c to the set, in units of c
+    float exteriorDistance = 0.0;
+    // Whether mandelbrot() tracks the derivative for it; the interior pattern's
+    // calls do not need it
+    bool trackDistance = true;
+    #endif
 
-    // Mandelbrot calculation
+    // Mandelbrot calculation, with the step of the formula the program was built for
     float mandelbrot(vec2 c) {
+        smoothIter = 1.0;
+        capped = false;
+    #ifdef FORMULA_INTERIOR_TEST
+        // The main cardioid and the period-2 bulb are interior, skip iterating
+        float xq = c.x - 0.25;
+        float q = xq * xq + c.y * c.y;
+        if (q * (q + xq) <= 0.25 * (c.y * c.y)) { shortcut = 1; return 1.0; }
+        if ((c.x + 1.0) * (c.x + 1.0) + c.y * c.y <= 0.0625) { shortcut = 2; return 1.0; }
+    #endif
+
         vec2 z = c;
+        vec2 saved = z;          // Brent cycle detection: z at the last power of two step
+        float nextSave = 2.0;
+    #ifdef DISTANCE_ESTIMATE
+        vec2 dz = vec2(1.0, 0.0);  // dz/dc
+    #endif
+        float iter;
+        for (iter = 0.0; iter < iMaxIter; iter++) {
+            if (dot(z, z) > 4.0) break;
+    #ifdef DISTANCE_ESTIMATE
+            if (trackDistance) dz = formulaDerivative(z, dz) + vec2(1.0, 0.0);
+    #endif
+            z = formulaStep(z) + c;
+            // An orbit that repeats exactly can never escape
+            if (z == saved) { shortcut = 3; return 1.0; }
+            if (iter + 1.0 == nextSave) { saved = z; nextSave *= 2.0; }
+        }
+        shortcut = 0;
+        // Points that outlast the budget are taken as interior
+        capped = iter == iMaxIter;
+        if (capped) return 1.0;
+        smoothIter = clamp((iter + 1.0 - formulaSmooth(length(z))) / ITER_SCALE, 0.0, float(iMaxIter) / ITER_SCALE);
+    #ifdef DISTANCE_ESTIMATE
+        if (trackDistance) exteriorDistance = distanceEstimate(z, dz, c, 1.0);
+    #endif
+        return iter / ITER_SCALE;
+    }
+
+    #ifdef DOUBLE_FLOAT
+    uniform vec2 iCenterLo;       // iCenter + iCenterLo is the centre as a double-float
+
+    // mandelbrot() with c and z as double-floats (re and im each hi, lo)
+    float mandelbrotDoubleFloat(vec2 cRe, vec2 cIm) {
+        smoothIter = 1.0;
+        capped = false;
+    #ifdef FORMULA_INTERIOR_TEST
+        vec2 c = vec2(cRe.x, cIm.x);
+        float xq = c.x - 0.25;
+        float q = xq * xq + c.y * c.y;
+        if (q * (q + xq) <= 0.25 * (c.y * c.y)) { shortcut = 1; return 1.0; }
+        if ((c.x + 1.0) * (c.x + 1.0) + c.y * c.y <= 0.0625) { shortcut = 2; return 1.0; }
+    #endif
+
+        vec2 zRe = cRe;
+        vec2 zIm = cIm;
+        vec4 saved = vec4(zRe, zIm);
+        float nextSave = 2.0;
+    #ifdef DISTANCE_ESTIMATE
+        vec2 dz = vec2(1.0, 0.0);  // dz/dc, which float holds well enough
+    #endif
         float iter;
-        for (iter = 0.0; iter < MAX_ITER; iter++) {
-            if (length(z) > 2.0) break;
-            z = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y) + c;
+        for (iter = 0.0; iter < iMaxIter; iter++) {
+            vec2 re2 = dfSqr(zRe);
+            vec2 im2 = dfSqr(zIm);
+            if (re2.x + im2.x > 4.0) break;
+    #ifdef DISTANCE_ESTIMATE
+            if (trackDistance) dz = formulaDerivative(vec2(zRe.x, zIm.x), dz) + vec2(1.0, 0.0);
+    #endif
+            dfFormulaStep(zRe, zIm, re2, im2, cRe, cIm);
+            vec4 z = vec4(zRe, zIm);
+            if (z == saved) { shortcut = 3; return 1.0; }
+            if (iter + 1.0 == nextSave) { saved = z; nextSave *= 2.0; }
         }
-        return iter / MAX_ITER;
+        shortcut = 0;
+        capped = iter == iMaxIter;
+        if (capped) return 1.0;
+        float radius = length(vec2(zRe.x, zIm.x));
+        smoothIter = clamp((iter + 1.0 - formulaSmooth(radius)) / ITER_SCALE, 0.0, float(iMaxIter) / ITER_SCALE);
+    #ifdef DISTANCE_ESTIMATE
+        if (trackDistance) exteriorDistance = distanceEstimate(vec2(zRe.x, zIm.x), dz, vec2(cRe.x, cIm.x), 1.0);
+    #endif
+        return iter / ITER_SCALE;
     }
+    #endif
 
     // Recursive fractal patterns
-    float recursiveFractal(vec2 c, float scale, float time) {
+    float recursiveFractal(vec2 c, float scale) {
         float fractal = 0.0;
 
 
@@ -63,75 +164,151 @@ const char* fragmentShaderSource = R"(
         return fractal;
     }
 
+    // Field value at a position in pixels of the full field; shortcut is
+    // left as the main mandelbrot() call set it
+    vec4 fieldValue(vec2 pixel) {
+        float pixelsPerUnit = iResolution.y * 0.2 * iZoom;
+        vec2 offset = (pixel - 0.5 * iResolution.xy) / (iResolution.y * 0.2) / iZoom;
+        vec2 c = offset + iCenter;
+
+    #ifdef DOUBLE_FLOAT
+        // The offset from the centre needs no more than float precision
+        float t = mandelbrotDoubleFloat(dfAdd(vec2(iCenter.x, iCenterLo.x), vec2(offset.x, 0.0)),
+                                        dfAdd(vec2(iCenter.y, iCenterLo.y), vec2(offset.y, 0.0)));
+    #else
+        float t = mandelbrot(c);
+    #endif
+        float smoothT = smoothIter;
+        int resolvedBy = shortcut;
+        float interior = shortcut != 0 ? 1.0 : capped ? 2.0 : 0.0;
+
+        // Recursive fractal patterns inside the boundary
+    #ifdef DISTANCE_ESTIMATE
+        trackDistance = false;
+        float innerFractal = interior != 0.0 ? recursiveFractal(c, 2.0) : exteriorDistance * pixelsPerUnit;
+        trackDistance = true;
+    #else
+        float innerFractal = interior != 0.0 ? recursiveFractal(c, 2.0) : 0.0;
+    #endif
+
+        shortcut = resolvedBy;
+        return vec4(t, smoothT, innerFractal, interior);
+    }
+
+    #ifndef EDGE_SUPERSAMPLE
     void main() {
-        float zoom = exp(iTime * 0.13); // Smooth zoom in
-        vec2 center = vec2(-0.745428, 0.131825); // Visually interesting point
-        center += 0.01 * vec2(sin(iTime * 0.15), cos(iTime * 0.1)); // Subtle movement
+        ivec2 cell = ivec2(gl_FragCoord.xy);
+        if (iHasCoarser != 0 && all(equal(cell % 2, ivec2(0)))) {
+            FieldValue = texelFetch(iCoarser, cell / 2, 0);
+            return;
+        }
+    #ifdef DISTANCE_ESTIMATE
+        if (iHasCoarser != 0 && distanceFill(iCoarser, cell, iStride, FieldValue)) return;
+    #endif
 
-        vec2 c = (fragCoord * iResolution - 0.5 * iResolution.xy) / (iResolution.y * 0.2) / zoom + center;
+        // The pixel of the full field this sample stands for
+        FieldValue = fieldValue(vec2(cell * iStride) + 0.5);
+        if (iShortcutProbe != 0 && shortcut != iShortcutProbe) discard;
+    }
+    #endif
+)";
 
-        
-        float t = mandelbrot(c);
-        vec3 color = palette(t);
+// Colour pass: palette lookup plus the outlined interior pattern
+const char* colorShaderSource = R"(
+    #version 330 core
+    out vec4 FragColor;
+
+    uniform sampler2D iField;
+    uniform sampler2D iPalette;   // palette(t) as a wrapping 256 entry lookup table
+    uniform vec2 iFieldScale;     // Field size / window size
+    uniform int iStride;          // Pixel stride of the field level bound to iField
+    uniform float iPaletteShift;
+    uniform int iSmooth;
+
+    const float ITER_SCALE = 300.0;   // Iterations per unit of field value
+
+    // Colour of a field texel with palette input value and interior pattern
+    vec3 shade(bool interior, float value, float pattern) {
+        // Equalized, the palette runs once over the escaped pixels of the view
+        if (iEqualizeBudget > 0.0 && !interior) value = equalize(value * ITER_SCALE);
+        vec3 color = texture(iPalette, vec2(((value + iPaletteShift) * 256.0 + 0.5) / 256.0, 0.5)).rgb;
 
         // Add recursive fractal patterns inside the boundary
-        if (t > 0.98) {
-            float innerFractal = recursiveFractal(c, 2.0, iTime);
-            float outlineFactor = mod(innerFractal * 15.0, 1.0);
+        if (interior) {
+            float outlineFactor = mod(pattern * 15.0, 1.0);
             vec3 innerColor = mix(vec3(0.427, 0.137, 0.137), vec3(0.996, 0.976, 0.882), outlineFactor);
             color = mix(color, innerColor, 0.95);
         }
+        return color;
+    }
 
-        FragColor = vec4(color, 1.0);
+    void main() {
+        // Upscale by taking the nearest sample the refinement has reached
+        ivec2 texel = ivec2(gl_FragCoord.xy * iFieldScale) / iStride;
+        vec4 field = texelFetch(iField, texel, 0);
+        // Edge pixels of a complete field are averaged from their subsamples
+        if (iEdgeSamples > 0 && iStride == 1 && isEdge(iField, texel, iEdgeThreshold, iSmooth))
+            FragColor = vec4(edgeColor(texel), 1.0);
+        else
+            FragColor = vec4(shade(field.a != 0.0, edgeValue(field, iSmooth), field.b), 1.0);
+    #ifdef DISTANCE_ESTIMATE
+        // Outside the set the pattern channel holds the distance to it
+        if (field.a == 0.0) FragColor.rgb = distanceShade(FragColor.rgb, field.b);
+    #endif
     }
 )";
 
-void checkCompileErrors(GLuint shader, std::string type) {
-    GLint success;
-    GLchar infoLog[1024];
-    if (type != "PROGRAM") {
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-            std::cout << "Shader Compilation Error (" << type << "):\n" << infoLog << std::endl;
-        }
-    } else {
-        glGetProgramiv(shader, GL_LINK_STATUS, &success);
-        if (!success) {
-            glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-            std::cout << "Program Linking Error:\n" << infoLog << std::endl;
-        }
+// Escape iterations of a field texel, for IterationHistogram; ITER_SCALE
+// comes from fieldIterationsVariant()
+const char* fieldIterationsSource = R"(
+    float fieldIterations(vec4 field, int layer) {
+        return field.a != 0.0 ? -field.a : field.r * ITER_SCALE;
     }
-}
+)";
+
+// Color palette from Color Hunt: #FEF9E1, #E5D0AC, #A31D1D, #6D2323
+const float paletteColors[4][3] = {
+    {0.996f, 0.976f, 0.882f}, {0.898f, 0.816f, 0.675f}, {0.639f, 0.114f, 0.114f}, {0.427f, 0.137f, 0.137f}};
+
+bool animationPaused = false;
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
     }
+    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
+        animationPaused = !animationPaused;
+    }
 }
 
-int main() {
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_CORE_PROFILE, GLFW_TRUE);
-    glfwWindowHint(GLFW_MAXIMIZED, GLFW_TRUE);
-    
-    GLFWwindow* window = glfwCreateWindow(1920, 1080, "Mandelbrot Renderer", glfwGetPrimaryMonitor(), NULL);
-    if (!window) {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-    glewExperimental = true;
-    glewInit();
-    
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glEnable(GL_MULTISAMPLE);
+int main(int argc, char** argv) {
+    RenderOptions options;
+    if (!parseRenderOptions(argc, argv, options)) return -1;
+
+    HeadlessContext headless;
+    GLFWwindow* window = nullptr;
+    if (options.headless) {
+        if (!createHeadlessContext(headless)) return -1;
+    } else {
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_CORE_PROFILE, GLFW_TRUE);
+        glfwWindowHint(GLFW_MAXIMIZED, GLFW_TRUE);
     
-    glfwSetKeyCallback(window, keyCallback);
+        window = glfwCreateWindow(1920, 1080, "Mandelbrot Renderer", glfwGetPrimaryMonitor(), NULL);
+        if (!window) {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glewExperimental = true;
+        glewInit();
     
+        glfwSetKeyCallback(window, keyCallback);
+    }
+
     GLuint VAO, VBO;
     float vertices[] = {
         -1.0f, -1.0f,  1.0f, -1.0f, -1.0f,  1.0f,  
@@ -145,37 +322,339 @@ int main() {
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    checkCompileErrors(vertexShader, "VERTEX");
-    
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    checkCompileErrors(fragmentShader, "FRAGMENT");
-    
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    checkCompileErrors(shaderProgram, "PROGRAM");
-    
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    
+    // All programs are requested at once, so that the driver can compile
+    // them side by side. The float field shader for --formula and the colour
+    // pass are needed for the first frame; the double-float field and the
+    // edge supersampling programs may still be compiling, and until they are
+    // the float field stands in and edges are not supersampled. Headless
+    // runs and --precision double wait for them, so that their frames do not
+    // depend on compile times.
+    ProgramCache programs;
+    programs.create(programCacheDir(options.shaderCache));
+    std::string fieldSource = formulaVariant(fieldShaderSource, options.formula);
+    std::string colorSource = equalizeVariant(colorShaderSource);
+    if (options.distanceEstimate) {
+        fieldSource = distanceVariant(fieldSource.c_str(), kDistanceFieldGlsl);
+        colorSource = distanceVariant(colorSource.c_str(), kDistanceShadeGlsl);
+    }
+    std::string edgeSource = edgeSupersampleVariant(fieldSource.c_str());
+    PendingProgram fieldPending[2] = {
+        programs.request(vertexShaderSource, fieldSource.c_str()),
+        programs.request(vertexShaderSource, doubleFloatVariant(fieldSource.c_str()).c_str())};
+    PendingProgram edgePending[2];
+    if (options.edgeSamples > 0) {
+        edgePending[0] = programs.request(vertexShaderSource, edgeSource.c_str());
+        edgePending[1] = programs.request(vertexShaderSource, doubleFloatVariant(edgeSource.c_str()).c_str());
+    }
+    GLuint colorProgram = programs.program(vertexShaderSource, edgeResolveVariant(colorSource.c_str()).c_str());
+    programs.finish(fieldPending[0], true);
+    bool waitForVariants = options.headless || options.precision == FieldPrecision::DoubleFloat;
+
+    struct FieldUniforms {
+        GLint resolution, zoom, center, centerLo, maxIter, stride, hasCoarser;
+    };
+    GLuint fieldPrograms[2] = {0, 0};
+    FieldUniforms fieldUniforms[2];
+    GLint iFieldScaleLocation = glGetUniformLocation(colorProgram, "iFieldScale");
+    GLint iColorStrideLocation = glGetUniformLocation(colorProgram, "iStride");
+    GLint iPaletteShiftLocation = glGetUniformLocation(colorProgram, "iPaletteShift");
+    GLint iColorEdgeSamplesLocation = glGetUniformLocation(colorProgram, "iEdgeSamples");
+    GLint iEqualizeBudgetLocation = glGetUniformLocation(colorProgram, "iEqualizeBudget");
+    glUseProgram(colorProgram);
+    glUniform1i(glGetUniformLocation(colorProgram, "iField"), 0);
+    glUniform1i(glGetUniformLocation(colorProgram, "iPalette"), 1);
+    glUniform1i(glGetUniformLocation(colorProgram, "iSmooth"), options.smooth ? 1 : 0);
+    glUniform1i(glGetUniformLocation(colorProgram, "iEdgeSampleTexture"), 2);
+    glUniform1i(glGetUniformLocation(colorProgram, "iEqualization"), 3);
+
+    // ITER_SCALE of the shaders, which is also the default budget
+    const int iterationScale = 300;
+    std::string fieldIterations = fieldIterationsVariant(fieldIterationsSource, iterationScale);
+
+    // Escape histograms of the finished field passes steer the budget and
+    // the equalized palette
+    IterationBudget budget(options.maxIter, options.adaptiveIter, iterationScale);
+    bool countHistograms = budget.isAdaptive() || options.equalize;
+    IterationHistogram histogram;
+    if (countHistograms) histogram.create(programs, fieldIterations.c_str());
+    EqualizationTable equalization;
+    if (options.equalize) equalization.create();
+    EscapeHistogram escapes;
+
+    // Edge supersampling: the field shader's fieldValue() behind the edge
+    // pass main(), in both precisions. Both read the complete field on unit 0.
+    EdgeSupersampler supersampler;
+    supersampler.create(options.edgeSamples, options.edgeThreshold, iterationScale);
+    GLuint edgePrograms[2] = {0, 0};
+    FieldUniforms edgeUniforms[2];
+    glUniform1f(glGetUniformLocation(colorProgram, "iEdgeThreshold"), supersampler.thresholdValue());
+
+    // Sets up the programs that have finished linking since the last call
+    auto pollPrograms = [&] {
+        for (int i = 0; i < 2; i++) {
+            if (!fieldPrograms[i] && programs.finish(fieldPending[i], waitForVariants)) {
+                GLuint program = fieldPrograms[i] = fieldPending[i].program;
+                fieldUniforms[i] = {glGetUniformLocation(program, "iResolution"),
+                                    glGetUniformLocation(program, "iZoom"),
+                                    glGetUniformLocation(program, "iCenter"),
+                                    glGetUniformLocation(program, "iCenterLo"),
+                                    glGetUniformLocation(program, "iMaxIter"),
+                                    glGetUniformLocation(program, "iStride"),
+                                    glGetUniformLocation(program, "iHasCoarser")};
+                glUseProgram(program);
+                glUniform1i(glGetUniformLocation(program, "iCoarser"), 0);
+                glUniform1f(glGetUniformLocation(program, "iDoubleFloatOne"), 1.0f);
+            }
+            if (supersampler.enabled() && !edgePrograms[i] && programs.finish(edgePending[i], waitForVariants)) {
+                GLuint program = edgePrograms[i] = edgePending[i].program;
+                edgeUniforms[i] = {glGetUniformLocation(program, "iResolution"),
+                                   glGetUniformLocation(program, "iZoom"),
+                                   glGetUniformLocation(program, "iCenter"),
+                                   glGetUniformLocation(program, "iCenterLo"),
+                                   glGetUniformLocation(program, "iMaxIter"), -1, -1};
+                glUseProgram(program);
+                glUniform1i(glGetUniformLocation(program, "iEdgeField"), 0);
+                glUniform1i(glGetUniformLocation(program, "iEdgeSamples"), supersampler.sampleCount());
+                glUniform1f(glGetUniformLocation(program, "iEdgeThreshold"), supersampler.thresholdValue());
+                glUniform1i(glGetUniformLocation(program, "iEdgeSmooth"), options.smooth ? 1 : 0);
+                glUniform1f(glGetUniformLocation(program, "iDoubleFloatOne"), 1.0f);
+            }
+        }
+    };
+    pollPrograms();
+
+    IterationField field;
+    field.create({kFieldR | kFieldG | kFieldB | kFieldA}, kProgressiveLevels);
+    GLuint paletteTexture = createPaletteTexture(paletteColors);
+
+    ShortcutProbe shortcutProbe;
+    shortcutProbe.create(fieldPrograms[0], {{1, "cardioid"}, {2, "bulb"}, {3, "periodic"}}, options.shortcutStats);
+    long frame = 0;
+    auto drawQuad = [&] { glDrawArrays(GL_TRIANGLES, 0, 6); };
+
+    FrameController controller(options.targetMs, options.minScale, budget.iterations());
+    // The controller learns its cost model from the profiler's pass timings,
+    // which also give the cost of each precision
+    FrameProfiler profiler;
+    if (!profiler.create(options, true)) return -1;
+    PrecisionCost precisionCost;
+    double scaleSum = 0.0, iterationSum = 0.0;
+    float lastZoom = 0.0f, lastCenterX = 0.0f, lastCenterY = 0.0f;
+    bool doubleFloat = false;
+    long doubleFloatFrames = 0;
+
+    // Refines the field as far as the frame budget allows (restarting when
+    // the view moved), then colours the frame from it at window size
+    auto drawFrame = [&](float time, double paletteShift, int width, int height) {
+        Scene scene = makeScene(SceneKind::Mandelbrot, time, width, height);
+        bool viewMoving = scene.viewport.zoom != lastZoom || scene.viewport.centerX != lastCenterX ||
+                          scene.viewport.centerY != lastCenterY;
+        lastZoom = scene.viewport.zoom;
+        lastCenterX = scene.viewport.centerX;
+        lastCenterY = scene.viewport.centerY;
+        // The histogram of the last field pass moves the budget; the
+        // controller may still cut it while the view moves
+        if (histogram.take(escapes)) {
+            budget.update(escapes);
+            if (options.equalize) equalization.update(escapes);
+            if (budget.isAdaptive()) profiler.value("capped share", budget.cappedShare());
+        }
+        budget.recordFrame();
+        controller.setMaxIterations(budget.iterations());
+        controller.update(width, height, viewMoving);
+        scaleSum += controller.scale();
+        iterationSum += controller.iterations();
+
+        FieldKey key;
+        key.width = controller.fieldWidth(width);
+        key.height = controller.fieldHeight(height);
+        key.zoom = scene.viewport.zoom;
+        key.centerX = scene.viewport.centerX;
+        key.centerY = scene.viewport.centerY;
+        key.maxIter = controller.iterations();
+        profiler.value("iterations", key.maxIter);
+
+        // Past float resolution the field switches to double-float, once
+        // that program has linked
+        pollPrograms();
+        double centerX, centerY;
+        sceneCenter(SceneKind::Mandelbrot, time, centerX, centerY);
+        double pixelSize = 1.0 / (key.height * scene.viewport.heightScale * scene.viewport.zoom);
+        bool useDoubleFloat = needsDoubleFloat(options.precision, pixelSize, centerX, centerY) && fieldPrograms[1];
+        if (useDoubleFloat != doubleFloat) {
+            std::cerr << "zoom " << scene.viewport.zoom << ": " << (useDoubleFloat ? "double-float" : "float")
+                      << " field" << std::endl;
+            doubleFloat = useDoubleFloat;
+        }
+        controller.setDoubleFloat(doubleFloat);
+        doubleFloatFrames += doubleFloat ? 1 : 0;
+        key.doubleFloat = doubleFloat;
+        GLuint fieldProgram = fieldPrograms[doubleFloat];
+        const FieldUniforms& uniforms = fieldUniforms[doubleFloat];
+        shortcutProbe.setProgram(fieldProgram);
+
+        // The view uniforms of a field or edge program in use
+        auto uploadView = [&](const FieldUniforms& view) {
+            glUniform2f(view.resolution, (float)key.width, (float)key.height);
+            glUniform1f(view.zoom, scene.viewport.zoom);
+            if (doubleFloat) {
+                float hiX, loX, hiY, loY;
+                splitDouble(centerX, hiX, loX);
+                splitDouble(centerY, hiY, loY);
+                glUniform2f(view.center, hiX, hiY);
+                glUniform2f(view.centerLo, loX, loY);
+            } else {
+                glUniform2f(view.center, scene.viewport.centerX, scene.viewport.centerY);
+            }
+            glUniform1i(view.maxIter, key.maxIter);
+        };
+
+        glBindVertexArray(VAO);
+        field.stale(key, 1u);
+        int level = field.finestLevel(1u);
+        if (level != 0) {
+            profiler.beginCpu("upload");
+            glUseProgram(fieldProgram);
+            uploadView(uniforms);
+            profiler.endCpu();
+            // Without a target the field is computed in one full pass, or
+            // with --distance through all levels at once, so that finer
+            // levels can fill samples far from the set
+            bool progressive = controller.enabled() || options.distanceEstimate;
+            double spentMs = 0.0;
+            for (int passes = 0; level != 0; passes++) {
+                bool coarserDone = level > 0 && progressive;
+                int next = !progressive ? 0 : level < 0 ? kProgressiveLevels - 1 : level - 1;
+                long samples = levelSamples(key.width, key.height, next, coarserDone);
+                double costMs = controller.estimateMs(samples);
+                if (controller.enabled() && passes > 0 && spentMs + costMs > controller.targetMs()) break;
+                spentMs += costMs;
+
+                if (coarserDone) field.bindTexture(GL_TEXTURE0, level);
+                field.begin(1u, next);
+                glUniform1i(uniforms.stride, 1 << next);
+                glUniform1i(uniforms.hasCoarser, coarserDone ? 1 : 0);
+                CpuSection section(profiler, "draw");
+                int iterations = key.maxIter;
+                bool passDoubleFloat = doubleFloat;
+                profiler.beginGpu(doubleFloat ? "field df" : "field",
+                                  [&controller, &precisionCost, samples, iterations, passDoubleFloat](double ms) {
+                    controller.record(ms, samples, iterations, passDoubleFloat);
+                    precisionCost.record(passDoubleFloat, ms, samples);
+                });
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                profiler.endGpu();
+                field.end();
+                level = next;
+            }
+            // The shortcut probe draws with this program and wants every pixel
+            glUniform1i(uniforms.stride, 1);
+            glUniform1i(uniforms.hasCoarser, 0);
+
+            if (countHistograms) {
+                int stride = 1 << level;
+                field.bindTexture(GL_TEXTURE0, level);
+                CpuSection section(profiler, "draw");
+                profiler.beginGpu("histogram");
+                histogram.count((key.width + stride - 1) / stride, (key.height + stride - 1) / stride, key.maxIter);
+                profiler.endGpu();
+            }
+        }
+
+        // Once the field is complete its edge pixels are supersampled, once
+        // per view and outside the --target-ms budget
+        bool edgeProgramReady = edgePrograms[doubleFloat] != 0;
+        if (level == 0 && edgeProgramReady && supersampler.stale(key)) {
+            profiler.beginCpu("upload");
+            glUseProgram(edgePrograms[doubleFloat]);
+            uploadView(edgeUniforms[doubleFloat]);
+            field.bindTexture(GL_TEXTURE0, 0);
+            profiler.endCpu();
+            CpuSection section(profiler, "draw");
+            supersampler.begin();
+            profiler.beginGpu("edge aa", [&supersampler](double ms) { supersampler.recordMs(ms); });
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            profiler.endGpu();
+            supersampler.end();
+        }
+
+        profiler.beginCpu("upload");
+        glViewport(0, 0, width, height);
+        glUseProgram(colorProgram);
+        field.bindTexture(GL_TEXTURE0, level);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, paletteTexture);
+        glUniform2f(iFieldScaleLocation, (float)key.width / width, (float)key.height / height);
+        glUniform1i(iColorStrideLocation, 1 << level);
+        bool useEdgeSamples = level == 0 && edgeProgramReady && supersampler.ready();
+        glUniform1i(iColorEdgeSamplesLocation, useEdgeSamples ? supersampler.sampleCount() : 0);
+        supersampler.bindTexture(GL_TEXTURE2);
+        equalization.bindTexture(GL_TEXTURE3);
+        glUniform1f(iEqualizeBudgetLocation, options.equalize ? (float)equalization.budget() : 0.0f);
+        glUniform1f(iPaletteShiftLocation, (float)(paletteShift - std::floor(paletteShift)));
+        profiler.endCpu();
+        profiler.beginCpu("draw");
+        profiler.beginGpu("colour");
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        profiler.endGpu();
+        profiler.endCpu();
+        shortcutProbe.update(frame++, width, height, drawQuad);
+    };
+
+    if (options.headless) {
+        int result = runHeadless(options, 600, [&](float time, int width, int height) {
+            drawFrame(time, time * options.paletteCycle, width, height);
+        }, &profiler);
+        std::cerr << field.passCount() << " field passes for " << frame << " frames" << std::endl;
+        if (controller.enabled() && frame > 0) {
+            std::cerr << "mean internal scale " << scaleSum / frame << ", mean iteration budget "
+                      << iterationSum / frame << std::endl;
+        }
+        if (doubleFloatFrames > 0) std::cerr << doubleFloatFrames << " frames in double-float" << std::endl;
+        profiler.destroy();
+        precisionCost.report();
+        budget.report();
+        histogram.destroy();
+        equalization.destroy();
+        supersampler.destroy();
+        programs.destroy();
+        shortcutProbe.destroy();
+        field.destroy();
+        destroyHeadlessContext(headless);
+        return result;
+    }
+
+    // Space pauses the zoom; the palette keeps cycling on the wall clock
+    double lastTime = glfwGetTime();
+    float animationTime = 0.0f;
     while (!glfwWindowShouldClose(window)) {
+        double currentTime = glfwGetTime();
+        if (!animationPaused) animationTime += (float)(currentTime - lastTime);
+        lastTime = currentTime;
+
         int width, height;
         glfwGetFramebufferSize(window, &width, &height);
-        glUseProgram(shaderProgram);
-        glUniform2f(glGetUniformLocation(shaderProgram, "iResolution"), (float)width, (float)height);
-        glUniform1f(glGetUniformLocation(shaderProgram, "iTime"), (float)glfwGetTime());
+        profiler.beginFrame();
         glClear(GL_COLOR_BUFFER_BIT);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        drawFrame(animationTime, currentTime * options.paletteCycle, width, height);
+        profiler.drawOverlay(width, height);
+        profiler.beginCpu("swap");
         glfwSwapBuffers(window);
+        profiler.endCpu();
+        profiler.beginCpu("poll");
         glfwPollEvents();
+        profiler.endCpu();
+        profiler.endFrame();
     }
+    profiler.destroy();
+    precisionCost.report();
+    budget.report();
+    histogram.destroy();
+    equalization.destroy();
+    supersampler.destroy();
+    programs.destroy();
+    shortcutProbe.destroy();
+    field.destroy();
     glfwTerminate();
     return 0;
 }
@@ -0,0 +1,187 @@
+#pragma once
+
+// Mariani-Silver subdivision. Large parts of a frame share one iteration
+// count, so instead of evaluating every pixel a rectangle only evaluates its
+// border: if the border has a single count the inside is filled with it,
+// otherwise the rectangle is split in two along its longer side and the
+// split line becomes part of both halves' borders.
+//
+// For a connected, full set (the Mandelbrot set, connected Julia sets) a
+// border that is entirely interior encloses only interior points. Exterior
+// bands are not guaranteed: a filament thinner than a pixel can cross a
+// band without touching the border. The centre pixel is always checked as
+// well, and uniform borders with a dwell at or above filamentDwell (close to
+// the set, where filaments live) are evaluated in full rather than filled.
+
+#include <cstdint>
+#include <vector>
+
+#include "escape_time.h"
+#include "tile_scheduler.h"
+
+struct SubdivisionOptions {
+    int minSize = 6;          // Rectangles with a side at or below this are evaluated pixel by pixel
+    int filamentDwell = 0;    // Uniform exterior borders at or above this dwell are not filled, 0 = off
+};
+
+struct SubdivisionStats {
+    long evaluated = 0;   // Pixels whose escape time was computed
+    long filled = 0;      // Pixels copied from a uniform border
+
+    SubdivisionStats& operator+=(const SubdivisionStats& other) {
+        evaluated += other.evaluated;
+        filled += other.filled;
+        return *this;
+    }
+};
+
+// Subdivides one tile whose rows start at base with the given stride.
+// Rectangles are resolved breadth first and every round's border, probe and
+// leftover pixels go through escapePoints together, so scattered columns
+// still fill whole SIMD lane groups. One instance is kept per worker and
+// reused for every tile and layer, so its work lists only grow once.
+class alignas(kCacheLine) MarianiSilver {
+public:
+    void run(const EscapeParams& escapeParams, const Viewport& viewport, SimdLevel level,
+             const SubdivisionOptions& subdivisionOptions, EscapeStats* stats, const Tile& tile, uint32_t* base,
+             size_t stride, SubdivisionStats& subdivisionStats) {
+        params = &escapeParams;
+        view = &viewport;
+        simd = level;
+        options = subdivisionOptions;
+        escapeStats = stats;
+        origin = tile;
+        rows = base;
+        rowStride = stride;
+        counters = &subdivisionStats;
+        known.assign((size_t)tile.width * tile.height, 0);
+
+        int w = tile.width, h = tile.height;
+        queueRow(0, 0, w);
+        queueRow(h - 1, 0, w);
+        queueColumn(0, 0, h);
+        queueColumn(w - 1, 0, h);
+        evaluateQueued();
+
+        current.assign(1, Rect{0, 0, w, h});
+        while (!current.empty()) {
+            next.clear();
+            probed.clear();
+            for (const Rect& rect : current) {
+                if (rect.w <= 2 || rect.h <= 2) continue;
+                if (rect.w <= options.minSize || rect.h <= options.minSize) {
+                    for (int y = rect.y + 1; y < rect.y + rect.h - 1; y++) queueRow(y, rect.x + 1, rect.w - 2);
+                } else if (fillCandidate(rect)) {
+                    queueRow(rect.y + rect.h / 2, rect.x + rect.w / 2, 1);
+                    probed.push_back(rect);
+                } else {
+                    split(rect, next);
+                }
+            }
+            evaluateQueued();
+
+            // A uniform border only fills if the centre agrees with it
+            for (const Rect& rect : probed) {
+                if (at(rect.x + rect.w / 2, rect.y + rect.h / 2) == at(rect.x, rect.y)) {
+                    fill(rect);
+                } else {
+                    split(rect, next);
+                }
+            }
+            evaluateQueued();
+            std::swap(current, next);
+        }
+    }
+
+private:
+    struct Rect {
+        int x, y, w, h;
+    };
+
+    uint32_t& at(int x, int y) { return rows[(size_t)y * rowStride + x]; }
+    uint8_t& isKnown(int x, int y) { return known[(size_t)y * origin.width + x]; }
+
+    void queue(int x, int y) {
+        if (isKnown(x, y)) return;
+        isKnown(x, y) = 1;
+        queuedX.push_back(x);
+        queuedY.push_back(y);
+        pointX.push_back(view->pixelX((float)(origin.x0 + x)));
+        pointY.push_back(view->pixelY((float)(origin.y0 + y)));
+    }
+
+    void queueRow(int y, int x0, int count) {
+        for (int x = x0; x < x0 + count; x++) queue(x, y);
+    }
+
+    void queueColumn(int x, int y0, int count) {
+        for (int y = y0; y < y0 + count; y++) queue(x, y);
+    }
+
+    void evaluateQueued() {
+        int count = (int)queuedX.size();
+        if (count == 0) return;
+        results.resize(count);
+        escapePoints(*params, pointX.data(), pointY.data(), count, results.data(), simd, escapeStats);
+        for (int i = 0; i < count; i++) at(queuedX[i], queuedY[i]) = results[i];
+        counters->evaluated += count;
+        queuedX.clear();
+        queuedY.clear();
+        pointX.clear();
+        pointY.clear();
+    }
+
+    bool fillCandidate(const Rect& rect) {
+        uint32_t value = at(rect.x, rect.y);
+        if (options.filamentDwell > 0 && (int)value >= options.filamentDwell && (int)value < params->maxIter)
+            return false;
+        for (int x = rect.x; x < rect.x + rect.w; x++)
+            if (at(x, rect.y) != value || at(x, rect.y + rect.h - 1) != value) return false;
+        for (int y = rect.y; y < rect.y + rect.h; y++)
+            if (at(rect.x, y) != value || at(rect.x + rect.w - 1, y) != value) return false;
+        return true;
+    }
+
+    void fill(const Rect& rect) {
+        uint32_t value = at(rect.x, rect.y);
+        for (int y = rect.y + 1; y < rect.y + rect.h - 1; y++) {
+            for (int x = rect.x + 1; x < rect.x + rect.w - 1; x++) {
+                if (isKnown(x, y)) continue;
+                isKnown(x, y) = 1;
+                at(x, y) = value;
+                counters->filled++;
+            }
+        }
+    }
+
+    // Halves the longer side; the split line is shared by both halves.
+    void split(const Rect& rect, std::vector<Rect>& next) {
+        if (rect.w >= rect.h) {
+            int mid = rect.x + rect.w / 2;
+            queueColumn(mid, rect.y, rect.h);
+            next.push_back({rect.x, rect.y, mid - rect.x + 1, rect.h});
+            next.push_back({mid, rect.y, rect.x + rect.w - mid, rect.h});
+        } else {
+            int mid = rect.y + rect.h / 2;
+            queueRow(mid, rect.x, rect.w);
+            next.push_back({rect.x, rect.y, rect.w, mid - rect.y + 1});
+            next.push_back({rect.x, mid, rect.w, rect.y + rect.h - mid});
+        }
+    }
+
+    const EscapeParams* params = nullptr;
+    const Viewport* view = nullptr;
+    SimdLevel simd = SimdLevel::Scalar;
+    SubdivisionOptions options;
+    EscapeStats* escapeStats = nullptr;
+
+    Tile origin;
+    uint32_t* rows = nullptr;
+    size_t rowStride = 0;
+    SubdivisionStats* counters = nullptr;
+    std::vector<uint8_t> known;
+    std::vector<int> queuedX, queuedY;
+    std::vector<float> pointX, pointY;
+    std::vector<uint32_t> results;
+    std::vector<Rect> current, next, probed;
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "double_float.h"
+#include "formulas.h"
+
+// Command line options shared by the three GPU renderers.
+struct RenderOptions {
+    bool headless = false;
+    int width = 1920;
+    int height = 1080;
+    double fps = 60.0;        // Frame clock rate used to derive iTime in headless mode
+    double startTime = 0.0;   // iTime of the first headless frame
+    long frames = 0;          // Number of headless frames, 0 = program default
+    int pboRing = 3;          // Pixel buffer objects in flight for readback
+    std::string output;       // printf pattern for PPM frames, "-" streams raw RGB to stdout
+    long shortcutStats = 0;   // Frames between interior shortcut counts, 0 = off
+    double paletteCycle = 0.0; // Palette rotations per second
+    bool smooth = false;      // Colour by smooth (continuous) iteration count
+    double targetMs = 0.0;    // Field time per frame to hold, 0 = always render in full
+    double minScale = 0.25;   // Lowest internal resolution the frame controller may pick
+    std::string profileCsv;   // Per-frame CPU/GPU section times as CSV
+    std::string profileTrace; // The same as a Chrome trace (JSON)
+    bool profileOverlay = false; // Draw a frame-time graph over the image
+    std::string video;        // Y4M output: file, "-" for stdout or "|command" for an encoder
+    int videoQueue = 8;       // Frames buffered between rendering and the video writer
+    FieldPrecision precision = FieldPrecision::Auto; // Float or double-float field kernels
+    Formula formula = Formula::Quadratic; // Iterated function the field shaders are specialized to
+    int edgeSamples = 0;      // Subsamples per edge pixel once a view is complete, 0 = off
+    double edgeThreshold = 2.0; // Iterations between neighbours that make a pixel an edge
+    std::string shaderCache;  // Program binary directory, "" = default, "off" = none
+    int maxIter = 0;          // Iteration budget (the ceiling when adaptive), 0 = program default
+    bool adaptiveIter = false; // Steer the budget by per-frame escape histograms
+    bool equalize = false;    // Histogram-equalized palette
+    int atlasColumns = 0;     // Julia atlas grid, 0 = no atlas
+    int atlasRows = 0;
+    int atlasCell = 64;       // Pixels per atlas cell side, a power of two
+    double atlasRange[4] = {-2.0, -1.25, 0.5, 1.25}; // c rectangle of the atlas: min x, min y, max x, max y
+    std::string atlasStats;   // Per-cell statistics as CSV
+    bool distanceEstimate = false; // Outline the set by estimated distance, fill far samples
+};
+
+inline void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --headless           Render offscreen (EGL surfaceless), no window\n"
+              << "  --size WxH           Framebuffer size in headless mode (default 1920x1080)\n"
+              << "  --fps N              Frame clock rate for iTime (default 60)\n"
+              << "  --start T            iTime of the first frame (default 0)\n"
+              << "  --frames N           Number of frames to render in headless mode\n"
+              << "  --pbo-ring N         Readback buffers in flight (default 3)\n"
+              << "  --out PATTERN        Write frames to PATTERN (e.g. out/frame_%05d.ppm),\n"
+              << "                       or '-' for raw RGB24 on stdout\n"
+              << "  --shortcut-stats N   Every N frames, print how many pixels the interior\n"
+              << "                       shortcuts resolved (stderr)\n"
+              << "  --palette-cycle R    Rotate the palette R times per second\n"
+              << "  --smooth             Colour by smooth iteration count instead of bands\n"
+              << "  --target-ms MS       Refine progressively and adapt resolution and iteration\n"
+              << "                       budget to hold MS of rendering per frame (mandelbrot)\n"
+              << "  --min-scale S        Lowest internal resolution for --target-ms (default 0.25)\n"
+              << "  --profile-csv PATH   Write per-frame CPU and GPU section times to PATH as CSV\n"
+              << "  --profile-trace PATH Write the same timings as a Chrome trace (JSON)\n"
+              << "  --overlay            Draw a CPU/GPU frame-time graph over the image\n"
+              << "  --video TARGET       Write the headless frames as Y4M video to a file, '-' for\n"
+              << "                       stdout or '|command' to pipe into an encoder\n"
+              << "  --video-queue N      Frames buffered for the video writer thread (default 8)\n"
+              << "  --precision MODE     Field kernels: float, double (double-float) or auto to switch\n"
+              << "                       on zoom (default auto; mandelbrot, julia)\n"
+              << "  --formula NAME       quadratic, multibrot3, multibrot4, multibrot5, burning-ship or\n"
+              << "                       tricorn (default quadratic)\n"
+              << "  --aa N               Supersample edge pixels of a complete view with N = 4, 9 or\n"
+              << "                       16 jittered samples (mandelbrot, julia)\n"
+              << "  --aa-threshold T     Iteration difference to a neighbour that makes an edge\n"
+              << "                       (default 2)\n"
+              << "  --shader-cache DIR   Keep linked shader programs in DIR, or 'off' (default\n"
+              << "                       ~/.cache/fractal-renderer)\n"
+              << "  --max-iter N         Iteration budget; with --adaptive-iter its ceiling\n"
+              << "                       (default 300, fractal 256; adaptive ceiling 4096)\n"
+              << "  --adaptive-iter      Raise or lower the budget from each frame's escape histogram\n"
+              << "  --equalize           Spread the palette evenly over the escaped pixels\n"
+              << "  --distance           Estimate the distance to the set: outline it, and fill\n"
+              << "                       samples far from it without iterating (mandelbrot, julia)\n"
+              << "  --atlas CxR          Render one headless frame of C x R Julia sets, one per c of\n"
+              << "                       --atlas-range, to --out (julia)\n"
+              << "  --atlas-range X0,Y0,X1,Y1\n"
+              << "                       c rectangle of the atlas (default -2,-1.25,0.5,1.25)\n"
+              << "  --atlas-cell N       Pixels per cell side, a power of two (default 64)\n"
+              << "  --atlas-stats PATH   Write per-cell escape statistics to PATH as CSV" << std::endl;
+}
+
+inline bool parseRenderOptions(int argc, char** argv, RenderOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                std::cerr << "Invalid --size, expected WxH" << std::endl;
+                return false;
+            }
+        } else if (arg == "--fps" && hasValue) {
+            options.fps = std::atof(argv[++i]);
+        } else if (arg == "--start" && hasValue) {
+            options.startTime = std::atof(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::atol(argv[++i]);
+        } else if (arg == "--pbo-ring" && hasValue) {
+            options.pboRing = std::atoi(argv[++i]);
+        } else if (arg == "--out" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--shortcut-stats" && hasValue) {
+            options.shortcutStats = std::atol(argv[++i]);
+        } else if (arg == "--palette-cycle" && hasValue) {
+            options.paletteCycle = std::atof(argv[++i]);
+        } else if (arg == "--smooth") {
+            options.smooth = true;
+        } else if (arg == "--target-ms" && hasValue) {
+            options.targetMs = std::atof(argv[++i]);
+        } else if (arg == "--min-scale" && hasValue) {
+            options.minScale = std::atof(argv[++i]);
+        } else if (arg == "--profile-csv" && hasValue) {
+            options.profileCsv = argv[++i];
+        } else if (arg == "--profile-trace" && hasValue) {
+            options.profileTrace = argv[++i];
+        } else if (arg == "--overlay") {
+            options.profileOverlay = true;
+        } else if (arg == "--video" && hasValue) {
+            options.video = argv[++i];
+        } else if (arg == "--video-queue" && hasValue) {
+            options.videoQueue = std::atoi(argv[++i]);
+        } else if (arg == "--precision" && hasValue) {
+            if (!parseFieldPrecision(argv[++i], options.precision)) {
+                std::cerr << "Unknown precision " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--formula" && hasValue) {
+            if (!parseFormula(argv[++i], options.formula)) {
+                std::cerr << "Unknown formula " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--aa" && hasValue) {
+            options.edgeSamples = std::atoi(argv[++i]);
+            if (options.edgeSamples != 4 && options.edgeSamples != 9 && options.edgeSamples != 16) {
+                std::cerr << "Invalid --aa, expected 4, 9 or 16" << std::endl;
+                return false;
+            }
+        } else if (arg == "--aa-threshold" && hasValue) {
+            options.edgeThreshold = std::atof(argv[++i]);
+            if (options.edgeThreshold < 0.0) {
+                std::cerr << "--aa-threshold must not be negative" << std::endl;
+                return false;
+            }
+        } else if (arg == "--shader-cache" && hasValue) {
+            options.shaderCache = argv[++i];
+        } else if (arg == "--max-iter" && hasValue) {
+            options.maxIter = std::atoi(argv[++i]);
+            if (options.maxIter < 1) {
+                std::cerr << "--max-iter must be positive" << std::endl;
+                return false;
+            }
+        } else if (arg == "--adaptive-iter") {
+            options.adaptiveIter = true;
+        } else if (arg == "--equalize") {
+            options.equalize = true;
+        } else if (arg == "--distance") {
+            options.distanceEstimate = true;
+        } else if (arg == "--atlas" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.atlasColumns, &options.atlasRows) != 2 ||
+                options.atlasColumns <= 0 || options.atlasRows <= 0) {
+                std::cerr << "Invalid --atlas, expected CxR" << std::endl;
+                return false;
+            }
+        } else if (arg == "--atlas-range" && hasValue) {
+            double* r = options.atlasRange;
+            if (std::sscanf(argv[++i], "%lf,%lf,%lf,%lf", &r[0], &r[1], &r[2], &r[3]) != 4 || r[0] >= r[2] ||
+                r[1] >= r[3]) {
+                std::cerr << "Invalid --atlas-range, expected X0,Y0,X1,Y1 with X0 < X1 and Y0 < Y1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--atlas-cell" && hasValue) {
+            options.atlasCell = std::atoi(argv[++i]);
+            if (options.atlasCell < 4 || options.atlasCell > 1024 || (options.atlasCell & (options.atlasCell - 1))) {
+                std::cerr << "--atlas-cell must be a power of two from 4 to 1024" << std::endl;
+                return false;
+            }
+        } else if (arg == "--atlas-stats" && hasValue) {
+            options.atlasStats = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options.fps <= 0.0 || options.pboRing < 1 || options.videoQueue < 1) {
+        std::cerr << "--fps, --pbo-ring and --video-queue must be positive" << std::endl;
+        return false;
+    }
+    if (options.output == "-" && options.video == "-") {
+        std::cerr << "--out and --video cannot both write to stdout" << std::endl;
+        return false;
+    }
+    // An atlas is one headless frame of the grid's size
+    if (options.atlasColumns > 0) {
+        if (options.atlasColumns > INT_MAX / options.atlasCell || options.atlasRows > INT_MAX / options.atlasCell) {
+            std::cerr << "--atlas " << options.atlasColumns << "x" << options.atlasRows << " with --atlas-cell "
+                      << options.atlasCell << " is too large a frame" << std::endl;
+            return false;
+        }
+        options.headless = true;
+        options.width = options.atlasColumns * options.atlasCell;
+        options.height = options.atlasRows * options.atlasCell;
+    }
+    // Nothing may create a context or a target for an empty frame
+    if (options.width <= 0 || options.height <= 0) {
+        std::cerr << "The frame size must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
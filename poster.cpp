@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "cpu_renderer.h"
+#include "escape_time.h"
+#include "scenes.h"
+#include "tiled_tiff.h"
+
+// Out-of-core poster renderer: renders one view of a shader scene at sizes
+// far beyond a framebuffer or RAM (e.g. 100000x100000) into a tiled BigTIFF.
+// Tiles are rendered in parallel and written straight into their slot of the
+// file, so memory use depends on the tile size and thread count only.
+
+struct PosterOptions {
+    SceneKind scene = SceneKind::Mandelbrot;
+    Formula formula = Formula::Quadratic;
+    int width = 16384;
+    int height = 16384;
+    double time = 30.0;       // iTime of the view; 30 is deep in mandelbrot.cpp's seahorse valley
+    SimdLevel simd = detectSimdLevel();
+    int threads = 0;          // 0 = one per hardware thread
+    int tileSize = 256;
+    bool pinThreads = false;
+    int maxIter = 0;          // 0 = the scene's MAX_ITER
+    bool interiorChecks = true;
+    bool deep = false;
+    bool subdivide = false;
+    SubdivisionOptions subdivision;
+    std::string centerRe;     // Fixed view centre as decimal strings, empty = the scene's at --time
+    std::string centerIm;
+    double zoom = 0.0;        // Fixed zoom, 0 = the scene's at --time
+    std::string output = "poster.tif";
+    bool resume = false;
+};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --scene NAME         mandelbrot, julia or fractal (default mandelbrot)\n"
+              << "  --formula NAME       quadratic, multibrot3, multibrot4, multibrot5, burning-ship or\n"
+              << "                       tricorn (default quadratic)\n"
+              << "  --size WxH           Poster size in pixels (default 16384x16384)\n"
+              << "  --time T             iTime of the view (default 30, the seahorse valley)\n"
+              << "  --simd LEVEL         scalar, sse2, avx2 or avx512 (default: widest supported)\n"
+              << "  --threads N          Worker threads (default: one per hardware thread)\n"
+              << "  --tile N             TIFF tile edge length, a multiple of 16 (default 256)\n"
+              << "  --pin                Pin worker threads to CPUs\n"
+              << "  --max-iter N         Override MAX_ITER\n"
+              << "  --no-interior-checks Disable cardioid/bulb and periodicity shortcuts\n"
+              << "  --subdivide          Fill rectangles with a uniform border instead of iterating them\n"
+              << "  --deep               Perturbation deep zoom with a high precision reference orbit\n"
+              << "  --center RE,IM       Fixed view centre, any number of decimal digits\n"
+              << "  --zoom Z             Fixed zoom factor instead of the scene's\n"
+              << "  --out PATH           Output BigTIFF (default poster.tif)\n"
+              << "  --resume             Continue an interrupted render of the same poster" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, PosterOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--scene" && hasValue) {
+            if (!parseSceneKind(argv[++i], options.scene)) {
+                std::cerr << "Unknown scene " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--formula" && hasValue) {
+            if (!parseFormula(argv[++i], options.formula)) {
+                std::cerr << "Unknown formula " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0) {
+                std::cerr << "Invalid --size, expected WxH" << std::endl;
+                return false;
+            }
+        } else if (arg == "--time" && hasValue) {
+            options.time = std::atof(argv[++i]);
+        } else if (arg == "--simd" && hasValue) {
+            if (!parseSimdLevel(argv[++i], options.simd)) {
+                std::cerr << "Unknown SIMD level " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::atoi(argv[++i]);
+        } else if (arg == "--tile" && hasValue) {
+            options.tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--pin") {
+            options.pinThreads = true;
+        } else if (arg == "--max-iter" && hasValue) {
+            options.maxIter = std::atoi(argv[++i]);
+        } else if (arg == "--no-interior-checks") {
+            options.interiorChecks = false;
+        } else if (arg == "--subdivide") {
+            options.subdivide = true;
+        } else if (arg == "--deep") {
+            options.deep = true;
+        } else if (arg == "--center" && hasValue) {
+            std::string center = argv[++i];
+            size_t comma = center.find(',');
+            if (comma == std::string::npos) {
+                std::cerr << "Invalid --center, expected RE,IM" << std::endl;
+                return false;
+            }
+            options.centerRe = center.substr(0, comma);
+            options.centerIm = center.substr(comma + 1);
+        } else if (arg == "--zoom" && hasValue) {
+            options.zoom = std::atof(argv[++i]);
+        } else if (arg == "--out" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--resume") {
+            options.resume = true;
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.tileSize < 16 || options.tileSize % 16 != 0) {
+        std::cerr << "--tile must be a positive multiple of 16" << std::endl;
+        return false;
+    }
+    if (options.deep && options.scene != SceneKind::Mandelbrot) {
+        std::cerr << "--deep is only available for the mandelbrot scene" << std::endl;
+        return false;
+    }
+    if (options.deep && options.formula != Formula::Quadratic) {
+        std::cerr << "--deep is only available for the quadratic formula" << std::endl;
+        return false;
+    }
+    if (options.deep && options.subdivide) {
+        std::cerr << "--subdivide cannot be combined with --deep" << std::endl;
+        return false;
+    }
+    if (options.simd > detectSimdLevel()) {
+        std::cerr << simdLevelName(options.simd) << " is not supported on this CPU" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Everything the pixels depend on; --resume only continues a file whose
+// description matches.
+std::string describe(const PosterOptions& options) {
+    // The centre has any number of digits, so only the fixed-width fields
+    // go through snprintf
+    char head[256];
+    std::snprintf(head, sizeof(head), "Fractals poster: scene=%s formula=%s size=%dx%d time=%.17g max-iter=%d "
+                  "interior=%d deep=%d subdivide=%d,%d,%d center=", sceneKindName(options.scene),
+                  formulaName(options.formula), options.width, options.height, options.time, options.maxIter,
+                  options.interiorChecks ? 1 : 0, options.deep ? 1 : 0, options.subdivide ? 1 : 0,
+                  options.subdivision.minSize, options.subdivision.filamentDwell);
+    char zoom[48];
+    std::snprintf(zoom, sizeof(zoom), " zoom=%.17g", options.zoom);
+    return head + options.centerRe + "," + options.centerIm + zoom;
+}
+
+int main(int argc, char** argv) {
+    PosterOptions options;
+    if (!parseOptions(argc, argv, options)) return -1;
+
+    Scene scene = makeScene(options.scene, (float)options.time, options.width, options.height);
+    if (options.maxIter > 0) scene.primary.maxIter = scene.secondary.maxIter = options.maxIter;
+    scene.primary.interiorChecks = scene.secondary.interiorChecks = options.interiorChecks;
+    scene.primary.formula = scene.secondary.formula = options.formula;
+    if (options.zoom > 0.0) scene.viewport.zoom = (float)std::min(options.zoom, 1e30);
+    if (!options.centerRe.empty()) {
+        scene.viewport.centerX = (float)std::atof(options.centerRe.c_str());
+        scene.viewport.centerY = (float)std::atof(options.centerIm.c_str());
+    }
+    DeepFrame deep;
+    double zoom = options.zoom > 0.0 ? options.zoom : std::exp(options.time * 0.13);
+    if (options.deep && !setupDeepFrame(scene, zoom, options.centerRe, options.centerIm, deep)) return -1;
+
+    TiledTiff tiff;
+    if (!tiff.open(options.output, options.width, options.height, options.tileSize, describe(options),
+                   options.resume))
+        return -1;
+
+    // Only the tiles an earlier run did not finish
+    std::vector<Tile> pending;
+    for (const Tile& tile : makeTiles(options.width, options.height, options.tileSize))
+        if (!tiff.tileDone(tile.index)) pending.push_back(tile);
+    size_t alreadyDone = tiff.tiles() - pending.size();
+
+    TileScheduler scheduler(options.threads, options.pinThreads);
+    std::printf("Rendering a %dx%d %s poster in %zu tiles of %d pixels (%zu already done) with %s kernels on "
+                "%d thread(s)\n", options.width, options.height, sceneKindName(options.scene), tiff.tiles(),
+                options.tileSize, alreadyDone, simdLevelName(options.simd), scheduler.threadCount());
+
+    RenderModes modes;
+    if (options.deep) modes.deep = &deep;
+    if (options.subdivide) modes.subdivision = &options.subdivision;
+    std::vector<TileScratch> scratch(scheduler.threadCount());
+    std::vector<WorkerStats> workerStats(scheduler.threadCount());
+    std::atomic<size_t> finished{0};
+    std::atomic<long> pixels{0};
+    std::atomic<bool> failed{false};
+    auto start = std::chrono::steady_clock::now();
+    size_t reportEvery = std::max<size_t>(1, pending.size() / 20);
+
+    scheduler.run(pending, [&](const Tile& tile, int worker) {
+        if (failed) return;
+        uint8_t* slot = tiff.mapTile(tile.index);
+        if (!slot) {
+            failed = true;
+            return;
+        }
+        // Slots are padded to whole tiles
+        renderTileRgb(scene, options.simd, modes, tile, slot, options.tileSize, scratch[worker],
+                      workerStats[worker]);
+        if (!tiff.finishTile(tile.index, slot)) failed = true;
+
+        pixels += (long)tile.width * tile.height;
+        size_t done = ++finished;
+        if (done % reportEvery == 0) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::printf("  %zu/%zu tiles, %.1f Mpixel/s\n", alreadyDone + done, tiff.tiles(),
+                        pixels / seconds / 1e6);
+            std::fflush(stdout);
+        }
+    });
+    if (!tiff.close() || failed) {
+        std::cerr << "Failed to write " << options.output << "; rerun with --resume to continue" << std::endl;
+        return -1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::printf("Rendered %zu tiles in %.1f s, peak resident memory %.1f MB\n", finished.load(), seconds,
+                usage.ru_maxrss / 1024.0);
+    return 0;
+}
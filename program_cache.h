@@ -0,0 +1,218 @@
+#pragma once
+
+// Shader programs for the GL renderers, linked once and kept on disk as
+// driver binaries (glGetProgramBinary), so later startups skip compiling.
+// A binary is named by a hash of both sources and the GL vendor, renderer
+// and version strings; one that the driver rejects anyway (an update that
+// kept the version string) is compiled again and replaced. Programs that
+// are not needed for the first frame can be requested instead: they are
+// linked by the driver's compiler threads (GL_KHR_parallel_shader_compile)
+// while the renderer keeps drawing with a program it already has.
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// The directory for --shader-cache: "off" for none, by default
+// $XDG_CACHE_HOME/fractal-renderer or ~/.cache/fractal-renderer.
+inline std::string programCacheDir(const std::string& option) {
+    if (option == "off") return "";
+    if (!option.empty()) return option;
+    const char* cache = std::getenv("XDG_CACHE_HOME");
+    if (cache && *cache) return std::string(cache) + "/fractal-renderer";
+    const char* home = std::getenv("HOME");
+    if (home && *home) return std::string(home) + "/.cache/fractal-renderer";
+    return "";
+}
+
+// A program being linked in the background; see ProgramCache::request().
+struct PendingProgram {
+    GLuint program = 0;
+    GLuint vertexShader = 0;
+    GLuint fragmentShader = 0;
+    std::string path;         // Where its binary goes once linked
+    bool done = false;
+};
+
+class ProgramCache {
+public:
+    // dir "" keeps programs in memory only. Needs a current context.
+    void create(const std::string& cacheDir) {
+        dir = cacheDir;
+        GLint formats = 0;
+        if (GLEW_ARB_get_program_binary || GLEW_VERSION_4_1)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0) dir.clear();
+        if (!dir.empty()) makeDirectories(dir);
+
+        driver = std::string(glString(GL_VENDOR)) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for (GLint i = 0; i < extensions; i++) {
+            const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                         std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+                parallel = true;
+        }
+    }
+
+    void destroy() {
+        if (loaded + compiled == 0) return;
+        std::fprintf(stderr, "program cache: %d loaded, %d compiled (%s)%s\n", loaded, compiled,
+                     dir.empty() ? "not stored" : dir.c_str(), parallel ? ", parallel compile" : "");
+    }
+
+    // The linked program, from disk if possible, otherwise compiled now.
+    GLuint program(const char* vertexSource, const char* fragmentSource) {
+        PendingProgram pending = request(vertexSource, fragmentSource);
+        finish(pending, true);
+        return pending.program;
+    }
+
+    // Starts linking a program. A cached one is done at once; otherwise the
+    // driver compiles in the background where it can, and finish() tells
+    // when the program is usable.
+    PendingProgram request(const char* vertexSource, const char* fragmentSource) {
+        PendingProgram pending;
+        if (!dir.empty()) pending.path = binaryPath(vertexSource, fragmentSource);
+        pending.program = glCreateProgram();
+        if (!pending.path.empty() && loadBinary(pending.program, pending.path)) {
+            loaded++;
+            pending.done = true;
+            return pending;
+        }
+
+        pending.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(pending.vertexShader, 1, &vertexSource, nullptr);
+        glCompileShader(pending.vertexShader);
+        pending.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(pending.fragmentShader, 1, &fragmentSource, nullptr);
+        glCompileShader(pending.fragmentShader);
+        glAttachShader(pending.program, pending.vertexShader);
+        glAttachShader(pending.program, pending.fragmentShader);
+        if (!dir.empty()) glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(pending.program);
+        return pending;
+    }
+
+    // Whether the program is linked, reporting compile errors and storing
+    // its binary the first time. Without wait, a program still compiling
+    // returns false; without the parallel compile extension the driver
+    // cannot say, and this waits.
+    bool finish(PendingProgram& pending, bool wait) {
+        if (pending.done) return true;
+        if (!wait && parallel) {
+            GLint complete = GL_FALSE;
+            glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &complete);
+            if (!complete) return false;
+        }
+        pending.done = true;
+        compiled++;
+        bool ok = checkShader(pending.vertexShader, "VERTEX") & checkShader(pending.fragmentShader, "FRAGMENT");
+        GLint linked = GL_FALSE;
+        glGetProgramiv(pending.program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            GLchar infoLog[1024];
+            glGetProgramInfoLog(pending.program, 1024, nullptr, infoLog);
+            std::cout << "Program Linking Error:\n" << infoLog << std::endl;
+        }
+        glDeleteShader(pending.vertexShader);
+        glDeleteShader(pending.fragmentShader);
+        pending.vertexShader = pending.fragmentShader = 0;
+        if (ok && linked && !pending.path.empty()) storeBinary(pending.program, pending.path);
+        return true;
+    }
+
+private:
+    static const char* glString(GLenum name) {
+        const char* value = (const char*)glGetString(name);
+        return value ? value : "";
+    }
+
+    static bool checkShader(GLuint shader, const char* type) {
+        GLint success;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (success) return true;
+        GLchar infoLog[1024];
+        glGetShaderInfoLog(shader, 1024, nullptr, infoLog);
+        std::cout << "Shader Compilation Error (" << type << "):\n" << infoLog << std::endl;
+        return false;
+    }
+
+    static void makeDirectories(const std::string& path) {
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+            mkdir(path.substr(0, slash).c_str(), 0755);
+        mkdir(path.c_str(), 0755);
+    }
+
+    std::string binaryPath(const char* vertexSource, const char* fragmentSource) const {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const std::string& part : {driver, std::string(vertexSource), std::string(fragmentSource)}) {
+            for (unsigned char c : part + '\0') {
+                hash ^= c;
+                hash *= 0x100000001b3ull;
+            }
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)hash);
+        return dir + name;
+    }
+
+    // A file holds the binary format and the binary.
+    static bool loadBinary(GLuint program, const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        uint32_t format = 0;
+        std::vector<char> binary;
+        bool ok = std::fread(&format, sizeof(format), 1, file) == 1;
+        char buffer[65536];
+        size_t n;
+        while (ok && (n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) binary.insert(binary.end(), buffer, buffer + n);
+        std::fclose(file);
+        if (!ok || binary.empty()) return false;
+
+        glProgramBinary(program, (GLenum)format, binary.data(), (GLsizei)binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        return linked == GL_TRUE;
+    }
+
+    // Written to a temporary file and renamed, so another instance never
+    // loads a partial binary.
+    static void storeBinary(GLuint program, const std::string& path) {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+        std::string temporary = path + ".tmp" + std::to_string((long)getpid());
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file) return;
+        uint32_t format32 = format;
+        bool ok = std::fwrite(&format32, sizeof(format32), 1, file) == 1 &&
+                  std::fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (ok) ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+        if (!ok) std::remove(temporary.c_str());
+    }
+
+    std::string dir;
+    std::string driver;
+    bool parallel = false;
+    int loaded = 0;
+    int compiled = 0;
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+// CPU mirrors of the main() functions of the three fragment shaders: the
+// animated viewport and Julia constant for a given iTime, and the palette /
+// interior pattern colouring applied to the iteration counts.
+
+#include <cmath>
+#include <cstdint>
+
+#include "escape_time.h"
+
+enum class SceneKind { Mandelbrot, Julia, Fractal };
+
+inline const char* sceneKindName(SceneKind kind) {
+    switch (kind) {
+        case SceneKind::Julia: return "julia";
+        case SceneKind::Fractal: return "fractal";
+        default: return "mandelbrot";
+    }
+}
+
+inline bool parseSceneKind(const char* name, SceneKind& kind) {
+    for (SceneKind k : {SceneKind::Mandelbrot, SceneKind::Julia, SceneKind::Fractal}) {
+        if (std::string(name) == sceneKindName(k)) {
+            kind = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Rgb {
+    float r, g, b;
+};
+
+inline Rgb mix(Rgb a, Rgb b, float t) {
+    return { a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t };
+}
+
+// Color palette from Color Hunt: #FEF9E1, #E5D0AC, #A31D1D, #6D2323
+struct Palette {
+    Rgb colors[4];
+
+    Rgb operator()(float t) const {
+        if (t < 0.25f) return mix(colors[0], colors[1], t * 4.0f);
+        else if (t < 0.5f) return mix(colors[1], colors[2], (t - 0.25f) * 4.0f);
+        else if (t < 0.75f) return mix(colors[2], colors[3], (t - 0.5f) * 4.0f);
+        else return mix(colors[3], colors[0], (t - 0.75f) * 4.0f);
+    }
+};
+
+const Palette kWarmPalette = {{
+    {0.996f, 0.976f, 0.882f}, {0.898f, 0.816f, 0.675f}, {0.639f, 0.114f, 0.114f}, {0.427f, 0.137f, 0.137f}
+}};
+// julia.cpp starts the palette from a dark red instead of #FEF9E1
+const Palette kJuliaPalette = {{
+    {0.11f, 0.0f, 0.0f}, {0.898f, 0.816f, 0.675f}, {0.639f, 0.114f, 0.114f}, {0.427f, 0.137f, 0.137f}
+}};
+
+struct Scene {
+    SceneKind kind = SceneKind::Mandelbrot;
+    Viewport viewport;
+    EscapeParams primary;     // The Mandelbrot layer (Julia layer in julia.cpp)
+    EscapeParams secondary;   // Julia layer blended in by fractal.cpp
+    float blend = 0.0f;       // mix() weight of the secondary layer
+    float time = 0.0f;
+};
+
+inline float smoothEaseInOut(float t) {
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Viewport and fractal parameters of the given program at iTime = time.
+// cameraX/cameraY is the iCenter uniform of fractal.cpp.
+inline Scene makeScene(SceneKind kind, float time, int width, int height,
+                       float cameraX = 0.15f, float cameraY = 0.0f) {
+    Scene scene;
+    scene.kind = kind;
+    scene.time = time;
+    scene.viewport.width = width;
+    scene.viewport.height = height;
+
+    if (kind == SceneKind::Mandelbrot) {
+        scene.viewport.zoom = std::exp(time * 0.13f);
+        scene.viewport.centerX = -0.745428f + 0.01f * std::sin(time * 0.15f);
+        scene.viewport.centerY = 0.131825f + 0.01f * std::cos(time * 0.1f);
+        scene.viewport.heightScale = 0.2f;
+        scene.primary.kind = FractalKind::Mandelbrot;
+        scene.primary.maxIter = 300;
+    } else if (kind == SceneKind::Julia) {
+        scene.viewport.zoom = std::exp(time * 0.09f);
+        scene.primary.kind = FractalKind::Julia;
+        scene.primary.juliaX = -0.8f + 0.02f * std::sin(time * 0.15f);
+        scene.primary.juliaY = 0.156f + 0.02f * std::cos(time * 0.1f);
+        scene.primary.maxIter = 300;
+    } else {
+        float totalTime = 125.0f;
+        float phase = std::fmod(time, totalTime) / totalTime;
+        float zoomInDuration = 80.0f;
+        float zoomOutDuration = 45.0f;
+        float maxZoom = 10.0f;
+        float baseZoom = 0.5f;
+        float zoom;
+        if (phase < (zoomInDuration / totalTime)) {
+            float zoomPhase = smoothEaseInOut(phase / (zoomInDuration / totalTime));
+            zoom = baseZoom + zoomPhase * (maxZoom - baseZoom);
+        } else {
+            float zoomPhase = smoothEaseInOut((phase - zoomInDuration / totalTime) / (zoomOutDuration / totalTime));
+            zoom = maxZoom - zoomPhase * (maxZoom - baseZoom);
+        }
+        scene.viewport.zoom = zoom;
+        scene.viewport.centerX = cameraX;
+        scene.viewport.centerY = cameraY;
+        scene.primary.kind = FractalKind::Mandelbrot;
+        scene.primary.maxIter = 256;
+        scene.secondary.kind = FractalKind::Julia;
+        scene.secondary.juliaX = -0.8f;
+        scene.secondary.juliaY = 0.156f;
+        scene.secondary.maxIter = 256;
+        scene.blend = (std::sin(time * 0.2f) + 1.0f) * 0.4f;
+    }
+    return scene;
+}
+
+// The view centre of the mandelbrot and julia scenes in double precision,
+// for the double-float kernels; the float viewport rounds it to about 1e-8.
+inline void sceneCenter(SceneKind kind, double time, double& x, double& y) {
+    x = y = 0.0;
+    if (kind == SceneKind::Mandelbrot) {
+        x = -0.745428 + 0.01 * std::sin(time * 0.15);
+        y = 0.131825 + 0.01 * std::cos(time * 0.1);
+    }
+}
+
+// recursiveFractal() of mandelbrot.cpp / julia.cpp: the interior pattern
+// layered over pixels that reach MAX_ITER (shadePixel tests primaryIter >= maxIter).
+inline float recursiveFractal(const EscapeParams& params, float x, float y, float scale) {
+    static const float mandelbrotLayers[6][2] = {
+        {1.0f, 0.95f}, {2.0f, 0.8f}, {4.0f, 0.6f}, {6.0f, 0.4f}, {8.0f, 0.3f}, {10.0f, 0.1f}
+    };
+    static const float juliaLayers[4][2] = {
+        {1.0f, 0.8f}, {2.0f, 0.5f}, {4.0f, 0.3f}, {6.0f, 0.1f}
+    };
+    bool julia = params.kind == FractalKind::Julia;
+    const float (*layers)[2] = julia ? juliaLayers : mandelbrotLayers;
+    int layerCount = julia ? 4 : 6;
+
+    float fractal = 0.0f;
+    for (int i = 0; i < layerCount; i++) {
+        float sx = x * scale * layers[i][0];
+        float sy = y * scale * layers[i][0];
+        fractal += (float)escapePoint(params, sx, sy) / params.maxIter * layers[i][1];
+    }
+    return fractal;
+}
+
+inline void storeRgb(Rgb color, uint8_t* rgb) {
+    auto channel = [](float v) {
+        v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        return (uint8_t)std::lround(v * 255.0f);
+    };
+    rgb[0] = channel(color.r);
+    rgb[1] = channel(color.g);
+    rgb[2] = channel(color.b);
+}
+
+// Colours one pixel from its iteration counts, as the shader main() does.
+inline Rgb shadePixel(const Scene& scene, int x, int row, uint32_t primaryIter, uint32_t secondaryIter) {
+    if (scene.kind == SceneKind::Fractal) {
+        float mandelbrotVal = (float)primaryIter / scene.primary.maxIter;
+        float juliaVal = (float)secondaryIter / scene.secondary.maxIter;
+        float blendedVal = mandelbrotVal + (juliaVal - mandelbrotVal) * scene.blend;
+        return kWarmPalette(blendedVal);
+    }
+
+    const Palette& palette = scene.kind == SceneKind::Julia ? kJuliaPalette : kWarmPalette;
+    float t = (float)primaryIter / scene.primary.maxIter;
+    Rgb color = palette(t);
+
+    // Add recursive fractal patterns inside the boundary: points a shortcut
+    // proved interior or that reached the budget, for which the kernels
+    // return maxIter
+    if (primaryIter >= (uint32_t)scene.primary.maxIter) {
+        float px = scene.viewport.pixelX((float)x);
+        float py = scene.viewport.pixelY((float)row);
+        float innerFractal = recursiveFractal(scene.primary, px, py, 2.0f);
+        float outline = innerFractal * 15.0f;
+        float outlineFactor = outline - std::floor(outline);
+        Rgb innerColor = mix({0.427f, 0.137f, 0.137f}, {0.996f, 0.976f, 0.882f}, outlineFactor);
+        color = mix(color, innerColor, 0.95f);
+    }
+    return color;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Building shader variants from source text. A variant is the base shader
+// with #defines and helper functions inserted right after its #version
+// line, which GLSL requires to come first. Variants of variants stack: the
+// text of the one applied last comes first.
+
+#include <string>
+
+// source with text inserted at the start of the line after #version (after
+// the first line if there is none).
+inline std::string insertAfterVersion(const std::string& source, const std::string& text) {
+    std::string result = source;
+    size_t version = result.find("#version");
+    size_t lineEnd = result.find('\n', version == std::string::npos ? 0 : version);
+    result.insert(lineEnd == std::string::npos ? result.size() : lineEnd + 1, text);
+    return result;
+}
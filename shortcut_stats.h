@@ -0,0 +1,88 @@
+#pragma once
+
+// Counts the pixels resolved by the interior shortcuts of the fragment
+// shaders. Every `interval` frames the frame's draw is repeated once per
+// shortcut with colour writes off and iShortcutProbe set, so only fragments
+// resolved by that shortcut survive and a GL_SAMPLES_PASSED query counts
+// them. Results are read on the next probe, so the queries never stall.
+
+#include <GL/glew.h>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ShortcutProbe {
+public:
+    // Each shortcut is the iShortcutProbe value the shader uses for it and a name.
+    void create(GLuint shaderProgram, const std::vector<std::pair<GLint, std::string>>& probeShortcuts,
+                long probeInterval) {
+        program = shaderProgram;
+        shortcuts = probeShortcuts;
+        interval = probeInterval;
+        probeLocation = glGetUniformLocation(program, "iShortcutProbe");
+        queries.resize(shortcuts.size());
+        if (interval > 0) glGenQueries((GLsizei)queries.size(), queries.data());
+    }
+
+    // Probes with another variant of the shader from now on.
+    void setProgram(GLuint shaderProgram) {
+        if (shaderProgram == program) return;
+        program = shaderProgram;
+        probeLocation = glGetUniformLocation(program, "iShortcutProbe");
+    }
+
+    void destroy() {
+        if (interval > 0) {
+            report();
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+        }
+        queries.clear();
+    }
+
+    // Call after the frame's regular draw; draw() repeats its draw call.
+    void update(long frame, int width, int height, const std::function<void()>& draw) {
+        if (interval <= 0 || frame % interval != 0) return;
+        report();
+
+        glUseProgram(program);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (size_t i = 0; i < queries.size(); i++) {
+            glUniform1i(probeLocation, shortcuts[i].first);
+            glBeginQuery(GL_SAMPLES_PASSED, queries[i]);
+            draw();
+            glEndQuery(GL_SAMPLES_PASSED);
+        }
+        glUniform1i(probeLocation, 0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        pendingFrame = frame;
+        pendingPixels = (double)width * height;
+    }
+
+private:
+    void report() {
+        if (pendingFrame < 0) return;
+        std::string line;
+        char entry[128];
+        for (size_t i = 0; i < queries.size(); i++) {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &samples);
+            std::snprintf(entry, sizeof(entry), "%s%s %u (%.1f%%)", i ? ", " : "", shortcuts[i].second.c_str(),
+                          samples, 100.0 * samples / pendingPixels);
+            line += entry;
+        }
+        // stderr, so that frames streamed to stdout stay intact
+        std::fprintf(stderr, "frame %ld interior shortcuts: %s\n", pendingFrame, line.c_str());
+        pendingFrame = -1;
+    }
+
+    GLuint program = 0;
+    GLint probeLocation = -1;
+    long interval = 0;
+    std::vector<std::pair<GLint, std::string>> shortcuts;
+    std::vector<GLuint> queries;
+    long pendingFrame = -1;
+    double pendingPixels = 1.0;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+// Frame-to-frame reuse of iteration counts. Consecutive frames of the zoom
+// animations differ by a zoom factor of about 1.002, so most pixels of a new
+// frame sit almost exactly on a sample of the previous one. The cache keeps
+// every pixel's count together with the complex coordinate it was actually
+// sampled at; a new pixel reuses the nearest previous sample when that
+// coordinate is within the error budget of the new pixel and the sample's
+// 3x3 neighbourhood shares its count (so it is not on a band edge). A reused
+// value keeps its original sample coordinate, so the error cannot creep up
+// over many frames.
+
+#include <cstdint>
+#include <vector>
+
+#include "scenes.h"
+
+struct ReuseStats {
+    long reused = 0;
+    long missing = 0;      // No previous sample (first frame, parameters changed, or outside the old view)
+    long coarse = 0;       // Nearest previous sample further away than the budget allows
+    long edge = 0;         // Nearest previous sample next to an iteration count change
+
+    long recomputed() const { return missing + coarse + edge; }
+
+    ReuseStats& operator+=(const ReuseStats& other) {
+        reused += other.reused;
+        missing += other.missing;
+        coarse += other.coarse;
+        edge += other.edge;
+        return *this;
+    }
+};
+
+class TemporalCache {
+public:
+    // budget is the largest distance between a new pixel and the sample it
+    // reuses, in new pixels. 0 disables reuse.
+    explicit TemporalCache(double budget = 0.0) : budget(budget) {}
+
+    bool enabled() const { return budget > 0.0; }
+
+    // Call before rendering a frame. Any change that alters the counts at a
+    // given coordinate (Julia c, MAX_ITER, frame size...) drops the history.
+    void begin(const Scene& scene) {
+        const Viewport& view = scene.viewport;
+        valid = hasHistory && previous.width == view.width && previous.height == view.height &&
+                samePoints(previousScene.primary, scene.primary) &&
+                (scene.kind != SceneKind::Fractal || samePoints(previousScene.secondary, scene.secondary)) &&
+                previousScene.kind == scene.kind;
+
+        size_t pixels = (size_t)view.width * view.height;
+        next.resize(pixels);
+        current = view;
+        pixelSize = 1.0 / ((double)view.height * view.heightScale * view.zoom);
+        maxError2 = budget * pixelSize * budget * pixelSize;
+        previousScale = (double)previous.height * previous.heightScale * previous.zoom;
+        previousScene = scene;
+    }
+
+    // Looks up the pixel at (x, row) of the new frame; on success fills in
+    // both layers' counts and records them for the next frame. On failure
+    // dwellHint is the nearest previous count (0 if there is none), which
+    // callers can use to batch similar pixels together.
+    bool reuse(int x, int row, uint32_t& primary, uint32_t& secondary, uint32_t& dwellHint, ReuseStats& stats) {
+        dwellHint = 0;
+        if (!valid) {
+            stats.missing++;
+            return false;
+        }
+        // The pixel centre in double; the float rounding of pixelX is far below any useful budget
+        double px = (x + 0.5 - 0.5 * current.width) * pixelSize + current.centerX;
+        double py = (0.5 * current.height - row - 0.5) * pixelSize + current.centerY;
+        // Inverse of Viewport::pixelX/pixelY for the previous view
+        double fx = (px - previous.centerX) * previousScale + 0.5 * previous.width - 0.5;
+        double fy = 0.5 * previous.height - 0.5 - (py - previous.centerY) * previousScale;
+        // Anything below 1 is rejected, so truncation works as floor here
+        if (fx < 1.0 || fy < 1.0) {
+            stats.missing++;
+            return false;
+        }
+        long x0 = (long)fx, y0 = (long)fy;
+        if (x0 >= previous.width - 2 || y0 >= previous.height - 2) {
+            stats.missing++;
+            return false;
+        }
+
+        // Closest of the four previous samples around the pixel. Reused
+        // samples keep their original coordinate, so this is not always the
+        // one nearest in the grid.
+        long ix = x0, iy = y0;
+        double best = 0.0;
+        for (long sy = y0; sy <= y0 + 1; sy++) {
+            for (long sx = x0; sx <= x0 + 1; sx++) {
+                const Sample& sample = history[(size_t)sy * previous.width + sx];
+                double dx = px - sample.x, dy = py - sample.y;
+                double error = dx * dx + dy * dy;
+                if ((sx == x0 && sy == y0) || error < best) {
+                    best = error;
+                    ix = sx;
+                    iy = sy;
+                }
+            }
+        }
+        const Sample& source = history[(size_t)iy * previous.width + ix];
+        dwellHint = (uint32_t)source.counts;
+        if (best > maxError2) {
+            stats.coarse++;
+            return false;
+        }
+        for (long ny = iy - 1; ny <= iy + 1; ny++) {
+            const Sample* neighbours = &history[(size_t)ny * previous.width + ix - 1];
+            if (neighbours[0].counts != source.counts || neighbours[1].counts != source.counts ||
+                neighbours[2].counts != source.counts) {
+                stats.edge++;
+                return false;
+            }
+        }
+
+        primary = (uint32_t)source.counts;
+        secondary = (uint32_t)(source.counts >> 32);
+        next[(size_t)row * current.width + x] = source;
+        stats.reused++;
+        return true;
+    }
+
+    // Records a freshly computed pixel and the coordinate it was sampled at.
+    void store(int x, int row, float sampleX, float sampleY, uint32_t primary, uint32_t secondary) {
+        next[(size_t)row * current.width + x] = {sampleX, sampleY, packCounts(primary, secondary)};
+    }
+
+    // Call once the frame is complete; its samples become the history.
+    void end() {
+        std::swap(history, next);
+        previous = current;
+        hasHistory = true;
+    }
+
+private:
+    struct Sample {
+        float x, y;
+        uint64_t counts;    // Primary layer in the low half, secondary in the high half
+    };
+
+    static uint64_t packCounts(uint32_t primary, uint32_t secondary) {
+        return primary | (uint64_t)secondary << 32;
+    }
+
+    static bool samePoints(const EscapeParams& a, const EscapeParams& b) {
+        return a.kind == b.kind && a.formula == b.formula && a.maxIter == b.maxIter &&
+               a.interiorChecks == b.interiorChecks &&
+               (a.kind != FractalKind::Julia || (a.juliaX == b.juliaX && a.juliaY == b.juliaY));
+    }
+
+    double budget;
+    bool hasHistory = false;
+    bool valid = false;
+    Viewport previous;
+    Viewport current;
+    Scene previousScene;
+    double pixelSize = 1.0;
+    double previousScale = 1.0;
+    double maxError2 = 0.0;
+    std::vector<Sample> history;
+    std::vector<Sample> next;
+};
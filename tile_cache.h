@@ -0,0 +1,297 @@
+#pragma once
+
+// Iteration-field tile pyramid for the tile server. Level z splits the
+// fractal's 4 x 4 home square into 2^z x 2^z tiles of kTileSize pixels
+// (XYZ order: x to the right, y downwards). Tiles store iteration counts
+// rather than colours, so they can be recoloured freely, and live in two
+// cache tiers: an LRU of decoded tiles in memory and a content-addressed
+// directory of run-length coded tiles on disk, keyed by a hash of
+// everything the counts depend on.
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "escape_time.h"
+
+constexpr int kTileSize = 256;
+// Pixel coordinates are floats, which resolve tiles down to about this level
+constexpr int kMaxTileZoom = 18;
+
+struct TileKey {
+    FractalKind kind = FractalKind::Mandelbrot;
+    float juliaX = 0.0f;
+    float juliaY = 0.0f;
+    int maxIter = 300;
+    int z = 0;
+    long x = 0;
+    long y = 0;
+
+    bool valid() const {
+        long count = 1L << z;
+        return z >= 0 && z <= kMaxTileZoom && x >= 0 && y >= 0 && x < count && y < count && maxIter > 0 &&
+               maxIter <= 65535;
+    }
+
+    // Everything the counts depend on, as the cache's identity
+    std::string canonical() const {
+        char text[160];
+        if (kind == FractalKind::Julia) {
+            std::snprintf(text, sizeof(text), "julia c=%a,%a iter=%d size=%d %d/%ld/%ld", juliaX, juliaY, maxIter,
+                          kTileSize, z, x, y);
+        } else {
+            std::snprintf(text, sizeof(text), "mandelbrot iter=%d size=%d %d/%ld/%ld", maxIter, kTileSize, z, x, y);
+        }
+        return text;
+    }
+
+    // Complex coordinate of the tile's top left corner and the pixel size
+    void origin(double& re, double& im, double& pixel) const {
+        double centerRe = kind == FractalKind::Mandelbrot ? -0.75 : 0.0;
+        double span = 4.0 / (double)(1L << z);
+        re = centerRe - 2.0 + x * span;
+        im = 2.0 - y * span;
+        pixel = span / kTileSize;
+    }
+
+    EscapeParams params() const {
+        EscapeParams params;
+        params.kind = kind;
+        params.juliaX = juliaX;
+        params.juliaY = juliaY;
+        params.maxIter = maxIter;
+        return params;
+    }
+};
+
+// kTileSize x kTileSize counts, rows top-down
+using TileCounts = std::vector<uint16_t>;
+using TilePtr = std::shared_ptr<const TileCounts>;
+
+inline TilePtr computeTile(const TileKey& key, SimdLevel simd) {
+    auto counts = std::make_shared<TileCounts>((size_t)kTileSize * kTileSize);
+    double re0, im0, pixel;
+    key.origin(re0, im0, pixel);
+    EscapeParams params = key.params();
+    // Coordinates are computed in double and rounded once, so neighbouring
+    // tiles agree along their seams
+    std::vector<float> xs(kTileSize), ys(kTileSize);
+    std::vector<uint32_t> iters(kTileSize);
+    for (int x = 0; x < kTileSize; x++) xs[x] = (float)(re0 + (x + 0.5) * pixel);
+    for (int row = 0; row < kTileSize; row++) {
+        ys.assign(kTileSize, (float)(im0 - (row + 0.5) * pixel));
+        escapePoints(params, xs.data(), ys.data(), kTileSize, iters.data(), simd);
+        for (int x = 0; x < kTileSize; x++) (*counts)[(size_t)row * kTileSize + x] = (uint16_t)iters[x];
+    }
+    return counts;
+}
+
+// Run-length coding of a tile as (count, run length) uint16 pairs; bands and
+// the interior make long runs.
+inline void encodeTile(const TileCounts& counts, std::vector<uint8_t>& out) {
+    out.clear();
+    auto put16 = [&](uint32_t v) {
+        out.push_back((uint8_t)v);
+        out.push_back((uint8_t)(v >> 8));
+    };
+    for (size_t i = 0; i < counts.size();) {
+        size_t run = 1;
+        while (i + run < counts.size() && counts[i + run] == counts[i] && run < 65535) run++;
+        put16(counts[i]);
+        put16((uint32_t)run);
+        i += run;
+    }
+}
+
+inline bool decodeTile(const uint8_t* data, size_t size, TileCounts& counts) {
+    counts.clear();
+    size_t expected = (size_t)kTileSize * kTileSize;
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint16_t value = (uint16_t)(data[i] | data[i + 1] << 8);
+        size_t run = (size_t)(data[i + 2] | data[i + 3] << 8);
+        if (counts.size() + run > expected) return false;
+        counts.insert(counts.end(), run, value);
+    }
+    return counts.size() == expected;
+}
+
+inline uint64_t fnv1a64(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Tiles on disk at dir/ab/abcdef0123456789.tile, named by the hash of the
+// key. A file starts with its canonical key, so a hash collision reads as
+// a miss rather than a wrong tile.
+class DiskTileCache {
+public:
+    explicit DiskTileCache(std::string dir) : dir(std::move(dir)) { mkdir(this->dir.c_str(), 0755); }
+
+    bool load(const TileKey& key, TileCounts& counts) const {
+        std::string path, subdir;
+        locate(key, path, subdir);
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        std::vector<uint8_t> data;
+        uint8_t buffer[65536];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + n);
+        std::fclose(file);
+
+        std::string header = key.canonical() + "\n";
+        if (data.size() < header.size() || std::string(data.begin(), data.begin() + header.size()) != header)
+            return false;
+        return decodeTile(data.data() + header.size(), data.size() - header.size(), counts);
+    }
+
+    // Writes to a temporary file and renames it, so readers never see a
+    // partial tile.
+    bool store(const TileKey& key, const TileCounts& counts) const {
+        std::string path, subdir;
+        locate(key, path, subdir);
+        mkdir(subdir.c_str(), 0755);
+        std::vector<uint8_t> encoded;
+        encodeTile(counts, encoded);
+        std::string header = key.canonical() + "\n";
+
+        std::string temporary = path + ".tmp" + std::to_string((long)getpid()) + "_" +
+                                std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file) return false;
+        bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size() &&
+                  std::fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (ok) ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+        if (!ok) std::remove(temporary.c_str());
+        return ok;
+    }
+
+private:
+    void locate(const TileKey& key, std::string& path, std::string& subdir) const {
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)fnv1a64(key.canonical()));
+        subdir = dir + "/" + std::string(hex, 2);
+        path = subdir + "/" + hex + ".tile";
+    }
+
+    std::string dir;
+};
+
+// Most recently used decoded tiles.
+class LruTileCache {
+public:
+    explicit LruTileCache(size_t capacity) : capacity(capacity) {}
+
+    TilePtr get(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end()) return nullptr;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void put(const std::string& key, TilePtr tile) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(tile);
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+        entries.emplace_front(key, std::move(tile));
+        index[key] = entries.begin();
+        if (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    bool contains(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.count(key) != 0;
+    }
+
+private:
+    size_t capacity;
+    std::list<std::pair<std::string, TilePtr>> entries;
+    std::unordered_map<std::string, std::list<std::pair<std::string, TilePtr>>::iterator> index;
+    std::mutex mutex;
+};
+
+// Where a tile request was answered from
+enum class TileSource { Memory, Disk, Computed };
+
+// Memory, then disk, then computation. Concurrent requests for a tile that
+// is being computed wait for that computation instead of repeating it.
+class TileStore {
+public:
+    TileStore(const std::string& cacheDir, size_t memoryTiles, SimdLevel simd)
+        : memory(memoryTiles), disk(cacheDir), simd(simd) {}
+
+    TilePtr get(const TileKey& key, TileSource* source = nullptr) {
+        std::string id = key.canonical();
+        if (TilePtr tile = memory.get(id)) {
+            if (source) *source = TileSource::Memory;
+            return tile;
+        }
+
+        std::promise<TilePtr> promise;
+        std::shared_future<TilePtr> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = inFlight.find(id);
+            if (it != inFlight.end()) {
+                pending = it->second;
+            } else {
+                inFlight[id] = promise.get_future().share();
+            }
+        }
+        if (pending.valid()) {
+            if (source) *source = TileSource::Memory;
+            return pending.get();
+        }
+
+        auto counts = std::make_shared<TileCounts>();
+        TileSource from = TileSource::Disk;
+        TilePtr tile;
+        if (disk.load(key, *counts)) {
+            tile = counts;
+        } else {
+            from = TileSource::Computed;
+            tile = computeTile(key, simd);
+            disk.store(key, *tile);
+        }
+        memory.put(id, tile);
+        promise.set_value(tile);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inFlight.erase(id);
+        }
+        if (source) *source = from;
+        return tile;
+    }
+
+    bool inMemory(const TileKey& key) { return memory.contains(key.canonical()); }
+
+private:
+    LruTileCache memory;
+    DiskTileCache disk;
+    SimdLevel simd;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_future<TilePtr>> inFlight;
+};
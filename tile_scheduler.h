@@ -0,0 +1,297 @@
+#pragma once
+
+// Tile-parallel CPU rendering. Escape-time cost varies by orders of magnitude
+// across a frame (interior pixels run to MAX_ITER and then through
+// recursiveFractal), so tiles are dealt out in contiguous runs to per-thread
+// deques and idle workers steal from the far end of a busy worker's deque.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+constexpr size_t kCacheLine = 64;
+
+// Heap array whose storage starts on a cache line boundary.
+template <typename T>
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t count) { resize(count); }
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    AlignedBuffer(AlignedBuffer&& other) noexcept { *this = std::move(other); }
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+        std::swap(ptr, other.ptr);
+        std::swap(count, other.count);
+        return *this;
+    }
+    ~AlignedBuffer() { std::free(ptr); }
+
+    void resize(size_t n) {
+        if (n == count) return;
+        std::free(ptr);
+        size_t bytes = (n * sizeof(T) + kCacheLine - 1) / kCacheLine * kCacheLine;
+        ptr = n ? (T*)std::aligned_alloc(kCacheLine, bytes) : nullptr;
+        if (n && !ptr) throw std::bad_alloc();
+        count = n;
+    }
+
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) { return ptr[i]; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+
+private:
+    T* ptr = nullptr;
+    size_t count = 0;
+};
+
+struct Tile {
+    int index = 0;
+    int x0 = 0;
+    int y0 = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Splits a frame into tileSize x tileSize tiles in row-major order; edge tiles are clipped.
+inline std::vector<Tile> makeTiles(int width, int height, int tileSize) {
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            Tile tile;
+            tile.index = (int)tiles.size();
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.width = std::min(tileSize, width - x);
+            tile.height = std::min(tileSize, height - y);
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+// Per-tile blocks of a frame-sized field. Every tile and every row inside a
+// tile starts on its own cache line, so workers writing neighbouring tiles
+// never share a line.
+template <typename T>
+class TiledBuffer {
+public:
+    void resize(int w, int h, int tile) {
+        width = w;
+        height = h;
+        tileSize = tile;
+        tilesX = (w + tile - 1) / tile;
+        tilesY = (h + tile - 1) / tile;
+        size_t perLine = kCacheLine / sizeof(T);
+        stride = (tile + perLine - 1) / perLine * perLine;
+        data.resize((size_t)tilesX * tilesY * tile * stride);
+    }
+
+    T* tileRow(const Tile& t, int localRow) {
+        return data.data() + ((size_t)t.index * tileSize + localRow) * stride;
+    }
+    const T* tileRow(const Tile& t, int localRow) const {
+        return data.data() + ((size_t)t.index * tileSize + localRow) * stride;
+    }
+
+    // Distance in elements between consecutive rows of a tile.
+    size_t rowStride() const { return stride; }
+
+    // Gathers the blocks into a row-major width x height array.
+    void copyTo(std::vector<T>& linear) const {
+        linear.resize((size_t)width * height);
+        for (const Tile& t : makeTiles(width, height, tileSize))
+            for (int row = 0; row < t.height; row++)
+                std::memcpy(&linear[(size_t)(t.y0 + row) * width + t.x0], tileRow(t, row), t.width * sizeof(T));
+    }
+
+    int width = 0;
+    int height = 0;
+    int tileSize = 0;
+
+private:
+    int tilesX = 0;
+    int tilesY = 0;
+    size_t stride = 0;
+    AlignedBuffer<T> data;
+};
+
+// Persistent pool of workers with one deque each. The calling thread takes
+// part as worker 0, so a scheduler with one thread runs everything inline.
+class TileScheduler {
+public:
+    using TileFunction = std::function<void(const Tile& tile, int worker)>;
+
+    explicit TileScheduler(int threads = 0, bool pinThreads = false)
+        : queues(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+          pin(pinThreads) {
+        if (pin) pinCurrentThread(0);
+        for (int i = 1; i < threadCount(); i++) workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~TileScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            stopping = true;
+        }
+        batchReady.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    int threadCount() const { return (int)queues.size(); }
+
+    // Tiles taken from another worker's deque during the last run().
+    long lastSteals() const { return steals.load(); }
+
+    // Runs fn on every tile and returns once all of them are done.
+    void run(const std::vector<Tile>& tiles, const TileFunction& fn) {
+        if (tiles.empty()) return;
+        // Contiguous runs keep neighbouring (similar-cost) tiles on one worker;
+        // imbalance between runs is what stealing fixes up.
+        size_t threads = queues.size();
+        for (size_t w = 0; w < threads; w++) {
+            size_t begin = tiles.size() * w / threads;
+            size_t end = tiles.size() * (w + 1) / threads;
+            std::lock_guard<std::mutex> lock(queues[w].mutex);
+            for (size_t i = begin; i < end; i++) queues[w].tiles.push_back((int)i);
+        }
+
+        steals = 0;
+        remaining = (long)tiles.size();
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            batchTiles = &tiles;
+            batchFunction = &fn;
+            generation++;
+        }
+        batchReady.notify_all();
+
+        drain(0, tiles, fn);
+
+        std::unique_lock<std::mutex> lock(batchMutex);
+        batchDone.wait(lock, [this] { return remaining.load() == 0 && busyWorkers == 0; });
+        batchTiles = nullptr;
+        batchFunction = nullptr;
+    }
+
+private:
+    struct alignas(kCacheLine) WorkQueue {
+        std::mutex mutex;
+        std::deque<int> tiles;
+    };
+
+    void workerLoop(int worker) {
+        if (pin) pinCurrentThread(worker);
+        long seen = 0;
+        for (;;) {
+            const std::vector<Tile>* tiles;
+            const TileFunction* fn;
+            {
+                std::unique_lock<std::mutex> lock(batchMutex);
+                batchReady.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                // Woke up after the batch already finished
+                if (!batchTiles) continue;
+                tiles = batchTiles;
+                fn = batchFunction;
+                busyWorkers++;
+            }
+            drain(worker, *tiles, *fn);
+            {
+                std::lock_guard<std::mutex> lock(batchMutex);
+                busyWorkers--;
+            }
+            batchDone.notify_all();
+        }
+    }
+
+    // Pops from the back of the own deque, then steals from the front of
+    // others. Tiles are never re-queued, so once every deque is empty the
+    // remaining tiles are already running elsewhere and the worker can stop.
+    void drain(int worker, const std::vector<Tile>& tiles, const TileFunction& fn) {
+        int threads = threadCount();
+        int tile;
+        while (popOwn(worker, tile) || steal(worker, threads, tile)) {
+            fn(tiles[tile], worker);
+            remaining--;
+        }
+    }
+
+    bool popOwn(int worker, int& tile) {
+        WorkQueue& queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tiles.empty()) return false;
+        tile = queue.tiles.back();
+        queue.tiles.pop_back();
+        return true;
+    }
+
+    bool steal(int thief, int threads, int& tile) {
+        for (int offset = 1; offset < threads; offset++) {
+            WorkQueue& victim = queues[(thief + offset) % threads];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tiles.empty()) continue;
+            tile = victim.tiles.front();
+            victim.tiles.pop_front();
+            steals++;
+            return true;
+        }
+        return false;
+    }
+
+    static void pinCurrentThread(int worker) {
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+        int cpuCount = CPU_COUNT(&allowed);
+        if (cpuCount == 0) return;
+        // Map worker i to the i-th CPU this process may run on
+        int target = worker % cpuCount;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            if (target-- == 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+                return;
+            }
+        }
+#else
+        (void)worker;
+#endif
+    }
+
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+    bool pin = false;
+
+    std::mutex batchMutex;
+    std::condition_variable batchReady;
+    std::condition_variable batchDone;
+    const std::vector<Tile>* batchTiles = nullptr;
+    const TileFunction* batchFunction = nullptr;
+    long generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+
+    std::atomic<long> remaining{0};
+    std::atomic<long> steals{0};
+};
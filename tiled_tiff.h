@@ -0,0 +1,244 @@
+#pragma once
+
+// Uncompressed, tiled RGB BigTIFF written in place. Every tile has a fixed,
+// page aligned slot in the file, so finished tiles are written straight
+// through a short-lived memory mapping of their slot and the image never
+// has to exist in memory as a whole. A tile's TileByteCounts entry is only
+// set once its data has been synced to disk, so the file itself records
+// which tiles are done and an interrupted render can be resumed from it.
+// The offset and byte count arrays follow the header; an image of a single
+// tile has none, as BigTIFF keeps values of up to 8 bytes in the IFD entry
+// itself, and its offset and byte count live there.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class TiledTiff {
+public:
+    ~TiledTiff() { close(); }
+
+    // Creates path for a width x height image of tileSize tiles (a multiple
+    // of 16). With resume an existing file is reopened if it was started
+    // with the same layout and description; its finished tiles are kept.
+    bool open(const std::string& path, int w, int h, int tile, const std::string& description, bool resume) {
+        width = w;
+        height = h;
+        tileSize = tile;
+        tilesAcross = (width + tileSize - 1) / tileSize;
+        tilesDown = (height + tileSize - 1) / tileSize;
+        tileCount = (size_t)tilesAcross * tilesDown;
+        pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        tileBytes = (size_t)tileSize * tileSize * 3;
+        slotBytes = roundUp(tileBytes);
+
+        std::vector<uint8_t> header = buildHeader(description);
+        bool inlineTable = tileCount == 1;
+        arrayBytes = inlineTable ? 0 : roundUp(tileCount * 16);
+        dataOffset = header.size() + arrayBytes;
+        uint64_t fileBytes = dataOffset + tileCount * slotBytes;
+        // Where the offsets and byte counts are, in the mapped table: the
+        // header with its IFD or the arrays after it
+        tableOffset = inlineTable ? 0 : header.size();
+        tableBytes = inlineTable ? header.size() : arrayBytes;
+        offsetsAt = inlineTable ? entryValueAt(kTileOffsetsEntry) : 0;
+        countsAt = inlineTable ? entryValueAt(kTileByteCountsEntry) : tileCount * 8;
+
+        bool reuse = false;
+        if (resume) {
+            fd = ::open(path.c_str(), O_RDWR);
+            if (fd >= 0) {
+                std::vector<uint8_t> existing(header.size());
+                struct stat info;
+                reuse = pread(fd, existing.data(), existing.size(), 0) == (ssize_t)existing.size() &&
+                        fstat(fd, &info) == 0 && (uint64_t)info.st_size == fileBytes;
+                // An inline byte count is the tile's progress, not settings
+                if (reuse && inlineTable) {
+                    uint64_t count = readValue(existing.data() + countsAt);
+                    if (count == 0 || count == tileBytes) writeValue(header.data() + countsAt, count);
+                }
+                reuse = reuse && existing == header;
+                if (!reuse) {
+                    std::cerr << path << " was started with different settings; remove it or drop --resume"
+                              << std::endl;
+                    return false;
+                }
+            }
+        }
+        if (!reuse) {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            // The tile slots stay sparse until they are written
+            if (fd < 0 || ftruncate(fd, (off_t)fileBytes) != 0 ||
+                pwrite(fd, header.data(), header.size(), 0) != (ssize_t)header.size()) {
+                std::cerr << "Failed to create " << path << std::endl;
+                return false;
+            }
+        }
+
+        void* mapped = mmap(nullptr, tableBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)tableOffset);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "Failed to map " << path << std::endl;
+            return false;
+        }
+        table = (uint8_t*)mapped;
+        if (!reuse)
+            for (size_t i = 0; i < tileCount; i++) writeValue(table + offsetsAt + i * 8, dataOffset + i * slotBytes);
+        return true;
+    }
+
+    size_t tiles() const { return tileCount; }
+    bool tileDone(size_t index) const { return readValue(table + countsAt + index * 8) != 0; }
+
+    // Maps the slot of tile index: tileSize rows of tileSize RGB pixels.
+    // Edge tiles are padded to the full tile size, as TIFF requires.
+    uint8_t* mapTile(size_t index) const {
+        void* data = mmap(nullptr, slotBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                          (off_t)(dataOffset + index * slotBytes));
+        return data == MAP_FAILED ? nullptr : (uint8_t*)data;
+    }
+
+    // Unmaps a written tile and marks it done. Tiles are synced in batches;
+    // only synced tiles are marked, so a marked tile is always complete.
+    bool finishTile(size_t index, uint8_t* data) {
+        munmap(data, slotBytes);
+        std::vector<size_t> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            unsynced.push_back(index);
+            if (unsynced.size() < kSyncBatch) return true;
+            batch.swap(unsynced);
+        }
+        return publish(batch);
+    }
+
+    // Syncs and marks the remaining tiles and closes the file.
+    bool close() {
+        if (fd < 0) return true;
+        bool ok = publish(unsynced);
+        unsynced.clear();
+        ok = msync(table, tableBytes, MS_SYNC) == 0 && ok;
+        munmap(table, tableBytes);
+        ok = ::close(fd) == 0 && ok;
+        fd = -1;
+        return ok;
+    }
+
+private:
+    // Tiles written between data syncs (about 50 MB of 256 x 256 tiles)
+    static constexpr size_t kSyncBatch = 256;
+    // IFD entries of the tile offsets and byte counts
+    static constexpr int kTileOffsetsEntry = 10;
+    static constexpr int kTileByteCountsEntry = 11;
+
+    // File offset of the value field of IFD entry index: after the 16 byte
+    // header, the 8 byte entry count, the entries before it and its tag,
+    // type and count.
+    static size_t entryValueAt(int index) { return 16 + 8 + (size_t)index * 20 + 12; }
+
+    // Values of the table, little-endian like the host; an inline one is
+    // not 8 byte aligned.
+    static uint64_t readValue(const uint8_t* at) {
+        uint64_t value;
+        std::memcpy(&value, at, 8);
+        return value;
+    }
+    static void writeValue(uint8_t* at, uint64_t value) { std::memcpy(at, &value, 8); }
+
+    size_t roundUp(size_t bytes) const { return (bytes + pageSize - 1) / pageSize * pageSize; }
+
+    bool publish(const std::vector<size_t>& batch) {
+        if (batch.empty()) return true;
+        if (fdatasync(fd) != 0) {
+            std::cerr << "Failed to sync the output file" << std::endl;
+            return false;
+        }
+        for (size_t index : batch) writeValue(table + countsAt + index * 8, tileBytes);
+        return true;
+    }
+
+    // Little-endian BigTIFF header, one IFD and the description, padded to
+    // a page; the tile offset and byte count arrays follow it, or for a
+    // single tile the tile itself, whose offset and (so far zero) byte
+    // count are inline.
+    std::vector<uint8_t> buildHeader(const std::string& description) const {
+        std::vector<uint8_t> bytes;
+        auto put = [&](uint64_t value, int size) {
+            for (int i = 0; i < size; i++) bytes.push_back((uint8_t)(value >> (8 * i)));
+        };
+        enum { kShort = 3, kLong = 4, kAscii = 2, kLong8 = 16 };
+        struct Entry {
+            uint16_t tag;
+            uint16_t type;
+            uint64_t count;
+            uint64_t value;
+        };
+
+        const int entryCount = 12;
+        uint64_t ifdBytes = 8 + entryCount * 20 + 8;
+        uint64_t descriptionOffset = 16 + ifdBytes;
+        uint64_t headerBytes = roundUp(descriptionOffset + description.size() + 1);
+        uint64_t arrays = headerBytes;
+        uint64_t counts = tileCount == 1 ? 0 : arrays + tileCount * 8;
+        const Entry entries[entryCount] = {
+            {256, kLong, 1, (uint64_t)width},                          // ImageWidth
+            {257, kLong, 1, (uint64_t)height},                         // ImageLength
+            {258, kShort, 3, 8 | (8ull << 16) | (8ull << 32)},         // BitsPerSample 8, 8, 8
+            {259, kShort, 1, 1},                                       // Compression: none
+            {262, kShort, 1, 2},                                       // PhotometricInterpretation: RGB
+            {270, kAscii, description.size() + 1, descriptionOffset},  // ImageDescription
+            {277, kShort, 1, 3},                                       // SamplesPerPixel
+            {284, kShort, 1, 1},                                       // PlanarConfiguration: chunky
+            {322, kLong, 1, (uint64_t)tileSize},                       // TileWidth
+            {323, kLong, 1, (uint64_t)tileSize},                       // TileLength
+            {324, kLong8, tileCount, arrays},                          // TileOffsets
+            {325, kLong8, tileCount, counts},                          // TileByteCounts
+        };
+
+        put('I' | ('I' << 8), 2);   // Little-endian
+        put(43, 2);                 // BigTIFF
+        put(8, 2);                  // Offset size
+        put(0, 2);
+        put(16, 8);                 // First IFD
+        put(entryCount, 8);
+        for (const Entry& entry : entries) {
+            put(entry.tag, 2);
+            put(entry.type, 2);
+            put(entry.count, 8);
+            put(entry.value, 8);
+        }
+        put(0, 8);
+        bytes.insert(bytes.end(), description.begin(), description.end());
+        bytes.resize(headerBytes, 0);
+        return bytes;
+    }
+
+    int width = 0;
+    int height = 0;
+    int tileSize = 0;
+    int tilesAcross = 0;
+    int tilesDown = 0;
+    size_t tileCount = 0;
+    size_t pageSize = 4096;
+    size_t tileBytes = 0;
+    size_t slotBytes = 0;
+    size_t arrayBytes = 0;
+    uint64_t dataOffset = 0;
+    uint64_t tableOffset = 0;
+    size_t tableBytes = 0;
+    size_t offsetsAt = 0;
+    size_t countsAt = 0;
+
+    int fd = -1;
+    uint8_t* table = nullptr;
+    std::mutex mutex;
+    std::vector<size_t> unsynced;
+};
@@ -0,0 +1,139 @@
+// Writes tiled BigTIFFs with TiledTiff, as poster does, and reads them back
+// with an independent IFD reader: a single-tile image (whose tile offset and
+// byte count are inline in the IFD), a multi-tile one, and the resume check
+// of both. Exits non-zero on the first mismatch.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "tiled_tiff.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+// Pixel value of channel c at (x, y) of the test pattern
+static uint8_t pattern(int x, int y, int c) {
+    return (uint8_t)(x * 7 + y * 13 + c * 101);
+}
+
+static bool writeImage(const std::string& path, int width, int height, int tileSize, bool resume) {
+    TiledTiff tiff;
+    if (!tiff.open(path, width, height, tileSize, "tiled_tiff_test", resume)) return false;
+    int tilesAcross = (width + tileSize - 1) / tileSize;
+    for (size_t index = 0; index < tiff.tiles(); index++) {
+        if (tiff.tileDone(index)) continue;
+        uint8_t* slot = tiff.mapTile(index);
+        if (!slot) return false;
+        int x0 = (int)(index % tilesAcross) * tileSize;
+        int y0 = (int)(index / tilesAcross) * tileSize;
+        for (int y = 0; y < tileSize; y++)
+            for (int x = 0; x < tileSize; x++)
+                for (int c = 0; c < 3; c++) slot[((size_t)y * tileSize + x) * 3 + c] = pattern(x0 + x, y0 + y, c);
+        if (!tiff.finishTile(index, slot)) return false;
+    }
+    return tiff.close();
+}
+
+static uint64_t readLe(const std::vector<uint8_t>& file, uint64_t at, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) value |= (uint64_t)file[at + i] << (8 * i);
+    return value;
+}
+
+// Values of a LONG or LONG8 entry, inline if they fit in its 8 bytes
+static std::vector<uint64_t> entryValues(const std::vector<uint8_t>& file, uint64_t entry) {
+    int type = (int)readLe(file, entry + 2, 2);
+    uint64_t count = readLe(file, entry + 4, 8);
+    int size = type == 16 ? 8 : type == 4 ? 4 : 2;
+    uint64_t at = count * size <= 8 ? entry + 12 : readLe(file, entry + 12, 8);
+    std::vector<uint64_t> values;
+    for (uint64_t i = 0; i < count; i++) values.push_back(readLe(file, at + i * size, size));
+    return values;
+}
+
+static void checkImage(const std::string& path, int width, int height, int tileSize) {
+    std::vector<uint8_t> file;
+    FILE* in = std::fopen(path.c_str(), "rb");
+    CHECK(in != nullptr);
+    if (!in) return;
+    uint8_t buffer[65536];
+    size_t got;
+    while ((got = std::fread(buffer, 1, sizeof(buffer), in)) > 0) file.insert(file.end(), buffer, buffer + got);
+    std::fclose(in);
+
+    CHECK(readLe(file, 0, 2) == ('I' | ('I' << 8)) && readLe(file, 2, 2) == 43);
+    uint64_t ifd = readLe(file, 8, 8);
+    uint64_t entries = readLe(file, ifd, 8);
+    std::vector<uint64_t> imageWidth, imageLength, tileWidth, offsets, byteCounts;
+    for (uint64_t i = 0; i < entries; i++) {
+        uint64_t entry = ifd + 8 + i * 20;
+        switch (readLe(file, entry, 2)) {
+            case 256: imageWidth = entryValues(file, entry); break;
+            case 257: imageLength = entryValues(file, entry); break;
+            case 322: tileWidth = entryValues(file, entry); break;
+            case 324: offsets = entryValues(file, entry); break;
+            case 325: byteCounts = entryValues(file, entry); break;
+        }
+    }
+    size_t tilesAcross = (width + tileSize - 1) / tileSize;
+    size_t tileCount = tilesAcross * ((height + tileSize - 1) / tileSize);
+    size_t tileBytes = (size_t)tileSize * tileSize * 3;
+    CHECK(imageWidth.size() == 1 && imageWidth[0] == (uint64_t)width);
+    CHECK(imageLength.size() == 1 && imageLength[0] == (uint64_t)height);
+    CHECK(tileWidth.size() == 1 && tileWidth[0] == (uint64_t)tileSize);
+    CHECK(offsets.size() == tileCount && byteCounts.size() == tileCount);
+    if (offsets.size() != tileCount || byteCounts.size() != tileCount) return;
+
+    for (size_t index = 0; index < tileCount; index++) {
+        CHECK(byteCounts[index] == tileBytes);
+        CHECK(offsets[index] + tileBytes <= file.size());
+        if (byteCounts[index] != tileBytes || offsets[index] + tileBytes > file.size()) continue;
+        int x0 = (int)(index % tilesAcross) * tileSize;
+        int y0 = (int)(index / tilesAcross) * tileSize;
+        bool same = true;
+        for (int y = 0; y < tileSize; y++)
+            for (int x = 0; x < tileSize; x++)
+                for (int c = 0; c < 3; c++)
+                    same = same && file[offsets[index] + ((size_t)y * tileSize + x) * 3 + c] ==
+                                       pattern(x0 + x, y0 + y, c);
+        CHECK(same);
+    }
+}
+
+static void roundTrip(int width, int height, int tileSize) {
+    char path[] = "/tmp/tiled_tiff_test_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+    ::close(fd);
+    CHECK(writeImage(path, width, height, tileSize, false));
+    checkImage(path, width, height, tileSize);
+    // A finished file resumes with every tile done and is left as it was
+    CHECK(writeImage(path, width, height, tileSize, true));
+    checkImage(path, width, height, tileSize);
+    std::remove(path);
+}
+
+int main() {
+    roundTrip(200, 150, 256);  // One tile: offset and byte count inline
+    roundTrip(600, 300, 256);  // 3 x 2 tiles: offset and byte count arrays
+    roundTrip(256, 256, 256);  // One full tile
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("tiled_tiff_test: all checks passed\n");
+    return 0;
+}
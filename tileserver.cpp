@@ -0,0 +1,471 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "escape_time.h"
+#include "image.h"
+#include "scenes.h"
+#include "tile_cache.h"
+
+// Local tile server for exploring the Mandelbrot and Julia sets in any
+// XYZ map viewer. Tiles are iteration fields cached in memory and on disk
+// (tile_cache.h) and coloured per request, so palette changes never
+// recompute anything. Tiles ahead of the viewer's pan direction and one
+// level deeper are prefetched in the background.
+//
+//   GET /                                   minimal built-in viewer
+//   GET /mandelbrot/{z}/{x}/{y}.png         coloured tile
+//   GET /julia/{z}/{x}/{y}.png?c=RE,IM      Julia set of c
+//   GET /{fractal}/{z}/{x}/{y}.tile         run-length coded counts
+//   GET /stats                              cache statistics as JSON
+//
+// Tile query parameters: iter=N (MAX_ITER), shift=S (palette offset),
+// palette=warm|julia, pattern=0 (no interior pattern).
+
+struct ServerOptions {
+    std::string bind = "127.0.0.1";
+    int port = 8080;
+    std::string cacheDir = "tile-cache";
+    size_t memoryTiles = 1024;  // 128 KB each
+    int prefetchThreads = 1;    // 0 = no prefetching
+    int maxIter = 300;          // Default MAX_ITER, as in the shaders
+    SimdLevel simd = detectSimdLevel();
+};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --bind ADDRESS       Address to listen on (default 127.0.0.1)\n"
+              << "  --port N             Port to listen on (default 8080)\n"
+              << "  --cache DIR          Disk cache directory (default tile-cache)\n"
+              << "  --memory-tiles N     Tiles kept in the memory cache (default 1024, 128 KB each)\n"
+              << "  --prefetch-threads N Background prefetch workers, 0 disables prefetching (default 1)\n"
+              << "  --max-iter N         Default MAX_ITER of tiles without iter= (default 300)\n"
+              << "  --simd LEVEL         scalar, sse2, avx2 or avx512 (default: widest supported)" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, ServerOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--bind" && hasValue) {
+            options.bind = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            options.port = std::atoi(argv[++i]);
+        } else if (arg == "--cache" && hasValue) {
+            options.cacheDir = argv[++i];
+        } else if (arg == "--memory-tiles" && hasValue) {
+            options.memoryTiles = (size_t)std::max(1L, std::atol(argv[++i]));
+        } else if (arg == "--prefetch-threads" && hasValue) {
+            options.prefetchThreads = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--max-iter" && hasValue) {
+            options.maxIter = std::atoi(argv[++i]);
+        } else if (arg == "--simd" && hasValue) {
+            if (!parseSimdLevel(argv[++i], options.simd)) {
+                std::cerr << "Unknown SIMD level " << argv[i] << std::endl;
+                return false;
+            }
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.port <= 0 || options.port > 65535 || options.maxIter < 1 || options.maxIter > 65535) {
+        std::cerr << "--port must be 1-65535 and --max-iter 1-65535" << std::endl;
+        return false;
+    }
+    if (options.simd > detectSimdLevel()) {
+        std::cerr << simdLevelName(options.simd) << " is not supported on this CPU" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct ServerStats {
+    std::atomic<long> requests{0};
+    std::atomic<long> memoryHits{0};
+    std::atomic<long> diskHits{0};
+    std::atomic<long> computed{0};
+    std::atomic<long> prefetched{0};
+};
+
+// Follows each client's view and queues the tiles it is likely to ask for
+// next: the neighbours along its pan direction and the tile's children one
+// level deeper. A viewer requests the tiles of a view in bursts, so the pan
+// direction is taken from the drift of the running mean of its requests.
+class Prefetcher {
+public:
+    Prefetcher(TileStore& store, ServerStats& stats, int threads) : store(store), stats(stats) {
+        for (int i = 0; i < threads; i++) workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    void observe(const std::string& client, const TileKey& key) {
+        if (workers.empty()) return;
+        std::vector<TileKey> ahead;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Motion& motion = clients[client];
+            double x = key.x + 0.5, y = key.y + 0.5;
+            if (motion.z != key.z || motion.kind != key.kind) {
+                motion = {key.z, key.kind, x, y, 0.0, 0.0};
+            } else {
+                double meanX = motion.x * 0.8 + x * 0.2, meanY = motion.y * 0.8 + y * 0.2;
+                motion.vx = motion.vx * 0.7 + (meanX - motion.x) * 0.3;
+                motion.vy = motion.vy * 0.7 + (meanY - motion.y) * 0.3;
+                motion.x = meanX;
+                motion.y = meanY;
+            }
+
+            if (key.z < kMaxTileZoom) {
+                for (int child = 0; child < 4; child++) {
+                    TileKey next = key;
+                    next.z = key.z + 1;
+                    next.x = key.x * 2 + (child & 1);
+                    next.y = key.y * 2 + (child >> 1);
+                    ahead.push_back(next);
+                }
+            }
+            double speed = std::hypot(motion.vx, motion.vy);
+            if (speed > 0.05) {
+                long dx = std::lround(motion.vx / speed), dy = std::lround(motion.vy / speed);
+                for (int step = 2; step >= 1; step--) {
+                    TileKey next = key;
+                    next.x += dx * step;
+                    next.y += dy * step;
+                    ahead.push_back(next);
+                }
+            }
+
+            // Newest first: what the viewer looks at now matters most
+            for (const TileKey& next : ahead) {
+                if (!next.valid()) continue;
+                queue.push_front(next);
+                if (queue.size() > kMaxQueued) queue.pop_back();
+            }
+        }
+        wake.notify_all();
+    }
+
+private:
+    static constexpr size_t kMaxQueued = 256;
+
+    struct Motion {
+        int z = -1;
+        FractalKind kind = FractalKind::Mandelbrot;
+        double x = 0.0, y = 0.0;    // Running mean of requested tile centres
+        double vx = 0.0, vy = 0.0;  // Its drift per request
+    };
+
+    void workerLoop() {
+        for (;;) {
+            TileKey key;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) return;
+                key = queue.front();
+                queue.pop_front();
+            }
+            if (store.inMemory(key)) continue;
+            TileSource source;
+            store.get(key, &source);
+            if (source != TileSource::Memory) stats.prefetched++;
+        }
+    }
+
+    TileStore& store;
+    ServerStats& stats;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<TileKey> queue;
+    std::unordered_map<std::string, Motion> clients;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+};
+
+// Colours a tile like the shaders: palette(count / MAX_ITER), with the
+// recursive interior pattern where the count reached the budget.
+void colourTile(const TileKey& key, const TileCounts& counts, const Palette& palette, double shift, bool pattern,
+                Image& image) {
+    image.resize(kTileSize, kTileSize);
+    double re0, im0, pixel;
+    key.origin(re0, im0, pixel);
+    EscapeParams params = key.params();
+    for (int row = 0; row < kTileSize; row++) {
+        for (int x = 0; x < kTileSize; x++) {
+            uint32_t count = counts[(size_t)row * kTileSize + x];
+            float t = (float)count / key.maxIter;
+            float u = t + (float)shift;
+            Rgb color = palette(shift != 0.0 ? u - std::floor(u) : t);
+            if (pattern && count >= (uint32_t)key.maxIter) {
+                float px = (float)(re0 + (x + 0.5) * pixel);
+                float py = (float)(im0 - (row + 0.5) * pixel);
+                float outline = recursiveFractal(params, px, py, 2.0f) * 15.0f;
+                Rgb inner = mix({0.427f, 0.137f, 0.137f}, {0.996f, 0.976f, 0.882f}, outline - std::floor(outline));
+                color = mix(color, inner, 0.95f);
+            }
+            storeRgb(color, image.pixel(x, row));
+        }
+    }
+}
+
+const char* kViewerPage = R"(<!DOCTYPE html>
+<html><head><title>Fractal tiles</title><style>
+body { margin: 0; overflow: hidden; background: #000; }
+#map { position: absolute; inset: 0; cursor: grab; }
+#map img { position: absolute; width: 256px; height: 256px; image-rendering: pixelated; }
+</style></head><body><div id="map"></div><script>
+// Drag to pan, wheel to zoom; the URL hash keeps the view
+const map = document.getElementById('map');
+const query = location.search;
+const base = location.pathname.replace(/\/?$/, '/');
+let [z, cx, cy] = (location.hash.slice(1) || '1,1,1').split(',').map(Number);
+function draw() {
+  map.replaceChildren();
+  const n = 1 << z, w = map.clientWidth, h = map.clientHeight;
+  const left = cx * 256 - w / 2, top = cy * 256 - h / 2;
+  for (let ty = Math.floor(top / 256); ty * 256 < top + h; ty++)
+    for (let tx = Math.floor(left / 256); tx * 256 < left + w; tx++) {
+      if (tx < 0 || ty < 0 || tx >= n || ty >= n) continue;
+      const img = new Image();
+      img.src = `${base}${z}/${tx}/${ty}.png${query}`;
+      img.style.left = (tx * 256 - left) + 'px';
+      img.style.top = (ty * 256 - top) + 'px';
+      map.appendChild(img);
+    }
+  location.hash = [z, cx.toFixed(6), cy.toFixed(6)].join(',');
+}
+let drag = null;
+map.onmousedown = e => drag = [e.clientX, e.clientY];
+onmouseup = () => drag = null;
+onmousemove = e => {
+  if (!drag) return;
+  cx -= (e.clientX - drag[0]) / 256; cy -= (e.clientY - drag[1]) / 256;
+  drag = [e.clientX, e.clientY]; draw();
+};
+map.onwheel = e => {
+  e.preventDefault();
+  const step = e.deltaY < 0 ? 1 : -1;
+  if (z + step < 0 || z + step > 18) return;
+  z += step; cx *= 2 ** step; cy *= 2 ** step; draw();
+};
+onresize = draw;
+if (location.pathname === '/') location.pathname = '/mandelbrot/';
+else draw();
+</script></body></html>
+)";
+
+bool sendAll(int socket, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t sent = send(socket, bytes, size, 0);
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+void respond(int socket, int status, const char* contentType, const void* body, size_t size,
+             const std::string& extraHeaders = "") {
+    const char* reason = status == 200 ? "OK" : status == 404 ? "Not Found" : "Bad Request";
+    char header[512];
+    int length = std::snprintf(header, sizeof(header),
+                               "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                               "Access-Control-Allow-Origin: *\r\nConnection: close\r\n%s\r\n",
+                               status, reason, contentType, size, extraHeaders.c_str());
+    if (sendAll(socket, header, (size_t)length)) sendAll(socket, body, size);
+}
+
+void respondText(int socket, int status, const std::string& text) {
+    respond(socket, status, "text/plain", text.data(), text.size());
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (size_t end; (end = text.find(separator, start)) != std::string::npos; start = end + 1)
+        parts.push_back(text.substr(start, end - start));
+    parts.push_back(text.substr(start));
+    return parts;
+}
+
+// Whole-string decimal integer; "", "12a" and out of range values fail, so a
+// malformed URL cannot alias a real tile.
+bool parseLong(const std::string& text, long& value) {
+    if (text.empty() || !(std::isdigit((unsigned char)text[0]) || text[0] == '-')) return false;
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtol(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+void handleConnection(int socket, const std::string& client, const ServerOptions& options, TileStore& store,
+                      Prefetcher& prefetcher, ServerStats& stats) {
+    std::string request;
+    char buffer[4096];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16384) {
+        ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        request.append(buffer, (size_t)received);
+    }
+    std::vector<std::string> line = split(request.substr(0, request.find("\r\n")), ' ');
+    if (line.size() < 2 || line[0] != "GET") {
+        respondText(socket, 400, "Only GET is supported\n");
+        return;
+    }
+    stats.requests++;
+
+    std::string target = line[1];
+    std::map<std::string, std::string> query;
+    size_t question = target.find('?');
+    if (question != std::string::npos) {
+        for (const std::string& pair : split(target.substr(question + 1), '&')) {
+            size_t equals = pair.find('=');
+            if (equals != std::string::npos) query[pair.substr(0, equals)] = pair.substr(equals + 1);
+        }
+        target = target.substr(0, question);
+    }
+
+    if (target == "/" || target == "/mandelbrot/" || target == "/julia/") {
+        respond(socket, 200, "text/html", kViewerPage, std::strlen(kViewerPage));
+        return;
+    }
+    if (target == "/stats") {
+        char json[256];
+        int length = std::snprintf(json, sizeof(json),
+                                   "{\"requests\": %ld, \"memory\": %ld, \"disk\": %ld, \"computed\": %ld, "
+                                   "\"prefetched\": %ld}\n",
+                                   stats.requests.load(), stats.memoryHits.load(), stats.diskHits.load(),
+                                   stats.computed.load(), stats.prefetched.load());
+        respond(socket, 200, "application/json", json, (size_t)length);
+        return;
+    }
+
+    // /{fractal}/{z}/{x}/{y}.{png|tile}
+    std::vector<std::string> parts = split(target, '/');
+    size_t dot = parts.size() == 5 ? parts[4].rfind('.') : std::string::npos;
+    TileKey key;
+    if (dot == std::string::npos || (parts[1] != "mandelbrot" && parts[1] != "julia")) {
+        respondText(socket, 404, "Expected /mandelbrot/{z}/{x}/{y}.png\n");
+        return;
+    }
+    std::string format = parts[4].substr(dot + 1);
+    key.kind = parts[1] == "julia" ? FractalKind::Julia : FractalKind::Mandelbrot;
+    long z = 0, maxIter = options.maxIter;
+    if (!parseLong(parts[2], z) || !parseLong(parts[3], key.x) || !parseLong(parts[4].substr(0, dot), key.y) ||
+        (query.count("iter") && !parseLong(query["iter"], maxIter)) || z < 0 || z > kMaxTileZoom ||
+        maxIter > 65535) {
+        respondText(socket, 404, "No such tile\n");
+        return;
+    }
+    key.z = (int)z;
+    key.maxIter = (int)maxIter;
+    if (key.kind == FractalKind::Julia) {
+        // julia.cpp's default constant
+        key.juliaX = -0.8f;
+        key.juliaY = 0.156f;
+        if (query.count("c") && std::sscanf(query["c"].c_str(), "%f,%f", &key.juliaX, &key.juliaY) != 2) {
+            respondText(socket, 400, "Expected c=RE,IM\n");
+            return;
+        }
+    }
+    if (!key.valid() || (format != "png" && format != "tile")) {
+        respondText(socket, 404, "No such tile\n");
+        return;
+    }
+
+    TileSource source;
+    TilePtr counts = store.get(key, &source);
+    if (source == TileSource::Memory) stats.memoryHits++;
+    else if (source == TileSource::Disk) stats.diskHits++;
+    else stats.computed++;
+    prefetcher.observe(client, key);
+
+    // Tiles never change, so browsers may keep them
+    std::string headers = "Cache-Control: public, max-age=31536000, immutable\r\n";
+    if (format == "tile") {
+        std::vector<uint8_t> encoded;
+        encodeTile(*counts, encoded);
+        headers += "X-Tile-Size: " + std::to_string(kTileSize) + "\r\nX-Max-Iter: " + std::to_string(key.maxIter) +
+                   "\r\n";
+        respond(socket, 200, "application/octet-stream", encoded.data(), encoded.size(), headers);
+        return;
+    }
+    bool juliaPalette = query.count("palette") ? query["palette"] == "julia" : key.kind == FractalKind::Julia;
+    double shift = query.count("shift") ? std::atof(query["shift"].c_str()) : 0.0;
+    bool pattern = !query.count("pattern") || query["pattern"] != "0";
+    Image image;
+    colourTile(key, *counts, juliaPalette ? kJuliaPalette : kWarmPalette, shift, pattern, image);
+    std::vector<uint8_t> png;
+    encodePng(image, png);
+    respond(socket, 200, "image/png", png.data(), png.size(), headers);
+}
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    if (!parseOptions(argc, argv, options)) return -1;
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)options.port);
+    if (listener < 0 || inet_pton(AF_INET, options.bind.c_str(), &address.sin_addr) != 1 ||
+        bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        std::cerr << "Failed to listen on " << options.bind << ":" << options.port << std::endl;
+        return -1;
+    }
+
+    TileStore store(options.cacheDir, options.memoryTiles, options.simd);
+    ServerStats stats;
+    Prefetcher prefetcher(store, stats, options.prefetchThreads);
+    std::printf("Serving tiles on http://%s:%d/ (cache %s, %zu tiles in memory, %s kernels)\n",
+                options.bind.c_str(), options.port, options.cacheDir.c_str(), options.memoryTiles,
+                simdLevelName(options.simd));
+    std::fflush(stdout);
+
+    for (;;) {
+        sockaddr_in peer = {};
+        socklen_t peerSize = sizeof(peer);
+        int connection = accept(listener, (sockaddr*)&peer, &peerSize);
+        if (connection < 0) continue;
+        char client[INET_ADDRSTRLEN] = "";
+        inet_ntop(AF_INET, &peer.sin_addr, client, sizeof(client));
+        std::thread([=, &options, &store, &prefetcher, &stats] {
+            handleConnection(connection, client, options, store, prefetcher, stats);
+            close(connection);
+        }).detach();
+    }
+}
@@ -0,0 +1,419 @@
+#pragma once
+
+// Video export for headless runs. Rendered frames are copied into a pool of
+// preallocated buffers and handed through a bounded single-producer,
+// single-consumer queue to a writer thread, which converts them to YUV 4:2:0
+// and streams them as Y4M into a file, stdout or a local encoder process.
+// The render thread only waits when every buffer is queued.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "escape_time.h"
+
+// Lock-free bounded queue between exactly one producer and one consumer.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : items(capacity + 1) {}
+
+    bool push(const T& item) {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % items.size();
+        if (next == headIndex.load(std::memory_order_acquire)) return false;
+        items[tail] = item;
+        tailIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire)) return false;
+        item = items[head];
+        headIndex.store((head + 1) % items.size(), std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> items;
+    alignas(64) std::atomic<size_t> headIndex{0};
+    alignas(64) std::atomic<size_t> tailIndex{0};
+};
+
+// Waits for a queue without burning a core: spins briefly, then yields,
+// then sleeps.
+class Backoff {
+public:
+    void wait() {
+        if (rounds < 64) {
+            rounds++;
+        } else if (rounds < 128) {
+            rounds++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+private:
+    int rounds = 0;
+};
+
+// RGB to BT.709 limited range YUV in 8-bit fixed point. Chroma is the
+// average of each 2x2 block (JPEG siting).
+constexpr int kLumaR = 47, kLumaG = 157, kLumaB = 16;
+constexpr int kCbR = -26, kCbG = -86, kCbB = 112;
+constexpr int kCrR = 112, kCrG = -102, kCrB = -10;
+
+inline uint8_t lumaOf(int r, int g, int b) {
+    return (uint8_t)(((kLumaR * r + kLumaG * g + kLumaB * b + 128) >> 8) + 16);
+}
+inline uint8_t cbOf(int r, int g, int b) { return (uint8_t)(((kCbR * r + kCbG * g + kCbB * b + 128) >> 8) + 128); }
+inline uint8_t crOf(int r, int g, int b) { return (uint8_t)(((kCrR * r + kCrG * g + kCrB * b + 128) >> 8) + 128); }
+
+// Converts columns [x0, x1) (x0 even) of the row pair top, bottom (bottom
+// may equal top on the last row of an odd height) to two luma rows and one
+// chroma row.
+inline void rgbaToYuvPairScalar(const uint8_t* top, const uint8_t* bottom, int x0, int x1, int width, uint8_t* yTop,
+                                uint8_t* yBottom, uint8_t* u, uint8_t* v) {
+    for (int x = x0; x < x1; x += 2) {
+        int r = 0, g = 0, b = 0;
+        for (int dx = 0; dx < 2; dx++) {
+            // An odd width repeats the last column
+            int xs = std::min(x + dx, width - 1);
+            const uint8_t* p = top + xs * 4;
+            const uint8_t* q = bottom + xs * 4;
+            if (x + dx < width) {
+                yTop[x + dx] = lumaOf(p[0], p[1], p[2]);
+                yBottom[x + dx] = lumaOf(q[0], q[1], q[2]);
+            }
+            r += p[0] + q[0];
+            g += p[1] + q[1];
+            b += p[2] + q[2];
+        }
+        r = (r + 2) >> 2;
+        g = (g + 2) >> 2;
+        b = (b + 2) >> 2;
+        u[x / 2] = cbOf(r, g, b);
+        v[x / 2] = crOf(r, g, b);
+    }
+}
+
+#ifdef FRACTALS_X86
+// 8 RGBA pixels as 16-bit R, G and B lanes
+inline void unpackRgbaSse2(const uint8_t* p, __m128i& r, __m128i& g, __m128i& b) {
+    __m128i a0 = _mm_loadu_si128((const __m128i*)p);
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 16));
+    __m128i mask = _mm_set1_epi32(0xFF);
+    r = _mm_packs_epi32(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 8), mask), _mm_and_si128(_mm_srli_epi32(a1, 8), mask));
+    b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 16), mask), _mm_and_si128(_mm_srli_epi32(a1, 16), mask));
+}
+
+// The sums stay below 65536, so unsigned 16-bit arithmetic is exact
+inline __m128i lumaSse2(__m128i r, __m128i g, __m128i b) {
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kLumaR)),
+                                              _mm_mullo_epi16(g, _mm_set1_epi16(kLumaG))),
+                                _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(kLumaB)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+// Averaged components stay within +-112 * 255, signed 16-bit is exact
+inline __m128i chromaSse2(__m128i r, __m128i g, __m128i b, int kr, int kg, int kb) {
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16((short)kr)),
+                                              _mm_mullo_epi16(g, _mm_set1_epi16((short)kg))),
+                                _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16((short)kb)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+// Rounded averages of the 2x2 blocks of two 8 pixel row pairs
+inline __m128i average2x2Sse2(__m128i topA, __m128i bottomA, __m128i topB, __m128i bottomB) {
+    __m128i ones = _mm_set1_epi16(1);
+    __m128i sums = _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(topA, bottomA), ones),
+                                   _mm_madd_epi16(_mm_add_epi16(topB, bottomB), ones));
+    return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+// 16 pixels of a row pair per step
+inline int rgbaToYuvPairSse2(const uint8_t* top, const uint8_t* bottom, int width, uint8_t* yTop,
+                             uint8_t* yBottom, uint8_t* u, uint8_t* v) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i r[4], g[4], b[4];
+        unpackRgbaSse2(top + x * 4, r[0], g[0], b[0]);
+        unpackRgbaSse2(top + x * 4 + 32, r[1], g[1], b[1]);
+        unpackRgbaSse2(bottom + x * 4, r[2], g[2], b[2]);
+        unpackRgbaSse2(bottom + x * 4 + 32, r[3], g[3], b[3]);
+        _mm_storeu_si128((__m128i*)(yTop + x),
+                         _mm_packus_epi16(lumaSse2(r[0], g[0], b[0]), lumaSse2(r[1], g[1], b[1])));
+        _mm_storeu_si128((__m128i*)(yBottom + x),
+                         _mm_packus_epi16(lumaSse2(r[2], g[2], b[2]), lumaSse2(r[3], g[3], b[3])));
+
+        __m128i ra = average2x2Sse2(r[0], r[2], r[1], r[3]);
+        __m128i ga = average2x2Sse2(g[0], g[2], g[1], g[3]);
+        __m128i ba = average2x2Sse2(b[0], b[2], b[1], b[3]);
+        __m128i zero = _mm_setzero_si128();
+        _mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(chromaSse2(ra, ga, ba, kCbR, kCbG, kCbB), zero));
+        _mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(chromaSse2(ra, ga, ba, kCrR, kCrG, kCrB), zero));
+    }
+    return x;
+}
+
+// 256-bit packs work per 128-bit half; this restores the lane order
+__attribute__((target("avx2")))
+inline __m256i inOrderAvx2(__m256i packed) {
+    return _mm256_permute4x64_epi64(packed, 0xD8);
+}
+
+__attribute__((target("avx2")))
+inline void unpackRgbaAvx2(const uint8_t* p, __m256i& r, __m256i& g, __m256i& b) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i*)p);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+    __m256i mask = _mm256_set1_epi32(0xFF);
+    r = inOrderAvx2(_mm256_packs_epi32(_mm256_and_si256(a0, mask), _mm256_and_si256(a1, mask)));
+    g = inOrderAvx2(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a0, 8), mask),
+                                       _mm256_and_si256(_mm256_srli_epi32(a1, 8), mask)));
+    b = inOrderAvx2(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a0, 16), mask),
+                                       _mm256_and_si256(_mm256_srli_epi32(a1, 16), mask)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i lumaAvx2(__m256i r, __m256i g, __m256i b) {
+    __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(kLumaR)),
+                                                    _mm256_mullo_epi16(g, _mm256_set1_epi16(kLumaG))),
+                                   _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(kLumaB)),
+                                                    _mm256_set1_epi16(128)));
+    return _mm256_add_epi16(_mm256_srli_epi16(sum, 8), _mm256_set1_epi16(16));
+}
+
+__attribute__((target("avx2")))
+inline __m256i chromaAvx2(__m256i r, __m256i g, __m256i b, int kr, int kg, int kb) {
+    __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16((short)kr)),
+                                                    _mm256_mullo_epi16(g, _mm256_set1_epi16((short)kg))),
+                                   _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16((short)kb)),
+                                                    _mm256_set1_epi16(128)));
+    return _mm256_add_epi16(_mm256_srai_epi16(sum, 8), _mm256_set1_epi16(128));
+}
+
+__attribute__((target("avx2")))
+inline __m256i average2x2Avx2(__m256i topA, __m256i bottomA, __m256i topB, __m256i bottomB) {
+    __m256i ones = _mm256_set1_epi16(1);
+    __m256i sums = inOrderAvx2(_mm256_packs_epi32(_mm256_madd_epi16(_mm256_add_epi16(topA, bottomA), ones),
+                                                  _mm256_madd_epi16(_mm256_add_epi16(topB, bottomB), ones)));
+    return _mm256_srli_epi16(_mm256_add_epi16(sums, _mm256_set1_epi16(2)), 2);
+}
+
+// 32 pixels of a row pair per step
+__attribute__((target("avx2")))
+inline int rgbaToYuvPairAvx2(const uint8_t* top, const uint8_t* bottom, int width, uint8_t* yTop,
+                             uint8_t* yBottom, uint8_t* u, uint8_t* v) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i r[4], g[4], b[4];
+        unpackRgbaAvx2(top + x * 4, r[0], g[0], b[0]);
+        unpackRgbaAvx2(top + x * 4 + 64, r[1], g[1], b[1]);
+        unpackRgbaAvx2(bottom + x * 4, r[2], g[2], b[2]);
+        unpackRgbaAvx2(bottom + x * 4 + 64, r[3], g[3], b[3]);
+        _mm256_storeu_si256((__m256i*)(yTop + x),
+                            inOrderAvx2(_mm256_packus_epi16(lumaAvx2(r[0], g[0], b[0]), lumaAvx2(r[1], g[1], b[1]))));
+        _mm256_storeu_si256((__m256i*)(yBottom + x),
+                            inOrderAvx2(_mm256_packus_epi16(lumaAvx2(r[2], g[2], b[2]), lumaAvx2(r[3], g[3], b[3]))));
+
+        __m256i ra = average2x2Avx2(r[0], r[2], r[1], r[3]);
+        __m256i ga = average2x2Avx2(g[0], g[2], g[1], g[3]);
+        __m256i ba = average2x2Avx2(b[0], b[2], b[1], b[3]);
+        __m256i cb = chromaAvx2(ra, ga, ba, kCbR, kCbG, kCbB);
+        __m256i cr = chromaAvx2(ra, ga, ba, kCrR, kCrG, kCrB);
+        _mm_storeu_si128((__m128i*)(u + x / 2), _mm256_castsi256_si128(inOrderAvx2(_mm256_packus_epi16(cb, cb))));
+        _mm_storeu_si128((__m128i*)(v + x / 2), _mm256_castsi256_si128(inOrderAvx2(_mm256_packus_epi16(cr, cr))));
+    }
+    return x;
+}
+#endif
+
+// Converts a bottom-up RGBA frame (as read back from GL) into top-down
+// I420 planes: width x height luma, then (width+1)/2 x (height+1)/2 Cb and Cr.
+// AVX-512 machines use the AVX2 path; the conversion is bound by memory.
+inline void rgbaToI420(const uint8_t* rgba, int width, int height, uint8_t* yuv, SimdLevel level) {
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+    uint8_t* yPlane = yuv;
+    uint8_t* uPlane = yPlane + (size_t)width * height;
+    uint8_t* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+    auto sourceRow = [&](int y) { return rgba + (size_t)(height - 1 - y) * width * 4; };
+
+    for (int y = 0; y < height; y += 2) {
+        int y1 = std::min(y + 1, height - 1);
+        const uint8_t* top = sourceRow(y);
+        const uint8_t* bottom = sourceRow(y1);
+        uint8_t* yTop = yPlane + (size_t)y * width;
+        // The luma of a repeated last row is written twice, to the same place
+        uint8_t* yBottom = yPlane + (size_t)y1 * width;
+        uint8_t* u = uPlane + (size_t)(y / 2) * chromaWidth;
+        uint8_t* v = vPlane + (size_t)(y / 2) * chromaWidth;
+        int done = 0;
+#ifdef FRACTALS_X86
+        if (level == SimdLevel::Avx512 || level == SimdLevel::Avx2)
+            done = rgbaToYuvPairAvx2(top, bottom, width, yTop, yBottom, u, v);
+        else if (level == SimdLevel::Sse2)
+            done = rgbaToYuvPairSse2(top, bottom, width, yTop, yBottom, u, v);
+#else
+        (void)level;
+#endif
+        rgbaToYuvPairScalar(top, bottom, done, width + (width & 1), width, yTop, yBottom, u, v);
+    }
+}
+
+// Streams frames as Y4M. The target is a file, "-" for stdout or
+// "|command" for an encoder reading Y4M on its stdin, e.g.
+// "|ffmpeg -y -i - -c:v libx264 zoom.mp4".
+class VideoWriter {
+public:
+    ~VideoWriter() { close(); }
+
+    // queueFrames buffers (of one RGBA frame each) are allocated up front.
+    bool open(const std::string& target, int w, int h, double fps, int queueFrames) {
+        width = w;
+        height = h;
+        piped = !target.empty() && target[0] == '|';
+        if (piped) {
+            // A failing encoder should surface as a write error, not kill us
+            std::signal(SIGPIPE, SIG_IGN);
+            file = popen(target.c_str() + 1, "w");
+        } else {
+            file = target == "-" ? stdout : std::fopen(target.c_str(), "wb");
+        }
+        if (!file) {
+            std::cerr << "Failed to open " << target << " for writing" << std::endl;
+            return false;
+        }
+
+        // Y4M wants the rate as a fraction
+        long rateNum = std::lround(fps * 1000.0), rateDen = 1000;
+        while (rateNum % 10 == 0 && rateDen % 10 == 0) {
+            rateNum /= 10;
+            rateDen /= 10;
+        }
+        std::fprintf(file, "YUV4MPEG2 W%d H%d F%ld:%ld Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=LIMITED\n",
+                     width, height, rateNum, rateDen);
+
+        frameBytes = (size_t)width * height * 4;
+        pool.assign(queueFrames, std::vector<uint8_t>(frameBytes));
+        yuv.resize((size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2));
+        queued = std::make_unique<SpscQueue<int>>(queueFrames);
+        available = std::make_unique<SpscQueue<int>>(queueFrames);
+        for (int i = 0; i < queueFrames; i++) available->push(i);
+        simd = detectSimdLevel();
+        closing = false;
+        failed = false;
+        writer = std::thread([this] { writeLoop(); });
+        return true;
+    }
+
+    // Copies a bottom-up RGBA frame into the queue. Waits only when every
+    // buffer is queued; returns false once writing failed.
+    bool submit(const uint8_t* rgba) {
+        if (failed) return false;
+        int index;
+        if (!available->pop(index)) {
+            auto start = std::chrono::steady_clock::now();
+            Backoff backoff;
+            while (!available->pop(index)) {
+                if (failed) return false;
+                backoff.wait();
+            }
+            stallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            stalledFrames++;
+        }
+        std::memcpy(pool[index].data(), rgba, frameBytes);
+        queued->push(index);
+        submitted++;
+        return true;
+    }
+
+    // Writes the queued frames and closes the output; returns false if any
+    // frame could not be written (or the encoder failed).
+    bool close() {
+        if (!file) return !failed;
+        closing = true;
+        writer.join();
+        bool ok = !failed;
+        if (piped) {
+            int status = pclose(file);
+            if (status != 0) {
+                std::cerr << "Encoder exited with status " << status << std::endl;
+                ok = false;
+            }
+        } else if (file == stdout) {
+            std::fflush(stdout);
+        } else if (std::fclose(file) != 0) {
+            ok = false;
+        }
+        file = nullptr;
+        std::cerr << "video: " << written << " of " << submitted << " frames written, render thread waited "
+                  << stalledFrames << " times (" << stallMs << " ms)" << std::endl;
+        return ok;
+    }
+
+private:
+    void writeLoop() {
+        std::string frameHeader = "FRAME\n";
+        Backoff backoff;
+        for (;;) {
+            int index = -1;
+            if (!queued->pop(index)) {
+                // close() sets closing after the last push, so once it is
+                // set an empty queue stays empty
+                if (!closing) {
+                    backoff.wait();
+                    continue;
+                }
+                if (!queued->pop(index)) return;
+            }
+            backoff = Backoff();
+            if (!failed) {
+                rgbaToI420(pool[index].data(), width, height, yuv.data(), simd);
+                bool ok = std::fwrite(frameHeader.data(), 1, frameHeader.size(), file) == frameHeader.size() &&
+                          std::fwrite(yuv.data(), 1, yuv.size(), file) == yuv.size();
+                if (ok) {
+                    written++;
+                } else {
+                    std::cerr << "Failed to write video frame " << written << std::endl;
+                    failed = true;
+                }
+            }
+            available->push(index);
+        }
+    }
+
+    FILE* file = nullptr;
+    bool piped = false;
+    int width = 0;
+    int height = 0;
+    size_t frameBytes = 0;
+    SimdLevel simd = SimdLevel::Scalar;
+
+    std::vector<std::vector<uint8_t>> pool;
+    std::vector<uint8_t> yuv;       // Writer thread's conversion buffer
+    std::unique_ptr<SpscQueue<int>> queued;    // Render thread -> writer
+    std::unique_ptr<SpscQueue<int>> available; // Writer -> render thread
+    std::thread writer;
+    std::atomic<bool> closing{false};
+    std::atomic<bool> failed{false};
+
+    long submitted = 0;
+    long stalledFrames = 0;
+    double stallMs = 0.0;
+    long written = 0;
+};